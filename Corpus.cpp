@@ -0,0 +1,557 @@
+#include "Corpus.h"
+#include "Pipeline.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+
+namespace {
+    class TopK { // the k best matches so far, kept as a heap with the worst of them on top
+        vector<Match>& heap;
+        size_t k;
+        bool ascending; // lower scores are better (kdtree)
+
+        bool better(float a, float b) const { return ascending ? a < b : a > b; };
+        bool worse(const Match& a, const Match& b) const { return better(a.score, b.score); };
+
+    public:
+        TopK(vector<Match>& heap_, size_t k_, bool ascending_) : heap(heap_), k(k_), ascending(ascending_) { heap.clear(); };
+        bool full() const { return heap.size() >= k; };
+        float kth() const { return full() && k > 0 ? heap.front().score : ascending ? INFINITY : 0.0f; }; // the score to beat, the worst possible until full
+        bool offer(Match&& match) { // false if it didn't make it in
+            if (k == 0 || (full() && !better(match.score, kth()))) return false;
+            auto order = [this](const Match& a, const Match& b) { return worse(a, b); };
+            if (full()) {
+                pop_heap(heap.begin(), heap.end(), order);
+                heap.pop_back();
+            }
+            heap.push_back(std::move(match));
+            push_heap(heap.begin(), heap.end(), order);
+            return true;
+        };
+        void finish() { sort_heap(heap.begin(), heap.end(), [this](const Match& a, const Match& b) { return worse(a, b); }); }; // best first
+    };
+
+    uint64_t scoreParameters(bool kdtree) { // everything a pair's score depends on besides the two point sets
+        const char* algorithm = kdtree ? "kdtree" : "octree";
+        float tolerance = kdtree ? 0.0f : OCT_TOLERANCE;
+        return hashBytes(&tolerance, sizeof(tolerance), hashBytes(algorithm, strlen(algorithm), SCORE_VERSION));
+    }
+
+    // the score a comparison bounded by kth would be judged by, when what the cache knows about the pair settles it
+    bool settled(const CachedScore& cached, bool kdtree, float kth, float& score) {
+        if (cached.bound == ScoreBound::Exact) score = cached.value;
+        else if (kdtree && cached.bound == ScoreBound::AtLeast && cached.value >= kth) score = INFINITY; // known to be past kth
+        else if (!kdtree && cached.bound == ScoreBound::AtMost && cached.value < kth) score = cached.value; // known to fall short
+        else return false;
+        return true;
+    }
+
+    CachedScore learned(bool kdtree, float kth, float score) { // what a comparison bounded by kth that gave score tells about the pair
+        if (kdtree) return score == INFINITY ? CachedScore{kth, ScoreBound::AtLeast} : CachedScore{score, ScoreBound::Exact};
+        return score >= kth ? CachedScore{score, ScoreBound::Exact} : CachedScore{score, ScoreBound::AtMost}; // stopped below the floor
+    }
+
+    string readFile(const filesystem::path& path) { // empty if it can't be read
+        ifstream in(path, ios::binary);
+        string bytes;
+        if (!in) return bytes;
+        in.seekg(0, ios::end);
+        bytes.resize(static_cast<size_t>(in.tellg()));
+        in.seekg(0);
+        in.read(bytes.data(), static_cast<streamsize>(bytes.size()));
+        return in ? bytes : string();
+    }
+}
+
+string searchStatsJson(const SearchStats& stats) {
+    ostringstream out;
+    out << "{\"candidates\": " << stats.candidates << ", \"refined\": " << stats.refined << ", \"cut_off\": " << stats.cutOff
+        << ", \"cached\": " << stats.cached << ", \"interrupted\": " << stats.interrupted << ", \"skipped\": " << stats.skipped
+        << ", \"estimated\": " << stats.estimated << ", \"deadline_hit\": " << (stats.deadlineHit ? "true" : "false") << "}";
+    return out.str();
+}
+
+unique_ptr<Corpus::Model> Corpus::buildModel(const string& path, const string& name) const {
+    Mesh mesh;
+    if (!loadMesh(path, mesh, sampling.mode != SampleMode::None)) return nullptr; // faces are only needed to fill sparse meshes
+    return buildModel(std::move(mesh), name);
+}
+
+unique_ptr<Corpus::Model> Corpus::buildModel(Mesh&& mesh, const string& name) const {
+    if (mesh.vertices.empty()) return nullptr;
+    auto model = make_unique<Model>();
+    model->name = name;
+    model->vertexCount = mesh.vertices.size();
+    model->faceCount = mesh.faceCount;
+    Point center;
+    float scale;
+    Quantizer grid;
+    preprocess(mesh, sampling, center, scale, &grid); // same frame, point budget and grid as the models of a prebuilt index
+    ScopedTimer timer(Counter::BuildNanos);
+    model->kdtree = fillKD(mesh.vertices);
+    model->octree = fillOct(mesh.vertices);
+    model->pyramid = Pyramid(model->octree);
+    model->descriptor = describe(mesh.vertices.data(), mesh.vertices.size());
+    model->contentHash = contentHash(model->kdtree.points(), model->kdtree.pointCount());
+    if (sampling.bits > 0) { // the points lie on the grid, so the codes hold them exactly
+        model->kdtree.compact(grid);
+        model->octree.compact(grid, sampling.delta);
+    }
+    return model;
+}
+
+void Corpus::scanFiles(const vector<OffFile>& paths, const char* lastStage, const ModelSink& sink) {
+    report = make_unique<PipelineReport>();
+    report->stages[3].name = lastStage;
+    StageCounter &reading = report->stages[0], &parsing = report->stages[1], &building = report->stages[2], &sinking = report->stages[3];
+    size_t readers = min<size_t>(2, paths.size()), workers = ThreadPool::cores();
+    report->readers = readers;
+    report->workers = workers;
+    auto start = chrono::steady_clock::now();
+
+    // small queues, at most a few files per thread are ever in flight
+    BoundedQueue<pair<size_t, string>> read(2 * workers);
+    BoundedQueue<pair<size_t, Mesh>> parsed(2 * workers);
+    BoundedQueue<pair<size_t, unique_ptr<Model>>> built(2 * workers);
+    atomic<size_t> nextFile{0}, finished{0};
+    // a thread that finds nothing to do yields a few times, then sleeps until a push (or the last file) wakes it: a cold scan is
+    // mostly waiting on the disk and spinning workers would only take the cores from the readers
+    const size_t IDLE_SPINS = 64;
+    Wakeup work, space; // something was pushed or the last file finished, the read queue has room again
+
+    // a stage whose output queue is full runs the next stage itself, so nothing ever waits on a full queue
+    auto sinkModel = [&](pair<size_t, unique_ptr<Model>>& item, ThreadPool& pool) {
+        sinking.time([&] { sink(item.first, std::move(item.second), pool); return true; });
+        if (++finished == paths.size()) work.notify();
+    };
+    auto buildMesh = [&](pair<size_t, Mesh>& item, ThreadPool& pool) {
+        const string& name = paths[item.first].name; // same form as the backend's model filenames
+        pair<size_t, unique_ptr<Model>> model{item.first, building.time([&] { return buildModel(std::move(item.second), name); })};
+        if (built.tryPush(model)) work.notify();
+        else sinkModel(model, pool);
+    };
+    auto parseFile = [&](pair<size_t, string>& item, ThreadPool& pool) {
+        pair<size_t, Mesh> mesh{item.first, Mesh()};
+        parsing.time([&] { return parseMesh(item.second.data(), item.second.size(), mesh.second, sampling.mode != SampleMode::None) || (mesh.second.vertices.clear(), false); });
+        if (parsed.tryPush(mesh)) work.notify();
+        else buildMesh(mesh, pool);
+    };
+
+    vector<thread> threads;
+    for (size_t r = 0; r < readers; ++r) {
+        threads.emplace_back([&] {
+            for (size_t i = nextFile++; i < paths.size(); i = nextFile++) {
+                pair<size_t, string> item{i, reading.time([&] { return readFile(paths[i].path); })};
+                reading.bytes += item.second.size();
+                for (size_t idle = 0;; ++idle) {
+                    uint32_t ticket = space.ticket();
+                    if (read.tryPush(item)) break;
+                    if (idle < IDLE_SPINS) this_thread::yield();
+                    else space.wait(ticket);
+                }
+                work.notify();
+            }
+        });
+    }
+    for (size_t w = 0; w < workers; ++w) {
+        threads.emplace_back([&] {
+            ThreadPool inlinePool(1); // every core already runs a pipeline worker, so comparisons stay on this thread
+            pair<size_t, string> file;
+            pair<size_t, Mesh> mesh;
+            pair<size_t, unique_ptr<Model>> model;
+            size_t idle = 0;
+            while (finished.load() < paths.size()) { // take work from the latest stage that has some, so files drain before new ones pile up
+                uint32_t ticket = work.ticket();
+                if (built.tryPop(model)) sinkModel(model, inlinePool);
+                else if (parsed.tryPop(mesh)) buildMesh(mesh, inlinePool);
+                else if (read.tryPop(file)) {
+                    space.notify();
+                    parseFile(file, inlinePool);
+                } else {
+                    if (idle++ < IDLE_SPINS) this_thread::yield();
+                    else if (finished.load() < paths.size()) work.wait(ticket);
+                    continue;
+                }
+                idle = 0;
+            }
+        });
+    }
+    for (thread& t : threads) t.join();
+    report->seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+vector<OffFile> Corpus::shardFiles(const string& directory) const {
+    vector<OffFile> paths = offFiles(directory);
+    if (shards > 1) paths.erase(remove_if(paths.begin(), paths.end(), [this](const OffFile& file) { return !inShard(file.name); }), paths.end());
+    return paths;
+}
+
+bool Corpus::load(const string& directory) {
+    if (!filesystem::is_directory(directory)) return false;
+    root = directory;
+    vector<OffFile> paths = shardFiles(directory);
+    vector<ModelFile> files(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) fileStamp(paths[i].path, files[i].size, files[i].modified); // before any file is read
+    vector<unique_ptr<Model>> loaded(paths.size());
+    scanFiles(paths, "keep", [&](size_t i, unique_ptr<Model> model, ThreadPool&) { loaded[i] = std::move(model); });
+    auto next = make_shared<Snapshot>();
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (!loaded[i]) continue;
+        next->byName[loaded[i]->name] = next->models.size();
+        next->descriptors.push_back(loaded[i]->descriptor);
+        next->files.push_back(files[i]);
+        next->models.push_back(std::move(loaded[i]));
+    }
+    publish(std::move(next));
+    index.close(); // nothing points into it any more
+    return true;
+}
+
+bool Corpus::refresh(const string& directory, RefreshReport& report) {
+    report = RefreshReport();
+    if (!filesystem::is_directory(directory)) return false;
+    lock_guard<mutex> guard(refreshLock);
+    auto start = chrono::steady_clock::now();
+    shared_ptr<const Snapshot> old = snapshot();
+    vector<OffFile> paths = shardFiles(directory);
+    vector<ModelFile> files(paths.size());
+    vector<shared_ptr<const Model>> fresh(paths.size());
+    vector<size_t> previous(paths.size(), SIZE_MAX); // position of the model of the same name in the old snapshot
+    vector<bool> found(old->models.size(), false);
+    vector<size_t> stale; // files to load
+    for (size_t i = 0; i < paths.size(); ++i) {
+        fileStamp(paths[i].path, files[i].size, files[i].modified);
+        auto known = old->byName.find(paths[i].name);
+        if (known != old->byName.end()) {
+            previous[i] = known->second;
+            found[known->second] = true;
+        }
+        if (previous[i] != SIZE_MAX && old->files[previous[i]] == files[i]) fresh[i] = old->models[previous[i]];
+        else stale.push_back(i);
+    }
+
+    // threads of its own: the shared pool takes one parallelFor at a time and searches going on meanwhile must not wait for this
+    atomic<size_t> nextStale{0};
+    vector<thread> builders;
+    for (size_t t = 0; t < min<size_t>(stale.size(), ThreadPool::cores()); ++t) {
+        builders.emplace_back([&] {
+            for (size_t s = nextStale++; s < stale.size(); s = nextStale++) fresh[stale[s]] = buildModel(paths[stale[s]].path.string(), paths[stale[s]].name);
+        });
+    }
+    for (thread& builder : builders) builder.join();
+    for (size_t i : stale) {
+        if (previous[i] == SIZE_MAX) (fresh[i] ? report.added : report.unreadable)++;
+        else if (fresh[i] && fresh[i]->contentHash == old->models[previous[i]]->contentHash) {
+            fresh[i] = old->models[previous[i]]; // only touched, the trees (and their cached scores) stay
+            report.touched++;
+        } else (fresh[i] ? report.changed : report.removed)++; // a file that can't be read any more (or just went) drops its model
+    }
+    report.removed += static_cast<size_t>(count(found.begin(), found.end(), false));
+
+    if (report.added + report.changed + report.removed + report.touched > 0) {
+        auto next = make_shared<Snapshot>();
+        next->models.reserve(paths.size());
+        for (size_t i = 0; i < paths.size(); ++i) {
+            if (!fresh[i]) continue;
+            next->byName[paths[i].name] = next->models.size();
+            next->descriptors.push_back(fresh[i]->descriptor);
+            next->files.push_back(files[i]);
+            next->models.push_back(std::move(fresh[i]));
+        }
+        publish(std::move(next)); // searches started before keep the old snapshot (and its models) until they finish
+    }
+    report.models = size();
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+bool Corpus::scan(const string& directory, const string& source, const string& algorithm, size_t k, vector<Match>& results) {
+    results.clear();
+    bool kdtree = algorithm == "kdtree";
+    if ((!kdtree && algorithm != "octree") || !filesystem::is_directory(directory)) return false;
+    unique_ptr<Model> query = buildModel(source, source);
+    if (!query) return false;
+
+    vector<OffFile> paths = offFiles(directory);
+    TopK best(results, k, kdtree);
+    mutex bestLock;
+    scanFiles(paths, "compare", [&](size_t i, unique_ptr<Model> model, ThreadPool& pool) {
+        std::error_code error;
+        if (!model || filesystem::equivalent(paths[i].path, source, error)) return; // never report the source as its own match
+        float kth;
+        {
+            lock_guard<mutex> guard(bestLock);
+            kth = best.kth();
+        }
+        float score;
+        if (!cachedScore(*query, *model, kdtree, kth, score)) score = compare(*query, *model, kdtree, kth, pool);
+        lock_guard<mutex> guard(bestLock); // kth only gets better meanwhile, so a score cut off by it is turned away here
+        best.offer({i, model->name, score, model->vertexCount, model->faceCount});
+    });
+    best.finish();
+    scores.flush();
+    return true;
+}
+
+unique_ptr<Corpus::Model> Corpus::indexModel(size_t i) const {
+    const IndexModel& entry = index.model(i);
+    auto model = make_unique<Model>();
+    model->name = index.name(i);
+    model->vertexCount = entry.vertexCount;
+    model->faceCount = entry.faceCount;
+    model->kdtree = KDTree<>::view(index.kdNodes(i), entry.kdNodeCount, index.vertices(i), entry.pointCount, index.leaves(i));
+    model->octree = Octree::view(index.octNodes(i), entry.octNodeCount, index.octPoints(i), entry.pointCount,
+                                 Point(entry.octOrigin[0], entry.octOrigin[1], entry.octOrigin[2]), entry.octSize,
+                                 index.occupancy(i), entry.occupancyWords);
+    model->pyramid = Pyramid(model->octree); // a few KB per model, cheap enough to derive on open
+    model->descriptor = index.descriptors()[i];
+    model->contentHash = entry.contentHash;
+    return model;
+}
+
+bool Corpus::loadIndex(const string& indexPath) {
+    publish(make_shared<const Snapshot>()); // the old models may point into the index about to be replaced
+    if (!index.open(indexPath)) return false;
+    root.clear();
+    sampling = index.sampling();
+    auto next = make_shared<Snapshot>();
+    for (size_t i = 0; i < index.size(); ++i) {
+        if (!inShard(index.name(i))) continue;
+        unique_ptr<Model> model = indexModel(i);
+        const IndexModel& entry = index.model(i);
+        next->descriptors.push_back(model->descriptor);
+        next->files.push_back({entry.fileSize, entry.modifiedTime});
+        next->byName[model->name] = next->models.size();
+        next->models.push_back(std::move(model));
+    }
+    publish(std::move(next));
+    return true;
+}
+
+unique_ptr<Corpus::Model> Corpus::otherShardModel(const string& name) const {
+    if (shards <= 1 || inShard(name)) return nullptr;
+    if (!root.empty()) {
+        filesystem::path path = filesystem::path(root) / name;
+        return filesystem::is_regular_file(path) ? buildModel(path.string(), name) : nullptr;
+    }
+    size_t low = 0, high = index.size(); // an index holds its models in name order
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (index.name(middle) < name) low = middle + 1;
+        else high = middle;
+    }
+    return low < index.size() && index.name(low) == name ? indexModel(low) : nullptr;
+}
+
+bool Corpus::search(const string& source, const string& algorithm, size_t k, vector<Match>& results, Deadline deadline) {
+    results.clear();
+    bool kdtree = algorithm == "kdtree";
+    if (!kdtree && algorithm != "octree") return false;
+
+    shared_ptr<const Snapshot> corpus = snapshot(); // held to the end, a refresh meanwhile publishes a new one
+    const Model* query = nullptr;
+    unique_ptr<Model> loaded;
+    string name = source;
+    auto found = corpus->byName.find(source);
+    string base = root.empty() && index.size() > 0 ? index.directory() : root; // an index remembers the directory it was built from
+    if (found == corpus->byName.end() && !base.empty()) { // a path pointing inside the corpus still reuses the resident trees
+        std::error_code error;
+        auto relative = filesystem::relative(source, base, error);
+        if (!error) found = corpus->byName.find(name = relative.generic_string());
+    }
+    if (found != corpus->byName.end()) query = corpus->models[found->second].get();
+    else {
+        loaded = otherShardModel(name);
+        if (!loaded && name != source) loaded = otherShardModel(source);
+        if (!loaded) loaded = buildModel(source, source);
+        query = loaded.get();
+    }
+    if (!query) return false;
+    rank(*corpus, *query, found != corpus->byName.end() ? found->second : SIZE_MAX, kdtree, k, results, deadline);
+    return true;
+}
+
+bool Corpus::search(Mesh&& mesh, const string& algorithm, size_t k, vector<Match>& results, Deadline deadline) {
+    results.clear();
+    bool kdtree = algorithm == "kdtree";
+    if (!kdtree && algorithm != "octree") return false;
+    unique_ptr<Model> query = buildModel(std::move(mesh), "query");
+    if (!query) return false;
+    rank(*snapshot(), *query, SIZE_MAX, kdtree, k, results, deadline);
+    return true;
+}
+
+void Corpus::rank(const Snapshot& corpus, const Model& query, size_t self, bool kdtree, size_t k, vector<Match>& results, Deadline deadline) {
+    // the descriptor scan picks the candidates, each gets a cheap bound from the coarsest grids, then they are refined best bound
+    // first and only while their bound can still beat the current kth best (and the deadline hasn't passed)
+    auto better = [kdtree](float a, float b) { return kdtree ? a < b : a > b; };
+    bool timed = deadline != NO_DEADLINE;
+    stats = SearchStats();
+    vector<uint32_t> candidates;
+    vector<pair<float, uint32_t>> order;
+    {
+        ScopedTimer timer(Counter::PrefilterNanos);
+        if (prefilter > 0 && prefilter < corpus.models.size()) { // self (the source's own model) is never reported as its own match
+            nearestDescriptors(query.descriptor, corpus.descriptors.data(), corpus.descriptors.size(), prefilter, self, candidates);
+        } else {
+            for (size_t i = 0; i < corpus.models.size(); ++i)
+                if (i != self) candidates.push_back(static_cast<uint32_t>(i));
+        }
+        uint64_t parameters = scoreParameters(kdtree);
+        for (size_t c = 0; c < candidates.size(); ++c) {
+            if (timed && c % 64 == 0 && chrono::steady_clock::now() >= deadline) { // the rest go without a bound, never to be compared
+                stats.skipped = candidates.size() - c;
+                stats.deadlineHit = true;
+                break;
+            }
+            uint32_t candidate = candidates[c];
+            const Model* model = corpus.models[candidate].get();
+            ScoreKey key = scoreKey(query.contentHash, model->contentHash, parameters);
+            CachedScore cached; // whatever the cache knows is a bound on the right side too, a pair seen before costs no tree work
+            float bound = scores.lookup(key, cached) ? cached.value // the grid bound is cheaper to redo than to cache, only compare() stores
+                        : kdtree ? query.pyramid.lowerBound(model->pyramid, 0)
+                                 : Octree::similarityBound(query.octree, model->octree, OCT_TOLERANCE, Pyramid::FIRST_DEPTH);
+            order.push_back({bound, candidate});
+        }
+        stable_sort(order.begin(), order.end(), [&](const auto& a, const auto& b) { return better(a.first, b.first); });
+    }
+    stats.candidates = candidates.size();
+    TopK best(results, k, kdtree);
+    vector<pair<float, uint32_t>> unsettled; // the deadline came before these were settled: their best estimate so far, candidate
+    for (const auto& [bound, candidate] : order) {
+        if (k == 0) break;
+        const Model* model = corpus.models[candidate].get();
+        bool full = best.full();
+        float kth = best.kth();
+        if (full && better(kth, bound)) break; // neither this candidate nor any after it can get in
+        float score;
+        bool cached = cachedScore(query, *model, kdtree, kth, score);
+        if (!cached) {
+            if (timed && chrono::steady_clock::now() >= deadline) { // past it only what the cache settles is still taken
+                stats.skipped++;
+                stats.deadlineHit = true;
+                unsettled.push_back({bound, candidate});
+                continue;
+            }
+            bool far = false;
+            for (int level = 1; kdtree && level < Pyramid::LEVELS && full && !far; ++level) far = query.pyramid.exceeds(model->pyramid, level, kth);
+            if (far) continue;
+            bool unfinished = false;
+            score = compare(query, *model, kdtree, kth, ThreadPool::shared(), deadline, &unfinished); // gives up once kth is out of reach
+            if (unfinished) { // score is a lower bound from the points compared so far
+                stats.refined++;
+                stats.interrupted++;
+                stats.deadlineHit = true;
+                unsettled.push_back({max(bound, score), candidate});
+                continue;
+            }
+        }
+        bool in = best.offer({candidate, model->name, score, model->vertexCount, model->faceCount});
+        if (cached) stats.cached++;
+        else {
+            stats.refined++;
+            if (!in) stats.cutOff++;
+        }
+    }
+    best.finish();
+    // short of k settled matches, the most promising unsettled candidates fill up the answer after them, scored with their estimate
+    stable_sort(unsettled.begin(), unsettled.end(), [&](const auto& a, const auto& b) { return better(a.first, b.first); });
+    for (size_t i = 0; i < unsettled.size() && results.size() < k; ++i, ++stats.estimated) {
+        const Model* model = corpus.models[unsettled[i].second].get();
+        results.push_back({unsettled[i].second, model->name, unsettled[i].first, model->vertexCount, model->faceCount});
+    }
+    scores.flush(); // one append per query
+}
+
+bool Corpus::cachedScore(const Model& a, const Model& b, bool kdtree, float kth, float& score) {
+    CachedScore cached;
+    if (!scores.lookup(scoreKey(a.contentHash, b.contentHash, scoreParameters(kdtree)), cached) || !settled(cached, kdtree, kth, score)) return false;
+    countStat(Counter::ScoreCacheHits, 1);
+    return true;
+}
+
+float Corpus::compare(const Model& a, const Model& b, bool kdtree, float kth, ThreadPool& pool, Deadline deadline, bool* unfinished) {
+    countStat(Counter::ScoreCacheMisses, 1);
+    float score;
+    bool stopped = false;
+    {
+        ScopedTimer timer(Counter::CompareNanos);
+        score = kdtree ? hausdorff(a.kdtree, b.kdtree, kth, pool, deadline, &stopped) : OctTreeScore(a.octree, b.octree, kth);
+    }
+    ScoreKey key = scoreKey(a.contentHash, b.contentHash, scoreParameters(kdtree));
+    scores.store(key, stopped ? CachedScore{score, ScoreBound::AtLeast} : learned(kdtree, kth, score)); // a stopped one still bounds the pair
+    if (unfinished) *unfinished = stopped;
+    return score;
+}
+
+vector<MatrixTile> Corpus::matrixTiles(size_t threads) const {
+    const size_t MATRIX_BLOCK_POINTS = 16384; // ~1 MB of kd tree and octree per block
+    size_t wanted = 1; // blocks, enough for a few tiles per thread: wanted * (wanted + 1) / 2 >= 4 * threads
+    while (wanted * (wanted + 1) / 2 < 4 * max<size_t>(threads, 1)) wanted++;
+    shared_ptr<const Snapshot> corpus = snapshot();
+    const auto& models = corpus->models;
+    size_t maxModels = max<size_t>((models.size() + wanted - 1) / wanted, 1);
+    vector<uint32_t> blockStarts;
+    size_t points = 0, inBlock = 0;
+    for (size_t i = 0; i < models.size(); ++i) {
+        size_t modelPoints = models[i]->kdtree.pointCount();
+        if (inBlock == 0 || points + modelPoints > MATRIX_BLOCK_POINTS || inBlock == maxModels) {
+            blockStarts.push_back(static_cast<uint32_t>(i));
+            points = 0;
+            inBlock = 0;
+        }
+        points += modelPoints;
+        inBlock++;
+    }
+    return ::matrixTiles(blockStarts, static_cast<uint32_t>(models.size()));
+}
+
+vector<string> Corpus::names() const {
+    vector<string> result;
+    for (const auto& model : snapshot()->models) result.push_back(model->name);
+    return result;
+}
+
+vector<Match> Corpus::models() const {
+    shared_ptr<const Snapshot> corpus = snapshot();
+    vector<Match> result;
+    for (size_t i = 0; i < corpus->models.size(); ++i) {
+        const Model& model = *corpus->models[i];
+        result.push_back({i, model.name, 0.0f, model.vertexCount, model.faceCount});
+    }
+    return result;
+}
+
+size_t Corpus::memoryBytes() const {
+    size_t total = 0;
+    for (const auto& model : snapshot()->models)
+        total += model->kdtree.memoryBytes() + model->octree.memoryBytes() + model->pyramid.memoryBytes() + sizeof(Descriptor);
+    return total;
+}
+
+bool Corpus::compareTiles(const string& algorithm, const vector<MatrixTile>& tiles, const vector<size_t>& todo, const TileSink& sink) {
+    bool kdtree = algorithm == "kdtree";
+    if (!kdtree && algorithm != "octree") return false;
+    shared_ptr<const Snapshot> corpus = snapshot(); // the tiles were cut from it
+    const auto& models = corpus->models;
+    ThreadPool::shared().parallelFor(todo.size(), [&](size_t t) {
+        const MatrixTile& tile = tiles[todo[t]];
+        ThreadPool inlinePool(1); // the tiles already use every thread
+        vector<float> tileScores(tile.rows() * tile.columns());
+        float unbounded = kdtree ? INFINITY : 0.0f;
+        for (size_t r = 0; r < tile.rows(); ++r) {
+            const Model& a = *models[tile.rowBegin + r];
+            for (size_t c = tile.diagonal() ? r : 0; c < tile.columns(); ++c) { // the column block stays cached across rows
+                const Model& b = *models[tile.columnBegin + c];
+                float score;
+                if (!cachedScore(a, b, kdtree, unbounded, score)) score = compare(a, b, kdtree, unbounded, inlinePool);
+                tileScores[r * tile.columns() + c] = score;
+                if (tile.diagonal()) tileScores[c * tile.columns() + r] = score;
+            }
+        }
+        scores.flush();
+        sink(todo[t], tileScores);
+    });
+    return true;
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include "Similarity.h"
+#include "CorpusIndex.h"
+#include "Pyramid.h"
+#include "Pipeline.h"
+#include "Matrix.h"
+#include "ScoreCache.h"
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+struct Match {
+    size_t id;              // position of the model in the corpus (load order, or index order)
+    string name;            // model path relative to the corpus root (category/split/file.off)
+    float score;            // KDTreeScore or OctTreeScore depending on the algorithm
+    size_t vertexCount, faceCount;
+};
+
+struct SearchStats { // what the last search did with the corpus
+    size_t candidates = 0;  // models left after the descriptor prefilter
+    size_t refined = 0;     // of those, models whose full comparison was started
+    size_t cutOff = 0;      // of those, comparisons that ended on the kth best bound instead of a score that made it in
+    size_t cached = 0;      // candidates settled by the score cache without a comparison
+    size_t interrupted = 0; // of the refined, comparisons the deadline stopped part way (left out of the results)
+    size_t skipped = 0;     // candidates the deadline came before, never compared
+    size_t estimated = 0;   // results that are interrupted or skipped candidates scored with their bound, after the settled ones
+    bool deadlineHit = false; // the results are the best of the candidates settled in time, not necessarily the exact top k
+};
+string searchStatsJson(const SearchStats& stats); // one line JSON object, the search part of a query's STATS
+
+struct RefreshReport { // what a refresh found in the directory
+    size_t added = 0, changed = 0, removed = 0;
+    size_t touched = 0;     // files with a new size or time but the same points, kept as they were
+    size_t unreadable = 0;  // new files that couldn't be loaded, tried again by the next refresh
+    size_t models = 0;      // in the published snapshot
+    double seconds = 0.0;
+};
+
+// every model of a directory (or of a prebuilt index) loaded once and kept in memory, then kept up to date by refresh
+// the models are held in an immutable snapshot that refresh replaces whole: searches run on the snapshot they started with, so a
+// refresh never waits on them nor they on it (load and loadIndex replace everything and must not overlap a search)
+class Corpus {
+    struct Model {
+        string name;
+        size_t vertexCount = 0, faceCount = 0;
+        KDTree<> kdtree;
+        Octree octree;
+        Pyramid pyramid;    // coarse grids for pruning candidates before the full comparison
+        Descriptor descriptor;
+        uint64_t contentHash = 0; // of the kd tree's points, the model's part of its score cache keys
+    };
+
+    struct ModelFile { // what refresh checks a model's file against
+        uint64_t size = 0;
+        int64_t modified = 0; // last write time (see fileStamp)
+        bool operator==(const ModelFile& other) const { return size == other.size && modified == other.modified; };
+    };
+
+    struct Snapshot { // one published state of the corpus, never changed once published
+        vector<shared_ptr<const Model>> models; // in name order, models that didn't change are shared with older snapshots
+        vector<ModelFile> files;                // per model
+        unordered_map<string, size_t> byName;   // name -> index into models
+        vector<Descriptor> descriptors;         // copy of every model's descriptor, in model order, for the flat prefilter scan
+    };
+
+    string root;
+    CorpusIndex index; // only open when loaded with loadIndex, the trees of models it holds point into it
+    shared_ptr<const Snapshot> current = make_shared<const Snapshot>();
+    mutable mutex snapshotLock; // held only to copy or swap current, never while building one
+    mutex refreshLock;          // one refresh at a time
+    size_t prefilter = 256; // candidates kept by the descriptor scan, 0 compares against the whole corpus
+    size_t shard = 0, shards = 1; // this corpus keeps only the models whose name hashes to shard (see setShard)
+    SampleOptions sampling; // applied to every model and query, taken from the index by loadIndex
+    SearchStats stats;
+    ScoreCache scores; // every pair compared, across queries (and runs, once openScoreCache gave it a file)
+    unique_ptr<PipelineReport> report; // of the last load or scan that read a directory
+
+    unique_ptr<Model> buildModel(const string& path, const string& name) const; // load the OFF file, preprocess it and build both trees, nullptr if it can't be read
+    unique_ptr<Model> buildModel(Mesh&& mesh, const string& name) const;
+
+    // gets every model of the directory scan (nullptr for files that can't be read) along with the calling worker's inline pool
+    using ModelSink = function<void(size_t path, unique_ptr<Model> model, ThreadPool& pool)>;
+    // reader threads pull whole files in while one worker per core parses, builds and sinks them, each stage handing over through a
+    // bounded lock-free queue; workers take from the latest stage that has work and run the next stage themselves when its queue is full
+    void scanFiles(const vector<OffFile>& paths, const char* lastStage, const ModelSink& sink);
+    bool inShard(const string& name) const { return shards <= 1 || hashBytes(name.data(), name.size()) % shards == shard; };
+    vector<OffFile> shardFiles(const string& directory) const; // offFiles of the directory this shard keeps
+    unique_ptr<Model> indexModel(size_t i) const; // a view of the open index's model i
+    unique_ptr<Model> otherShardModel(const string& name) const; // a model of another shard, built for one query, nullptr if there is none
+    shared_ptr<const Snapshot> snapshot() const { lock_guard<mutex> guard(snapshotLock); return current; };
+    void publish(shared_ptr<const Snapshot> next) { lock_guard<mutex> guard(snapshotLock); current.swap(next); }; // the old one goes after the unlock
+    // the body of search, over one snapshot, self is skipped (SIZE_MAX for none)
+    void rank(const Snapshot& corpus, const Model& query, size_t self, bool kdtree, size_t k, vector<Match>& results, Deadline deadline);
+    // the pair's score as a comparison bounded by kth (see KDTreeScore and OctTreeScore) would be judged, when the score cache
+    // knows enough about the pair to settle it
+    bool cachedScore(const Model& a, const Model& b, bool kdtree, float kth, float& score);
+    // the comparison itself, its result cached; a kd tree comparison the deadline stops sets *unfinished and gives a lower bound
+    float compare(const Model& a, const Model& b, bool kdtree, float kth, ThreadPool& pool, Deadline deadline = NO_DEADLINE, bool* unfinished = nullptr);
+
+public:
+    bool load(const string& directory);  // recursively load every .off under directory, returns false if the directory doesn't exist
+    bool loadIndex(const string& indexPath); // map a file written by CorpusIndex::build, trees are used in place
+    // brings the corpus up to date with directory (the one it was loaded from, or an index's source directory): files whose size or
+    // time changed and new files are loaded and built on threads of their own, models of removed files dropped, and the result
+    // published as a new snapshot; the rest is shared with the current snapshot, false if directory doesn't exist
+    bool refresh(const string& directory, RefreshReport& report);
+    const string& directory() const { return root; }; // empty for a corpus loaded from an index
+    size_t size() const { return snapshot()->models.size(); };
+    const SearchStats& lastStats() const { return stats; };
+    const PipelineReport* scanReport() const { return report.get(); }; // nullptr until a directory has been read
+    void setPrefilter(size_t candidates) { prefilter = candidates; };
+    // for the next load, loadIndex or refresh: keep only the models whose name hashes to shard out of shards, so shards processes
+    // over the same directory or index split it between them; a search by the name of a model another shard keeps still works,
+    // the model is built (or viewed in the index) for the query
+    void setShard(size_t shard_, size_t shards_) { shard = shard_; shards = max<size_t>(shards_, 1); };
+    void setSampling(const SampleOptions& options) { sampling = options; }; // for the next load or scan
+    const SampleOptions& samplingOptions() const { return sampling; };
+    // keeps every score across runs in an append-only file next to the in-memory cache, false if it can't be opened
+    bool openScoreCache(const string& path) { return scores.open(path); };
+    const ScoreCache& scoreCache() const { return scores; };
+
+    // source is either a model name inside the corpus (trees reused) or a path to an OFF file (loaded for this query)
+    // only the prefilter models with the closest descriptors are compared, results are ordered best first: ascending for kdtree, descending for octree
+    // the kth best score so far is handed to every comparison as a bound, so a candidate that can't get in stops part way
+    // anytime with a deadline: candidates are refined in the order of their cheap bound (most promising first) until it passes,
+    // then the best k of those settled so far are returned, filled up with the most promising unsettled ones (scored with their
+    // bound) when fewer were; kd tree comparisons stop part way at the deadline, octree ones (a few milliseconds at most) finish;
+    // lastStats() says how many candidates were compared, interrupted, skipped and estimated
+    bool search(const string& source, const string& algorithm, size_t k, vector<Match>& results, Deadline deadline = NO_DEADLINE);
+    bool search(Mesh&& mesh, const string& algorithm, size_t k, vector<Match>& results, Deadline deadline = NO_DEADLINE); // a query mesh held in memory, preprocessed like a file
+    // one pass over a directory without keeping it: every model is compared as soon as it's built, against the kth best bound so far
+    // the corpus itself is left as it was, results are ordered like search's and ids are positions in the sorted file list
+    bool scan(const string& directory, const string& source, const string& algorithm, size_t k, vector<Match>& results);
+
+    // all pairs matrix (see Matrix.h): consecutive models cut into blocks of at most MATRIX_BLOCK_POINTS points, small enough
+    // for a pair of blocks to stay in cache, and into enough blocks to keep every thread busy
+    vector<MatrixTile> matrixTiles(size_t threads) const;
+    vector<string> names() const; // in model order
+    vector<Match> models() const; // every model (score 0), in model order
+    size_t memoryBytes() const;   // held by the models' trees, pyramids and descriptors (a mapped index's trees count nothing)
+    // every pair of each of tiles[todo], the tiles spread over the shared pool, each compared on one thread and passed to sink
+    // from that thread; scores are tile.rows() x tile.columns(), row major, diagonal tiles filled in full from their upper half
+    using TileSink = function<void(size_t tile, const vector<float>& scores)>;
+    bool compareTiles(const string& algorithm, const vector<MatrixTile>& tiles, const vector<size_t>& todo, const TileSink& sink);
+};
@@ -0,0 +1,267 @@
+#include "CorpusIndex.h"
+#include "Similarity.h"
+#include "ScoreCache.h"
+#include <cstring>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+namespace {
+    template <typename T>
+    void writeArray(ofstream& out, const T* data, size_t count) {
+        out.write(reinterpret_cast<const char*>(data), static_cast<streamsize>(count * sizeof(T)));
+    }
+
+    void pad(ofstream& out) { // keep every section 8 byte aligned inside the mapping
+        static const char zeros[8] = {0};
+        out.write(zeros, (8 - out.tellp() % 8) % 8);
+    }
+
+    uint64_t appendSection(ofstream& out, const string& sidePath, bool nonEmpty) { // copy a side file to the end of the index, returns its offset
+        pad(out);
+        uint64_t offset = static_cast<uint64_t>(out.tellp());
+        ifstream in(sidePath, ios::binary);
+        if (nonEmpty) out << in.rdbuf();
+        in.close();
+        std::error_code ignored;
+        filesystem::remove(sidePath, ignored);
+        return offset;
+    }
+
+    bool fits(uint64_t first, uint64_t count, uint64_t available) { // first + count <= available, without wrapping around
+        return first <= available && count <= available - first;
+    }
+
+    template <typename T>
+    bool section(uint64_t offset, uint64_t end, uint64_t& count) { // [offset, end) as whole, aligned T, count of them
+        if (offset > end || offset % alignof(T) != 0) return false;
+        count = (end - offset) / sizeof(T);
+        return true;
+    }
+}
+
+vector<OffFile> offFiles(const string& directory) {
+    vector<OffFile> files;
+    string prefix = (filesystem::path(directory) / "").generic_string(); // names are cut out of the paths, relative() costs syscalls
+    for (const auto& entry : filesystem::recursive_directory_iterator(directory)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".off") continue;
+        string name = entry.path().generic_string();
+        files.push_back({entry.path(), name.compare(0, prefix.size(), prefix) == 0 ? name.substr(prefix.size()) : name});
+    }
+    sort(files.begin(), files.end(), [](const OffFile& a, const OffFile& b) { return a.name < b.name; });
+    return files;
+}
+
+void fileStamp(const filesystem::path& path, uint64_t& size, int64_t& modified) {
+#ifdef _WIN32
+    std::error_code error;
+    size = filesystem::file_size(path, error);
+    if (error) size = 0;
+    auto time = filesystem::last_write_time(path, error);
+    modified = error ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+#else
+    struct stat info; // one call for both, a refresh stats every file of the corpus
+    if (stat(path.c_str(), &info) != 0) {
+        size = 0;
+        modified = 0;
+        return;
+    }
+    size = static_cast<uint64_t>(info.st_size);
+    modified = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+}
+
+bool CorpusIndex::build(const string& corpusDir, const string& indexPath, const SampleOptions& sampling) {
+    if (!filesystem::is_directory(corpusDir)) return false;
+    vector<OffFile> files = offFiles(corpusDir); // same corpus, same file
+
+    // vertices go straight into the index, the other sections into side files appended at the end, so only metadata stays in memory
+    string nodesPath = indexPath + ".nodes.tmp", leavesPath = indexPath + ".leaves.tmp";
+    string octPointsPath = indexPath + ".octpoints.tmp", octNodesPath = indexPath + ".octnodes.tmp", occupancyPath = indexPath + ".occupancy.tmp";
+    // written next to the index and renamed over it at the end: servers mapping the old one keep reading its (now unlinked) file
+    string buildPath = indexPath + ".tmp";
+    ofstream out(buildPath, ios::binary | ios::trunc), nodesOut(nodesPath, ios::binary | ios::trunc), leavesOut(leavesPath, ios::binary | ios::trunc);
+    ofstream octPointsOut(octPointsPath, ios::binary | ios::trunc), octNodesOut(octNodesPath, ios::binary | ios::trunc);
+    ofstream occupancyOut(occupancyPath, ios::binary | ios::trunc);
+    auto fail = [&]() { // nothing of a failed build is left behind, the index it was to replace stays as it was
+        out.close();
+        std::error_code ignored;
+        for (const string& path : {buildPath, nodesPath, leavesPath, octPointsPath, octNodesPath, occupancyPath}) filesystem::remove(path, ignored);
+        return false;
+    };
+    if (!out || !nodesOut || !leavesOut || !octPointsOut || !octNodesOut || !occupancyOut) return fail();
+    IndexHeader header = {};
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.sampleMode = static_cast<uint32_t>(sampling.mode);
+    header.sampleBudget = sampling.budget;
+    header.sampleBits = sampling.bits;
+    writeArray(out, &header, 1);
+    header.verticesOffset = static_cast<uint64_t>(out.tellp());
+
+    vector<IndexModel> models;
+    vector<Descriptor> descriptors; // small, kept in memory like the model table
+    string names;
+    uint64_t vertexTotal = 0, nodeTotal = 0, leafTotal = 0, octNodeTotal = 0, occupancyTotal = 0;
+    Mesh mesh;
+    vector<Point>& vertices = mesh.vertices;
+    for (const auto& [path, name] : files) {
+        uint64_t fileSize;
+        int64_t modifiedTime;
+        fileStamp(path, fileSize, modifiedTime); // before reading, so a file rewritten meanwhile looks changed to a later refresh
+        if (!loadMesh(path.string(), mesh, sampling.mode != SampleMode::None) || vertices.empty()) continue;
+        IndexModel model = {};
+        model.fileSize = fileSize;
+        model.modifiedTime = modifiedTime;
+        model.vertexCount = static_cast<uint32_t>(vertices.size());
+        Point center;
+        preprocess(mesh, sampling, center, model.scale);
+        model.center[0] = center.x; model.center[1] = center.y; model.center[2] = center.z;
+        KDTree<> tree = fillKD(vertices);
+        Octree octree = fillOct(vertices);
+        descriptors.push_back(describe(vertices.data(), vertices.size()));
+
+        model.nameOffset = names.size();
+        model.nameLength = static_cast<uint32_t>(name.size());
+        model.firstVertex = vertexTotal;
+        model.pointCount = static_cast<uint32_t>(vertices.size());
+        model.faceCount = static_cast<uint32_t>(mesh.faceCount);
+        model.firstKDNode = nodeTotal;
+        model.kdNodeCount = static_cast<uint32_t>(tree.nodeCount());
+        model.firstLeaf = leafTotal;
+        model.firstOctNode = octNodeTotal;
+        model.octNodeCount = static_cast<uint32_t>(octree.nodeCount());
+        model.octOrigin[0] = octree.origin().x; model.octOrigin[1] = octree.origin().y; model.octOrigin[2] = octree.origin().z;
+        model.octSize = octree.size();
+        model.firstOccupancy = occupancyTotal;
+        model.occupancyWords = static_cast<uint32_t>(octree.occupancyWordCount());
+        model.contentHash = contentHash(tree.points(), tree.pointCount());
+        names += name;
+        writeArray(out, tree.points(), tree.pointCount()); // tree order, the mapped view uses it as the leaves' point array
+        writeArray(nodesOut, tree.nodes(), tree.nodeCount());
+        writeArray(leavesOut, tree.leafCoordinates(), 3 * KDTree<>::leafStride(tree.pointCount()));
+        writeArray(octPointsOut, octree.points(), octree.pointCount());
+        writeArray(octNodesOut, octree.nodes(), octree.nodeCount());
+        writeArray(occupancyOut, octree.occupancyWords(), octree.occupancyWordCount());
+        vertexTotal += vertices.size();
+        nodeTotal += tree.nodeCount();
+        leafTotal += 3 * KDTree<>::leafStride(tree.pointCount());
+        octNodeTotal += octree.nodeCount();
+        occupancyTotal += octree.occupancyWordCount();
+        models.push_back(model);
+    }
+    nodesOut.close();
+    leavesOut.close();
+    octPointsOut.close();
+    octNodesOut.close();
+    occupancyOut.close();
+    if (!out || !nodesOut || !leavesOut || !octPointsOut || !octNodesOut || !occupancyOut) return fail(); // a short section (disk full)
+
+    header.kdNodesOffset = appendSection(out, nodesPath, nodeTotal > 0);
+    header.leavesOffset = appendSection(out, leavesPath, leafTotal > 0);
+    header.octPointsOffset = appendSection(out, octPointsPath, vertexTotal > 0);
+    header.octNodesOffset = appendSection(out, octNodesPath, octNodeTotal > 0);
+    header.occupancyOffset = appendSection(out, occupancyPath, occupancyTotal > 0);
+    pad(out);
+    header.descriptorsOffset = static_cast<uint64_t>(out.tellp());
+    writeArray(out, descriptors.data(), descriptors.size());
+    pad(out);
+    header.modelsOffset = static_cast<uint64_t>(out.tellp());
+    writeArray(out, models.data(), models.size());
+    header.namesOffset = static_cast<uint64_t>(out.tellp());
+    out.write(names.data(), static_cast<streamsize>(names.size()));
+    std::error_code error;
+    string directory = filesystem::absolute(corpusDir, error).lexically_normal().generic_string();
+    if (error) directory.clear();
+    header.directoryOffset = static_cast<uint64_t>(out.tellp());
+    header.directoryLength = directory.size();
+    out.write(directory.data(), static_cast<streamsize>(directory.size()));
+    header.fileSize = static_cast<uint64_t>(out.tellp());
+    header.modelCount = static_cast<uint32_t>(models.size());
+    out.seekp(0);
+    writeArray(out, &header, 1); // the header is only complete once every section has been written
+    out.close();
+    if (out) filesystem::rename(buildPath, indexPath, error);
+    if (!out || error) return fail();
+    return true;
+}
+
+bool CorpusIndex::open(const string& indexPath) {
+    header = nullptr;
+    if (!file.open(indexPath) || file.size() < sizeof(IndexHeader)) return false;
+    const IndexHeader* candidate = reinterpret_cast<const IndexHeader*>(file.data());
+    if (memcmp(candidate->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || candidate->version != INDEX_VERSION) return false;
+    if (candidate->fileSize != file.size() || candidate->sampleMode > static_cast<uint32_t>(SampleMode::Farthest)
+        || candidate->sampleBits > MAX_QUANTIZE_BITS) return false;
+    // every section ends where the next one starts, and every model's ranges lie inside its sections: a damaged index of the right
+    // size must not send model(), name(), vertices() or the tree views outside the mapping
+    const IndexHeader& h = *candidate;
+    uint64_t vertexCount, kdNodeCount, leafCount, octPointCount, octNodeCount, occupancyCount, descriptorCount, modelCount;
+    if (h.verticesOffset < sizeof(IndexHeader) || !section<Point>(h.verticesOffset, h.kdNodesOffset, vertexCount)
+        || !section<FlatKDNode>(h.kdNodesOffset, h.leavesOffset, kdNodeCount) || !section<float>(h.leavesOffset, h.octPointsOffset, leafCount)
+        || !section<Point>(h.octPointsOffset, h.octNodesOffset, octPointCount)
+        || !section<OctNode>(h.octNodesOffset, h.occupancyOffset, octNodeCount)
+        || !section<uint32_t>(h.occupancyOffset, h.descriptorsOffset, occupancyCount)
+        || !section<Descriptor>(h.descriptorsOffset, h.modelsOffset, descriptorCount)
+        || !section<IndexModel>(h.modelsOffset, h.namesOffset, modelCount) || h.namesOffset > h.directoryOffset
+        || !fits(h.directoryOffset, h.directoryLength, file.size()) || descriptorCount < h.modelCount || modelCount < h.modelCount) return false;
+    const IndexModel* models = reinterpret_cast<const IndexModel*>(file.data() + h.modelsOffset);
+    for (uint32_t i = 0; i < h.modelCount; ++i) {
+        const IndexModel& m = models[i];
+        if (m.pointCount == 0 || m.kdNodeCount == 0 || m.octNodeCount == 0 || !fits(m.nameOffset, m.nameLength, h.directoryOffset - h.namesOffset)
+            || !fits(m.firstVertex, m.pointCount, vertexCount) || !fits(m.firstVertex, m.pointCount, octPointCount)
+            || !fits(m.firstKDNode, m.kdNodeCount, kdNodeCount) || !fits(m.firstLeaf, 3 * KDTree<>::leafStride(m.pointCount), leafCount)
+            || !fits(m.firstOctNode, m.octNodeCount, octNodeCount) || !fits(m.firstOccupancy, m.occupancyWords, occupancyCount)) return false;
+    }
+    header = candidate;
+    return true;
+}
+
+const IndexModel& CorpusIndex::model(size_t i) const {
+    return reinterpret_cast<const IndexModel*>(file.data() + header->modelsOffset)[i];
+}
+
+string CorpusIndex::name(size_t i) const {
+    const IndexModel& entry = model(i);
+    return string(file.data() + header->namesOffset + entry.nameOffset, entry.nameLength);
+}
+
+string CorpusIndex::directory() const {
+    return string(file.data() + header->directoryOffset, header->directoryLength);
+}
+
+SampleOptions CorpusIndex::sampling() const {
+    SampleOptions options;
+    options.mode = static_cast<SampleMode>(header->sampleMode);
+    options.budget = header->sampleBudget;
+    options.bits = header->sampleBits;
+    return options;
+}
+
+const Point* CorpusIndex::vertices(size_t i) const {
+    return reinterpret_cast<const Point*>(file.data() + header->verticesOffset) + model(i).firstVertex;
+}
+
+const float* CorpusIndex::leaves(size_t i) const {
+    return reinterpret_cast<const float*>(file.data() + header->leavesOffset) + model(i).firstLeaf;
+}
+
+const FlatKDNode* CorpusIndex::kdNodes(size_t i) const {
+    return reinterpret_cast<const FlatKDNode*>(file.data() + header->kdNodesOffset) + model(i).firstKDNode;
+}
+
+const Point* CorpusIndex::octPoints(size_t i) const {
+    return reinterpret_cast<const Point*>(file.data() + header->octPointsOffset) + model(i).firstVertex;
+}
+
+const OctNode* CorpusIndex::octNodes(size_t i) const {
+    return reinterpret_cast<const OctNode*>(file.data() + header->octNodesOffset) + model(i).firstOctNode;
+}
+
+const uint32_t* CorpusIndex::occupancy(size_t i) const {
+    return reinterpret_cast<const uint32_t*>(file.data() + header->occupancyOffset) + model(i).firstOccupancy;
+}
+
+const Descriptor* CorpusIndex::descriptors() const {
+    return reinterpret_cast<const Descriptor*>(file.data() + header->descriptorsOffset);
+}
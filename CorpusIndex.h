@@ -0,0 +1,92 @@
+#pragma once
+#include "KDTree.h"
+#include "Octree.h"
+#include "Descriptor.h"
+#include "MappedFile.h"
+#include "Sampling.h"
+#include <cstdint>
+
+/**
+ * Binary corpus index, written once by CorpusIndex::build and then mapped read-only
+ * layout :: IndexHeader | vertices (float[3], in kd tree order) | kd nodes (FlatKDNode) | kd leaves (x, y, z float arrays)
+ *           | octree points (float[3], in Morton order) | octree nodes (OctNode) | octree occupancy (uint32 words)
+ *           | descriptors (Descriptor[modelCount]) | IndexModel[modelCount] | names | the corpus directory (absolute)
+ * every section is used in place, nothing is deserialized on open
+ */
+const char INDEX_MAGIC[8] = {'M', 'E', 'S', 'H', 'I', 'D', 'X', '\0'};
+const uint32_t INDEX_VERSION = 11; // bump whenever the layout below changes
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t modelCount;
+    uint32_t sampleMode;    // SampleOptions the models were preprocessed with, queries against the index must match
+    uint32_t sampleBudget;
+    uint32_t sampleBits;    // grid the points were snapped to, 0 for none (an index keeps float points, see Quantized.h)
+    uint32_t padding;       // zeroed
+    uint64_t verticesOffset;
+    uint64_t kdNodesOffset;
+    uint64_t leavesOffset;
+    uint64_t octPointsOffset;
+    uint64_t octNodesOffset;
+    uint64_t occupancyOffset;
+    uint64_t descriptorsOffset;
+    uint64_t modelsOffset;
+    uint64_t namesOffset;
+    uint64_t directoryOffset; // the corpus directory it was built from, directoryLength bytes, so queries given as paths find their model
+    uint64_t directoryLength;
+    uint64_t fileSize;      // guards against truncated files
+};
+
+struct IndexModel {
+    uint64_t nameOffset;    // relative to namesOffset
+    uint64_t firstVertex;   // index into the vertex section
+    uint64_t firstKDNode;   // index into the kd node section
+    uint64_t firstLeaf;     // index into the leaf section (floats), 3 * KDTree<>::leafStride(vertexCount) of them
+    uint64_t firstOctNode;  // index into the octree node section, the octree's points start at firstVertex in their own section
+    uint64_t firstOccupancy; // index into the occupancy section (uint32 words)
+    uint64_t contentHash;   // of the vertices, keys the model's entries in a score cache (see ScoreCache.h)
+    uint64_t fileSize;      // of the OFF file when it was indexed, Corpus::refresh rebuilds the model once either changes
+    int64_t modifiedTime;   // see fileStamp
+    uint32_t nameLength;
+    uint32_t vertexCount;   // of the mesh as loaded
+    uint32_t pointCount;    // kept by the preprocessing, what both trees hold
+    uint32_t faceCount;
+    uint32_t kdNodeCount;
+    uint32_t octNodeCount;
+    uint32_t occupancyWords;
+    float octOrigin[3];     // the octree's root cube
+    float octSize;
+    float center[3];        // normalize() transform: original = point / scale + center
+    float scale;
+};
+
+struct OffFile {
+    filesystem::path path;
+    string name; // relative to the corpus root, / separated (category/split/file.off), the model's name
+};
+vector<OffFile> offFiles(const string& directory); // every .off under directory, sorted by name so a corpus always loads in the same order
+void fileStamp(const filesystem::path& path, uint64_t& size, int64_t& modified); // size and last write time, zeros if it's gone
+
+class CorpusIndex {
+    MappedFile file;
+    const IndexHeader* header = nullptr;
+
+public:
+    // offline: load, preprocess and flatten every .off under corpusDir
+    static bool build(const string& corpusDir, const string& indexPath, const SampleOptions& sampling = SampleOptions());
+    bool open(const string& indexPath);  // false if the file is missing, truncated, damaged or from another version
+    void close() { file.close(); header = nullptr; };
+    size_t size() const { return header ? header->modelCount : 0; };
+    const IndexModel& model(size_t i) const;
+    string name(size_t i) const;
+    string directory() const; // absolute path of the corpus directory it was built from
+    SampleOptions sampling() const;
+    const Point* vertices(size_t i) const;      // pointCount points, preprocessed and ordered so the kd tree leaves index into them
+    const FlatKDNode* kdNodes(size_t i) const;  // kdNodeCount nodes, nodes[0] is the root
+    const float* leaves(size_t i) const;        // the kd tree's x, y, z leaf arrays
+    const Point* octPoints(size_t i) const;     // pointCount points in Morton order, the octree nodes' ranges index into them
+    const OctNode* octNodes(size_t i) const;    // octNodeCount nodes, nodes[0] is the root
+    const uint32_t* occupancy(size_t i) const;  // occupancyWords words of the octree's packed occupancy pyramid
+    const Descriptor* descriptors() const;      // one per model, in model order
+};
@@ -0,0 +1,70 @@
+#include "Descriptor.h"
+
+namespace {
+    const float D2_WEIGHT = 2.0f;       // histogram bins are fractions that sum to 1
+    const float EXTENT_WEIGHT = 1.0f;   // normalized, so the largest extent is always 1
+    const float MOMENT_WEIGHT = 8.0f;   // variances of a unit sized model are a few hundredths
+}
+
+Descriptor describe(const Point* vertices, size_t count) { // O(count + D2_SAMPLES)
+    Descriptor descriptor = {};
+    if (count == 0) return descriptor;
+
+    uint64_t state = 0x9e3779b97f4a7c15ULL ^ count; // fixed seed, the same model always gets the same pairs
+    auto next = [&state, count]() {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<size_t>(state >> 33) % count;
+    };
+    const float longest = sqrt(3.0f); // diagonal of the unit cube a normalized model fits in
+    for (int i = 0; i < Descriptor::D2_SAMPLES; ++i) {
+        float d = sqrt(distance(vertices[next()], vertices[next()])) / longest;
+        int bin = min(static_cast<int>(d * Descriptor::D2_BINS), Descriptor::D2_BINS - 1);
+        descriptor.values[bin] += D2_WEIGHT / Descriptor::D2_SAMPLES;
+    }
+
+    Point low = vertices[0], high = vertices[0];
+    double sx = 0.0, sy = 0.0, sz = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        const Point& p = vertices[i];
+        low = Point(min(low.x, p.x), min(low.y, p.y), min(low.z, p.z));
+        high = Point(max(high.x, p.x), max(high.y, p.y), max(high.z, p.z));
+        sx += p.x; sy += p.y; sz += p.z;
+    }
+    float* extents = descriptor.values + Descriptor::D2_BINS;
+    extents[0] = EXTENT_WEIGHT * (high.x - low.x);
+    extents[1] = EXTENT_WEIGHT * (high.y - low.y);
+    extents[2] = EXTENT_WEIGHT * (high.z - low.z);
+
+    double mx = sx / count, my = sy / count, mz = sz / count;
+    double xx = 0.0, yy = 0.0, zz = 0.0, xy = 0.0, xz = 0.0, yz = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        double x = vertices[i].x - mx, y = vertices[i].y - my, z = vertices[i].z - mz;
+        xx += x * x; yy += y * y; zz += z * z;
+        xy += x * y; xz += x * z; yz += y * z;
+    }
+    float* moments = extents + 3;
+    double moment[6] = {xx, yy, zz, xy, xz, yz};
+    for (int i = 0; i < 6; ++i) moments[i] = static_cast<float>(MOMENT_WEIGHT * moment[i] / count);
+    return descriptor;
+}
+
+float descriptorDistance(const Descriptor& a, const Descriptor& b) { // O(SIZE)
+    float sum = 0.0f;
+    for (int i = 0; i < Descriptor::SIZE; ++i) {
+        float d = a.values[i] - b.values[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+void nearestDescriptors(const Descriptor& query, const Descriptor* descriptors, size_t descriptorCount, size_t count, size_t skip, vector<uint32_t>& out) {
+    vector<pair<float, uint32_t>> scored;
+    scored.reserve(descriptorCount);
+    for (size_t i = 0; i < descriptorCount; ++i) {
+        if (i != skip) scored.push_back({descriptorDistance(query, descriptors[i]), static_cast<uint32_t>(i)});
+    }
+    count = min(count, scored.size());
+    partial_sort(scored.begin(), scored.begin() + count, scored.end()); // ties go to the lower index
+    out.resize(count);
+    for (size_t i = 0; i < count; ++i) out[i] = scored[i].second;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "generic.h"
+
+/**
+ * Global shape signature of one normalized model, cheap enough to compare against a whole corpus with a flat scan
+ * values :: D2 histogram (distances between sampled vertex pairs) | bounding box extents | second order central moments
+ * each group is pre-scaled so the groups weigh roughly the same in the plain squared distance below
+ */
+struct Descriptor {
+    static const int D2_BINS = 32;
+    static const int D2_SAMPLES = 4096;     // vertex pairs per histogram, drawn from a fixed seed so a model always gets the same descriptor
+    static const int SIZE = D2_BINS + 3 + 6;
+    float values[SIZE];
+};
+
+Descriptor describe(const Point* vertices, size_t count); // vertices must already be normalized (see normalize)
+float descriptorDistance(const Descriptor& a, const Descriptor& b); // squared distance, lower is more similar
+
+// indices of the (at most) count descriptors closest to query, closest first; skip is left out (pass SIZE_MAX to keep everything)
+void nearestDescriptors(const Descriptor& query, const Descriptor* descriptors, size_t descriptorCount, size_t count, size_t skip, vector<uint32_t>& out);
@@ -0,0 +1,260 @@
+#include "Geometry.h"
+#include "CorpusIndex.h"
+#include "MappedFile.h"
+#include "Quantized.h"
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+    const uint32_t POSITION_BITS = 16;
+    const uint32_t FINEST_CELLS = 256;  // along the longest axis, for the first level clustered
+    const uint32_t COARSEST_CELLS = 8;
+
+    struct Level { // triangles over their own vertices
+        vector<Point> vertices;
+        vector<uint32_t> indices; // 3 per triangle
+    };
+
+    size_t padded(size_t bytes) { return (bytes + 3) & ~static_cast<size_t>(3); }
+
+    size_t indexBytes(uint32_t vertexCount) { return vertexCount <= 65536 ? sizeof(uint16_t) : sizeof(uint32_t); }
+
+    size_t blockSize(uint32_t vertexCount, uint32_t indexCount) {
+        return padded(3 * sizeof(uint16_t) * vertexCount) + padded(2 * vertexCount) + padded(indexBytes(vertexCount) * indexCount);
+    }
+
+    template <class T>
+    void append(vector<uint8_t>& out, const vector<T>& values) { // padded to 4 bytes
+        size_t at = out.size();
+        out.resize(padded(at + values.size() * sizeof(T)), 0);
+        if (!values.empty()) memcpy(out.data() + at, values.data(), values.size() * sizeof(T));
+    }
+
+    Level triangulate(const Mesh& mesh) { // every polygon as a fan around its first corner
+        Level level;
+        level.vertices = mesh.vertices;
+        level.indices.reserve(3 * mesh.faceCount);
+        for (size_t f = 0; f + 1 < mesh.faceOffsets.size(); ++f) {
+            uint32_t begin = mesh.faceOffsets[f], end = mesh.faceOffsets[f + 1];
+            for (uint32_t i = begin + 1; i + 1 < end; ++i)
+                level.indices.insert(level.indices.end(), {mesh.faceIndices[begin], mesh.faceIndices[i], mesh.faceIndices[i + 1]});
+        }
+        return level;
+    }
+
+    // vertex clustering over cells cells along the longest axis: a cell's vertices merge into their mean, triangles that collapse
+    // or repeat another one's corners are dropped (the first keeps its winding), clusters are numbered in the order triangles use them
+    Level cluster(const Level& full, const Point& low, float extent, uint32_t cells) {
+        float cell = extent / static_cast<float>(cells);
+        unordered_map<uint64_t, uint32_t> ids; // cell -> cluster
+        vector<uint32_t> clusterOf(full.vertices.size());
+        vector<array<double, 3>> sums;
+        vector<uint32_t> counts;
+        for (size_t v = 0; v < full.vertices.size(); ++v) {
+            const Point& p = full.vertices[v];
+            uint64_t key = 0;
+            for (uint32_t axis = 0; axis < 3; ++axis) {
+                float at = max((p[axis] - low[axis]) / cell, 0.0f);
+                key = key << 21 | min<uint64_t>(static_cast<uint64_t>(at), cells - 1);
+            }
+            auto [it, added] = ids.try_emplace(key, static_cast<uint32_t>(sums.size()));
+            if (added) {
+                sums.push_back({0.0, 0.0, 0.0});
+                counts.push_back(0);
+            }
+            clusterOf[v] = it->second;
+            sums[it->second][0] += p.x;
+            sums[it->second][1] += p.y;
+            sums[it->second][2] += p.z;
+            counts[it->second]++;
+        }
+        vector<pair<array<uint32_t, 3>, uint32_t>> corners; // sorted clusters, triangle
+        for (size_t t = 0; t < full.indices.size() / 3; ++t) {
+            array<uint32_t, 3> c = {clusterOf[full.indices[3 * t]], clusterOf[full.indices[3 * t + 1]], clusterOf[full.indices[3 * t + 2]]};
+            if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2]) continue;
+            sort(c.begin(), c.end());
+            corners.push_back({c, static_cast<uint32_t>(t)});
+        }
+        sort(corners.begin(), corners.end()); // equal corners next to each other, the earliest triangle first
+        vector<uint32_t> kept;
+        for (size_t i = 0; i < corners.size(); ++i)
+            if (i == 0 || corners[i].first != corners[i - 1].first) kept.push_back(corners[i].second);
+        sort(kept.begin(), kept.end()); // back in mesh order
+        Level level;
+        vector<uint32_t> renumbered(sums.size(), UINT32_MAX);
+        level.indices.reserve(3 * kept.size());
+        for (uint32_t t : kept) {
+            for (uint32_t corner = 0; corner < 3; ++corner) {
+                uint32_t c = clusterOf[full.indices[3 * t + corner]];
+                if (renumbered[c] == UINT32_MAX) {
+                    renumbered[c] = static_cast<uint32_t>(level.vertices.size());
+                    double n = counts[c];
+                    level.vertices.push_back(Point(static_cast<float>(sums[c][0] / n), static_cast<float>(sums[c][1] / n), static_cast<float>(sums[c][2] / n)));
+                }
+                level.indices.push_back(renumbered[c]);
+            }
+        }
+        return level;
+    }
+
+    // area weighted vertex normals (the sum of the cross products of the triangles around a vertex), oct encoded: the unit vector
+    // projected onto the octahedron |x| + |y| + |z| = 1, its lower half folded over the upper one, x and y as snorm8
+    vector<int8_t> octNormals(const Level& level) {
+        vector<float> sums(3 * level.vertices.size(), 0.0f);
+        for (size_t t = 0; t < level.indices.size() / 3; ++t) {
+            const uint32_t* c = &level.indices[3 * t];
+            Point a = level.vertices[c[0]], u = level.vertices[c[1]] - a, v = level.vertices[c[2]] - a;
+            float cross[3] = {u.y * v.z - u.z * v.y, u.z * v.x - u.x * v.z, u.x * v.y - u.y * v.x};
+            for (uint32_t corner = 0; corner < 3; ++corner)
+                for (uint32_t axis = 0; axis < 3; ++axis) sums[3 * c[corner] + axis] += cross[axis];
+        }
+        vector<int8_t> oct(2 * level.vertices.size());
+        for (size_t v = 0; v < level.vertices.size(); ++v) {
+            float x = sums[3 * v], y = sums[3 * v + 1], z = sums[3 * v + 2];
+            float l1 = fabs(x) + fabs(y) + fabs(z);
+            if (l1 == 0.0f) { // no triangle or only degenerate ones
+                x = 0.0f;
+                y = 0.0f;
+                z = 1.0f;
+                l1 = 1.0f;
+            }
+            x /= l1;
+            y /= l1;
+            if (z < 0.0f) {
+                float folded = (1.0f - fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+                y = (1.0f - fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+                x = folded;
+            }
+            oct[2 * v] = static_cast<int8_t>(nearbyint(clamp(x, -1.0f, 1.0f) * 127.0f));
+            oct[2 * v + 1] = static_cast<int8_t>(nearbyint(clamp(y, -1.0f, 1.0f) * 127.0f));
+        }
+        return oct;
+    }
+
+    void writeCache(const string& path, const vector<uint8_t>& data) { // a cache that can't be written only makes the next call slower
+        error_code error;
+        filesystem::path target(path);
+        if (target.has_parent_path()) filesystem::create_directories(target.parent_path(), error);
+        uint64_t unique = hash<thread::id>()(this_thread::get_id()) ^ static_cast<uint64_t>(chrono::steady_clock::now().time_since_epoch().count());
+        string temporary = path + ".tmp" + to_string(unique);
+        {
+            ofstream file(temporary, ios::binary);
+            file.write(reinterpret_cast<const char*>(data.data()), static_cast<streamsize>(data.size()));
+            if (!file.flush()) {
+                file.close();
+                filesystem::remove(temporary, error);
+                return;
+            }
+        }
+        filesystem::rename(temporary, target, error);
+        if (error) filesystem::remove(temporary, error);
+    }
+}
+
+bool encodeGeometry(const Mesh& mesh, uint64_t sourceSize, int64_t sourceModified, vector<uint8_t>& out) {
+    vector<Level> levels;
+    levels.reserve(GEOMETRY_LEVELS);
+    levels.push_back(triangulate(mesh));
+    const Level& full = levels[0];
+    if (!full.indices.empty()) {
+        Point low = full.vertices[0], high = full.vertices[0];
+        for (const Point& p : full.vertices) {
+            low = Point(min(low.x, p.x), min(low.y, p.y), min(low.z, p.z));
+            high = Point(max(high.x, p.x), max(high.y, p.y), max(high.z, p.z));
+        }
+        float extent = max({high.x - low.x, high.y - low.y, high.z - low.z});
+        for (uint32_t cells = FINEST_CELLS; extent > 0.0f && cells >= COARSEST_CELLS && levels.size() < GEOMETRY_LEVELS; cells /= 2) {
+            Level coarse = cluster(full, low, extent, cells);
+            if (coarse.indices.empty()) break; // nothing left to show
+            if (2 * coarse.indices.size() <= levels.back().indices.size()) levels.push_back(std::move(coarse));
+        }
+    }
+
+    Quantizer grid = Quantizer::fit(mesh.vertices, POSITION_BITS);
+    GeometryHeader header = {};
+    memcpy(header.magic, GEOMETRY_MAGIC, sizeof(header.magic));
+    header.version = GEOMETRY_VERSION;
+    header.levels = static_cast<uint32_t>(levels.size());
+    header.first = 0;
+    header.count = header.levels;
+    header.sourceSize = sourceSize;
+    header.sourceModified = sourceModified;
+    copy(grid.origin, grid.origin + 3, header.origin);
+    copy(grid.step, grid.step + 3, header.step);
+    vector<GeometryLevel> table(levels.size());
+    out.assign(sizeof(header) + table.size() * sizeof(GeometryLevel), 0);
+    for (size_t l = 0; l < levels.size(); ++l) {
+        const Level& level = levels[l];
+        if (level.vertices.size() > UINT32_MAX || level.indices.size() > UINT32_MAX) return false;
+        uint32_t vertexCount = static_cast<uint32_t>(level.vertices.size());
+        size_t offset = out.size();
+        vector<uint16_t> codes(3 * level.vertices.size());
+        for (size_t v = 0; v < level.vertices.size(); ++v)
+            for (uint32_t axis = 0; axis < 3; ++axis) codes[3 * v + axis] = grid.encode(level.vertices[v][axis], static_cast<int>(axis));
+        append(out, codes);
+        append(out, octNormals(level));
+        if (indexBytes(vertexCount) == sizeof(uint16_t)) append(out, vector<uint16_t>(level.indices.begin(), level.indices.end()));
+        else append(out, level.indices);
+        if (out.size() > UINT32_MAX) return false;
+        table[l] = {vertexCount, static_cast<uint32_t>(level.indices.size()), static_cast<uint32_t>(offset), static_cast<uint32_t>(out.size() - offset)};
+    }
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + sizeof(header), table.data(), table.size() * sizeof(GeometryLevel));
+    return true;
+}
+
+bool geometryLevel(const uint8_t* data, size_t size, uint32_t level, vector<uint8_t>& out) {
+    GeometryHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, GEOMETRY_MAGIC, sizeof(header.magic)) != 0 || header.version != GEOMETRY_VERSION || header.levels == 0 ||
+        header.count == 0 || header.count > GEOMETRY_LEVELS)
+        return false;
+    level = min(level, header.levels - 1);
+    size_t tableEnd = sizeof(header) + header.count * sizeof(GeometryLevel);
+    if (level < header.first || level - header.first >= header.count || size < tableEnd) return false;
+    GeometryLevel entry;
+    memcpy(&entry, data + sizeof(header) + (level - header.first) * sizeof(entry), sizeof(entry));
+    if (entry.offset < tableEnd || entry.offset % 4 != 0 || static_cast<uint64_t>(entry.offset) + entry.size > size ||
+        entry.size != blockSize(entry.vertexCount, entry.indexCount))
+        return false;
+    header.first = level;
+    header.count = 1;
+    out.resize(sizeof(header) + sizeof(entry) + entry.size);
+    memcpy(out.data() + sizeof(header) + sizeof(entry), data + entry.offset, entry.size);
+    entry.offset = static_cast<uint32_t>(sizeof(header) + sizeof(entry));
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + sizeof(header), &entry, sizeof(entry));
+    return true;
+}
+
+bool loadGeometry(const string& offPath, const string& cachePath, uint32_t level, vector<uint8_t>& out, string& error) {
+    uint64_t size;
+    int64_t modified;
+    fileStamp(offPath, size, modified);
+    if (!cachePath.empty()) {
+        MappedFile cached;
+        GeometryHeader header;
+        if (cached.open(cachePath) && cached.size() >= sizeof(header)) {
+            memcpy(&header, cached.data(), sizeof(header));
+            if (header.sourceSize == size && header.sourceModified == modified &&
+                geometryLevel(reinterpret_cast<const uint8_t*>(cached.data()), cached.size(), level, out))
+                return true;
+        }
+    }
+    Mesh mesh;
+    if (!loadMesh(offPath, mesh)) {
+        error = "cannot read " + offPath;
+        return false;
+    }
+    vector<uint8_t> levels;
+    if (!encodeGeometry(mesh, size, modified, levels) || !geometryLevel(levels.data(), levels.size(), level, out)) {
+        error = "cannot encode " + offPath;
+        return false;
+    }
+    if (!cachePath.empty()) writeCache(cachePath, levels);
+    return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "generic.h"
+#include <cstdint>
+
+/**
+ * Compact binary geometry for the viewer: a mesh's triangles as 16 bit quantized positions, oct encoded normals and 16 or 32 bit
+ * indices, at the full mesh and a few coarser levels of detail, laid out so a browser wraps every array in place (typed arrays)
+ * buffer :: GeometryHeader | GeometryLevel[count] | blocks, every one starting on 4 bytes
+ * block  :: positions (uint16 x, y, z codes per vertex) | normals (int8 oct x, y per vertex) | indices (3 per triangle), each
+ *           padded to 4 bytes; indices are uint16 when every vertex fits, else uint32
+ * levels :: 0 is the mesh itself (polygons cut into fans), every next one clusters its vertices on a grid twice as coarse (the
+ *           cluster's mean stands for them, triangles left degenerate or doubled are dropped); a level is kept when it has at most
+ *           half the triangles of the one before, up to GEOMETRY_LEVELS; normals are area weighted over each level's own triangles
+ * a cache file holds every level, a served buffer one (count 1, first its level), little endian like the other mapped files
+ */
+const char GEOMETRY_MAGIC[4] = {'G', 'E', 'O', 'M'};
+const uint32_t GEOMETRY_VERSION = 1; // bump whenever the layout below or the way levels are built changes
+const uint32_t GEOMETRY_LEVELS = 4;
+
+struct GeometryHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t levels;        // the model has, 0 the full mesh
+    uint32_t first;         // level of the first table entry
+    uint32_t count;         // table entries, and blocks after them
+    uint32_t padding;       // zeroed
+    uint64_t sourceSize;    // fileStamp of the OFF file encoded, a cache file with another stamp is stale
+    int64_t sourceModified;
+    float origin[3];        // position = origin + code * step per axis, the model's 16 bit grid (see Quantized.h)
+    float step[3];
+};
+
+struct GeometryLevel {
+    uint32_t vertexCount;
+    uint32_t indexCount;    // 3 per triangle
+    uint32_t offset;        // of the level's block, from the start of the buffer
+    uint32_t size;          // of the block, in bytes
+};
+
+static_assert(sizeof(GeometryHeader) == 64 && sizeof(GeometryLevel) == 16, "the viewer decodes these at fixed offsets");
+
+bool encodeGeometry(const Mesh& mesh, uint64_t sourceSize, int64_t sourceModified, vector<uint8_t>& out); // every level, false past 4 GB
+bool geometryLevel(const uint8_t* data, size_t size, uint32_t level, vector<uint8_t>& out); // one level (past the coarsest: the coarsest)
+                                                                                         // of a buffer holding them all, false if malformed
+// one level of an OFF file, read from the cache file when it was encoded from the file as it is now, else encoded and written there
+// (through a temporary file renamed over it, so concurrent readers never see half of one); an empty cachePath caches nothing
+bool loadGeometry(const string& offPath, const string& cachePath, uint32_t level, vector<uint8_t>& out, string& error);
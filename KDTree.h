@@ -1,25 +1,474 @@
 #pragma once
 #include "generic.h"
+#include "Quantized.h"
+#include "Simd.h"
+#include "Stats.h"
+#include <array>
+#include <limits>
+#include <span>
+#include <type_traits>
 
+template <size_t Dim, typename Scalar>
+struct KDElement { using type = array<Scalar, Dim>; }; // e.g. shape descriptor vectors
+template <>
+struct KDElement<3, float> { using type = Point; };   // mesh vertices
+
+/**
+ * KDTree over Dim dimensional points, stored as flat arrays and queried iteratively with a fixed size stack
+ * the bulk built part is either owned or a view over someone else's memory (e.g. a mapped index)
+ * incremental inserts go to a binary counter of small bulk built trees, so every part is balanced
+ * mesh trees (3, float) also keep their points as x, y, z arrays so whole leaf buckets are scanned with one SIMD kernel call,
+ * or once compacted only as 16 bit codes on a Quantizer grid (6 bytes per point instead of 24), decoded inside the leaf kernel
+ */
+template <size_t Dim = 3, typename Scalar = float>
 class KDTree {
-    struct KDNode {
-        Point point;
-        KDNode *left, *right;
-        KDNode(const Point &p) : point(p), left(nullptr), right(nullptr) {}
+public:
+    using Element = typename KDElement<Dim, Scalar>::type;
+
+    struct FlatNode { // stored in preorder so an inner node's left child is always the next node
+        static const uint32_t LEAF = Dim;   // axis value marking a bucket
+        Scalar split;                       // splitting coordinate (inner nodes)
+        uint32_t axis;                      // 0 .. Dim - 1 or LEAF
+        uint32_t right;                     // index of the right child (inner nodes) or of the bucket's first point (leaves)
+        uint32_t count;                     // points in the bucket (leaves)
+    };
+
+    static constexpr size_t dimensions = Dim;
+    static constexpr bool simdLeaves = Dim == 3 && is_same_v<Scalar, float>;
+    static size_t leafStride(size_t pointCount) { return pointCount + 8; }; // x, y, z arrays are padded so a bucket can always be read 8 wide
+    static Scalar coord(const Element& p, uint32_t axis) { return p[axis]; };
+    static Scalar distanceSquared(const Element& a, const Element& b) {
+        Scalar dist = 0;
+        for (size_t axis = 0; axis < Dim; ++axis) { // unrolled, Dim is a constant
+            Scalar diff = a[axis] - b[axis];
+            dist += diff * diff;
+        }
+        return dist;
+    };
+
+private:
+    static const uint32_t BUCKET_SIZE = 8; // points per leaf, one leafDistances call
+    static const int MAX_DEPTH = 64;       // median splits halve every level, so 64 covers any point count
+
+    struct Part { // one balanced tree: nodes plus the points its leaves reference
+        const FlatNode* nodes = nullptr;
+        const Element* points = nullptr; // nullptr once compacted
+        size_t nodeCount = 0, pointCount = 0;
+        const float* leaves = nullptr; // x, y, z arrays of leafStride(pointCount) each (mesh trees only, scalar scan when missing)
+        const uint16_t* codes = nullptr; // instead of points and leaves in a compacted part: x, y, z code arrays laid out like leaves
+        Quantizer grid;                  // the codes' grid
+    };
+    struct Block { // owned storage of a part
+        vector<FlatNode> nodes;
+        vector<Element> points;
+        vector<float> leaves;
+        vector<uint16_t> codes;
+        Quantizer grid;
+        size_t pointCount() const { return codes.empty() ? points.size() : codes.size() / 3 - leafStride(0); }; // codes: 3 padded arrays
+        Part part() const {
+            return {nodes.data(), codes.empty() ? points.data() : nullptr, nodes.size(), pointCount(), leaves.empty() ? nullptr : leaves.data(),
+                    codes.empty() ? nullptr : codes.data(), grid};
+        };
     };
 
-    KDNode* root;
-    KDNode* insertHelper(KDNode* node, const Point &point, int depth);
-    bool searchHelper(const KDNode* node, const Point &point, int depth); 
-    void traverseHelper(const KDNode* node, std::vector<Point> &points);
-    void deleteKDTree(KDNode* node);
-    void nearestNeighborHelper(KDNode* node, const Point &point, Point &bestPoint, float &dist, int depth);
+    Block owned;           // storage of the bulk built part unless it is a view
+    Part base;             // the bulk built part
+    vector<Block> levels;  // inserted points: levels[i] is empty or holds exactly 2^i of them
+
+    static void buildBlock(Block& block, vector<Element>&& points);
+    static void buildHelper(Block& block, uint32_t begin, uint32_t end);
+    static Element pointAt(const Part& part, uint32_t i); // decoded when the part is compacted
+    static void scanLeaf(const Part& part, const FlatNode& leaf, const Element& point, Scalar* dist); // squared distance to every point of the bucket
+    static bool searchPart(const Part& part, const Element& point);
+    static void nearestPart(const Part& part, const Element& point, Element& bestPoint, Scalar& dist);
+    static void knnPart(const Part& part, const Element& point, size_t k, Element* best, Scalar* bestDist, size_t& found);
+    static void radiusPart(const Part& part, const Element& point, Scalar radiusSquared, vector<Element>& neighbors);
 
 public:
-    KDTree() : root(nullptr) {}
-    ~KDTree() { deleteKDTree(root); }
-    void insert(const Point &point);
-    bool search(const Point &point);
-    Point nearestNeighbor(const Point &point);
-    vector<Point> traverse();
-};
\ No newline at end of file
+    KDTree() {};
+    KDTree(const KDTree&) = delete;             // parts point into the tree's own storage, so it can only be moved
+    KDTree& operator=(const KDTree&) = delete;
+    KDTree(KDTree&& other) noexcept { *this = std::move(other); };
+    KDTree& operator=(KDTree&& other) noexcept;
+
+    // use a built tree in place, the memory must outlive the tree (leaves as returned by leafCoordinates, optional)
+    static KDTree view(const FlatNode* nodes, size_t nodeCount, const Element* points, size_t pointCount, const float* leaves = nullptr);
+    void build(const vector<Element> &points); // balanced median split tree over all points, replaces the current contents
+    void insert(const Element &point);         // incremental insert next to the bulk built part, amortized O(log^2 n)
+    // mesh trees only: the bulk built part keeps its points only as codes on grid, from then on points() and leafCoordinates() are
+    // nullptr; the points must already lie on grid (see Quantizer::snap), so every query answers exactly as before
+    void compact(const Quantizer& grid) requires simdLeaves;
+    bool compacted() const { return base.codes != nullptr; };
+    bool empty() const { return size() == 0; };
+    size_t size() const;
+    bool search(const Element &point) const;
+    Element nearestNeighbor(const Element &point, Scalar* distSquared = nullptr) const; // read only and allocation free, safe to call from several threads at once
+    // batched queries: neighbors and distSquared hold k entries per query, best first (missing ones get the query and infinity)
+    // with k == 1 every query starts from the previous query's answer, so spatially coherent batches prune most of the tree
+    void knn(span<const Element> queries, size_t k, span<Element> neighbors, span<Scalar> distSquared) const;
+    // every point within radius of each query: query i's neighbors are neighbors[offsets[i] .. offsets[i + 1]), buffers are reused
+    void radiusSearch(span<const Element> queries, Scalar radius, vector<uint32_t>& offsets, vector<Element>& neighbors) const;
+    vector<Element> traverse() const;
+    const FlatNode* nodes() const { return base.nodes; };     // bulk built part, e.g. to be written to an index
+    size_t nodeCount() const { return base.nodeCount; };
+    const Element* points() const { return base.points; };   // in tree order, leaves reference ranges of it
+    size_t pointCount() const { return base.pointCount; };
+    const float* leafCoordinates() const { return base.leaves; }; // x, y, z arrays of the bulk built part, leafStride(pointCount()) floats each
+    size_t memoryBytes() const; // owned storage only
+};
+
+using FlatKDNode = KDTree<>::FlatNode;
+
+/* ===== Private KDTree Functions ===== */
+template <size_t Dim, typename Scalar>
+void KDTree<Dim, Scalar>::buildBlock(Block& block, vector<Element>&& points) {
+    block.points = std::move(points);
+    block.nodes.clear();
+    block.nodes.reserve(2 * (block.points.size() / BUCKET_SIZE + 1));
+    if (!block.points.empty()) buildHelper(block, 0, static_cast<uint32_t>(block.points.size()));
+    if constexpr (simdLeaves) { // mirror the points in tree order as x, y, z arrays for the leaf kernel
+        size_t stride = leafStride(block.points.size());
+        block.leaves.assign(3 * stride, 0.0f);
+        for (size_t i = 0; i < block.points.size(); ++i) {
+            block.leaves[i] = block.points[i].x;
+            block.leaves[stride + i] = block.points[i].y;
+            block.leaves[2 * stride + i] = block.points[i].z;
+        }
+    }
+}
+
+template <size_t Dim, typename Scalar>
+void KDTree<Dim, Scalar>::buildHelper(Block& block, uint32_t begin, uint32_t end) {
+    uint32_t index = static_cast<uint32_t>(block.nodes.size());
+    block.nodes.push_back({0, FlatNode::LEAF, begin, end - begin});
+    if (end - begin <= BUCKET_SIZE) return;
+    // split on the axis with the largest spread so sorted or flat inputs still halve every level
+    uint32_t axis = 0;
+    Scalar widest = -1;
+    for (uint32_t dim = 0; dim < Dim; ++dim) {
+        Scalar lowest = coord(block.points[begin], dim), highest = lowest;
+        for (uint32_t i = begin; i < end; ++i) {
+            lowest = min(lowest, coord(block.points[i], dim));
+            highest = max(highest, coord(block.points[i], dim));
+        }
+        if (highest - lowest > widest) {
+            widest = highest - lowest;
+            axis = dim;
+        }
+    }
+    uint32_t middle = begin + (end - begin) / 2;
+    nth_element(block.points.begin() + begin, block.points.begin() + middle, block.points.begin() + end,
+                [axis](const Element& a, const Element& b) { return coord(a, axis) < coord(b, axis); });
+    // everything left of middle is <= split and everything from middle on is >= split
+    block.nodes[index].split = coord(block.points[middle], axis);
+    block.nodes[index].axis = axis;
+    buildHelper(block, begin, middle);
+    block.nodes[index].right = static_cast<uint32_t>(block.nodes.size());
+    buildHelper(block, middle, end);
+}
+
+template <size_t Dim, typename Scalar>
+typename KDTree<Dim, Scalar>::Element KDTree<Dim, Scalar>::pointAt(const Part& part, uint32_t i) {
+    if constexpr (simdLeaves) {
+        if (part.codes) {
+            size_t stride = leafStride(part.pointCount);
+            return part.grid.decode(part.codes[i], part.codes[stride + i], part.codes[2 * stride + i]);
+        }
+    }
+    return part.points[i];
+}
+
+template <size_t Dim, typename Scalar>
+void KDTree<Dim, Scalar>::scanLeaf(const Part& part, const FlatNode& leaf, const Element& point, Scalar* dist) {
+    if constexpr (simdLeaves) {
+        if (part.codes) {
+            size_t stride = leafStride(part.pointCount);
+            const uint16_t* xs = part.codes + leaf.right;
+            quantizedLeafDistances(xs, xs + stride, xs + 2 * stride, part.grid.origin, part.grid.step, point.x, point.y, point.z, dist);
+            return;
+        }
+        if (part.leaves) {
+            size_t stride = leafStride(part.pointCount);
+            const float* xs = part.leaves + leaf.right;
+            leafDistances(xs, xs + stride, xs + 2 * stride, point.x, point.y, point.z, dist);
+            return;
+        }
+    }
+    for (uint32_t i = 0; i < leaf.count; ++i)
+        dist[i] = distanceSquared(part.points[leaf.right + i], point);
+}
+
+template <size_t Dim, typename Scalar>
+bool KDTree<Dim, Scalar>::searchPart(const Part& part, const Element& point) {
+    if (part.nodeCount == 0) return false;
+    LocalCounter visited(Counter::KDNodesVisited);
+    uint32_t stack[MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const FlatNode& node = part.nodes[stack[--top]];
+        ++visited;
+        if (node.axis == FlatNode::LEAF) {
+            for (uint32_t i = node.right; i < node.right + node.count; ++i)
+                if (distanceSquared(pointAt(part, i), point) == 0) return true;
+            continue;
+        }
+        // points equal to the split can sit on either side of it
+        Scalar value = coord(point, node.axis);
+        if (value >= node.split) stack[top++] = node.right;
+        if (value <= node.split) stack[top++] = static_cast<uint32_t>(&node - part.nodes) + 1;
+    }
+    return false;
+}
+
+template <size_t Dim, typename Scalar>
+void KDTree<Dim, Scalar>::nearestPart(const Part& part, const Element& point, Element& bestPoint, Scalar& dist) {
+    if (part.nodeCount == 0) return;
+    uint32_t stackNode[MAX_DEPTH];   // farther children still to visit
+    Scalar stackPlane[MAX_DEPTH];    // and their squared distance to the splitting plane
+    int top = 0;
+    uint32_t index = 0;
+    LocalCounter visited(Counter::KDNodesVisited), leaves(Counter::KDLeavesScanned), pruned(Counter::KDSubtreesPruned);
+    while (true) {
+        // descend to the closer leaf, remembering the other side of every split
+        while (part.nodes[index].axis != FlatNode::LEAF) {
+            const FlatNode& node = part.nodes[index];
+            Scalar distPlane = coord(point, node.axis) - node.split;
+            stackNode[top] = distPlane < 0 ? node.right : index + 1;
+            stackPlane[top++] = distPlane * distPlane;
+            index = distPlane < 0 ? index + 1 : node.right;
+            ++visited;
+        }
+        const FlatNode& leaf = part.nodes[index];
+        ++visited;
+        ++leaves;
+        Scalar leafDist[BUCKET_SIZE];
+        scanLeaf(part, leaf, point, leafDist);
+        for (uint32_t i = 0; i < leaf.count; ++i) {
+            if (leafDist[i] < dist) {
+                dist = leafDist[i];
+                bestPoint = pointAt(part, leaf.right + i);
+            }
+        }
+        // the other side of a splitting plane can only hold something closer if the plane itself is closer
+        while (true) {
+            if (top == 0) return;
+            --top;
+            if (stackPlane[top] < dist) break;
+            ++pruned;
+        }
+        index = stackNode[top];
+    }
+}
+
+template <size_t Dim, typename Scalar>
+void KDTree<Dim, Scalar>::knnPart(const Part& part, const Element& point, size_t k, Element* best, Scalar* bestDist, size_t& found) {
+    if (part.nodeCount == 0) return;
+    uint32_t stackNode[MAX_DEPTH];
+    Scalar stackPlane[MAX_DEPTH];
+    int top = 0;
+    uint32_t index = 0;
+    LocalCounter visited(Counter::KDNodesVisited), leaves(Counter::KDLeavesScanned), pruned(Counter::KDSubtreesPruned);
+    while (true) {
+        while (part.nodes[index].axis != FlatNode::LEAF) {
+            const FlatNode& node = part.nodes[index];
+            Scalar distPlane = coord(point, node.axis) - node.split;
+            stackNode[top] = distPlane < 0 ? node.right : index + 1;
+            stackPlane[top++] = distPlane * distPlane;
+            index = distPlane < 0 ? index + 1 : node.right;
+            ++visited;
+        }
+        const FlatNode& leaf = part.nodes[index];
+        ++visited;
+        ++leaves;
+        Scalar leafDist[BUCKET_SIZE];
+        scanLeaf(part, leaf, point, leafDist);
+        for (uint32_t i = 0; i < leaf.count; ++i) { // insertion into the sorted k best
+            if (found == k && leafDist[i] >= bestDist[k - 1]) continue;
+            size_t slot = found < k ? found++ : k - 1;
+            for (; slot > 0 && bestDist[slot - 1] > leafDist[i]; --slot) {
+                bestDist[slot] = bestDist[slot - 1];
+                best[slot] = best[slot - 1];
+            }
+            bestDist[slot] = leafDist[i];
+            best[slot] = pointAt(part, leaf.right + i);
+        }
+        // until k points are found every subtree can contribute
+        while (true) {
+            if (top == 0) return;
+            --top;
+            if (found < k || stackPlane[top] < bestDist[k - 1]) break;
+            ++pruned;
+        }
+        index = stackNode[top];
+    }
+}
+
+template <size_t Dim, typename Scalar>
+void KDTree<Dim, Scalar>::radiusPart(const Part& part, const Element& point, Scalar radiusSquared, vector<Element>& neighbors) {
+    if (part.nodeCount == 0) return;
+    uint32_t stack[MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    LocalCounter visited(Counter::KDNodesVisited), leaves(Counter::KDLeavesScanned), pruned(Counter::KDSubtreesPruned);
+    while (top > 0) {
+        uint32_t index = stack[--top];
+        const FlatNode& node = part.nodes[index];
+        ++visited;
+        if (node.axis == FlatNode::LEAF) {
+            ++leaves;
+            Scalar leafDist[BUCKET_SIZE];
+            scanLeaf(part, node, point, leafDist);
+            for (uint32_t i = 0; i < node.count; ++i)
+                if (leafDist[i] <= radiusSquared) neighbors.push_back(pointAt(part, node.right + i));
+            continue;
+        }
+        Scalar distPlane = coord(point, node.axis) - node.split;
+        // the closer side always, the other one only when the ball crosses the plane
+        if (distPlane * distPlane <= radiusSquared) stack[top++] = distPlane < 0 ? node.right : index + 1;
+        else ++pruned;
+        stack[top++] = distPlane < 0 ? index + 1 : node.right;
+    }
+}
+
+/* ===== Public KDTree Functions ===== */
+template <size_t Dim, typename Scalar>
+KDTree<Dim, Scalar>& KDTree<Dim, Scalar>::operator=(KDTree&& other) noexcept {
+    if (this != &other) {
+        bool ownsBase = other.base.nodes == other.owned.nodes.data();
+        owned = std::move(other.owned); // moving keeps the buffers, so the parts stay valid
+        base = ownsBase ? owned.part() : other.base;
+        levels = std::move(other.levels);
+        other.owned = Block();
+        other.base = Part();
+        other.levels.clear();
+    }
+    return *this;
+}
+
+template <size_t Dim, typename Scalar>
+KDTree<Dim, Scalar> KDTree<Dim, Scalar>::view(const FlatNode* nodes, size_t nodeCount, const Element* points, size_t pointCount, const float* leaves) {
+    KDTree tree;
+    tree.base = {nodes, points, nodeCount, pointCount, simdLeaves ? leaves : nullptr};
+    return tree;
+}
+
+template <size_t Dim, typename Scalar>
+void KDTree<Dim, Scalar>::build(const vector<Element> &points) {
+    levels.clear();
+    buildBlock(owned, vector<Element>(points));
+    base = owned.part();
+}
+
+template <size_t Dim, typename Scalar>
+void KDTree<Dim, Scalar>::insert(const Element &point) {
+    // binary counter: merge full levels into the first empty one and rebuild it balanced
+    vector<Element> carry(1, point);
+    size_t level = 0;
+    for (; level < levels.size() && !levels[level].points.empty(); ++level) {
+        carry.insert(carry.end(), levels[level].points.begin(), levels[level].points.end());
+        levels[level] = Block();
+    }
+    if (level == levels.size()) levels.emplace_back();
+    buildBlock(levels[level], std::move(carry));
+}
+
+template <size_t Dim, typename Scalar>
+void KDTree<Dim, Scalar>::compact(const Quantizer& grid) requires simdLeaves {
+    Block block;
+    block.nodes.assign(base.nodes, base.nodes + base.nodeCount);
+    block.grid = grid;
+    size_t stride = leafStride(base.pointCount);
+    block.codes.assign(3 * stride, 0); // padded like the leaves, the kernel reads whole buckets
+    for (uint32_t i = 0; i < base.pointCount; ++i) {
+        Element p = pointAt(base, i);
+        block.codes[i] = grid.encode(p.x, 0);
+        block.codes[stride + i] = grid.encode(p.y, 1);
+        block.codes[2 * stride + i] = grid.encode(p.z, 2);
+    }
+    owned = std::move(block);
+    base = owned.part();
+}
+
+template <size_t Dim, typename Scalar>
+size_t KDTree<Dim, Scalar>::memoryBytes() const {
+    auto bytes = [](const Block& block) {
+        return block.nodes.capacity() * sizeof(FlatNode) + block.points.capacity() * sizeof(Element) + block.leaves.capacity() * sizeof(float)
+             + block.codes.capacity() * sizeof(uint16_t);
+    };
+    size_t total = bytes(owned);
+    for (const Block& block : levels) total += bytes(block);
+    return total;
+}
+
+template <size_t Dim, typename Scalar>
+size_t KDTree<Dim, Scalar>::size() const {
+    size_t total = base.pointCount;
+    for (const Block& block : levels) total += block.points.size();
+    return total;
+}
+
+template <size_t Dim, typename Scalar>
+bool KDTree<Dim, Scalar>::search(const Element &point) const {
+    if (searchPart(base, point)) return true;
+    for (const Block& block : levels)
+        if (searchPart(block.part(), point)) return true;
+    return false;
+}
+
+template <size_t Dim, typename Scalar>
+typename KDTree<Dim, Scalar>::Element KDTree<Dim, Scalar>::nearestNeighbor(const Element &point, Scalar* distSquared) const {
+    Element bestPoint = point; // returned as is when the tree is empty
+    Scalar dist = numeric_limits<Scalar>::infinity();
+    nearestPart(base, point, bestPoint, dist);
+    for (const Block& block : levels) nearestPart(block.part(), point, bestPoint, dist);
+    if (distSquared) *distSquared = empty() ? 0 : dist;
+    return bestPoint;
+}
+
+template <size_t Dim, typename Scalar>
+void KDTree<Dim, Scalar>::knn(span<const Element> queries, size_t k, span<Element> neighbors, span<Scalar> distSquared) const {
+    if (k == 0) return;
+    for (size_t q = 0; q < queries.size(); ++q) {
+        Element* best = neighbors.data() + q * k;
+        Scalar* bestDist = distSquared.data() + q * k;
+        if (k == 1) {
+            // the previous answer is a point of the tree, so its distance already bounds this query's search
+            Element bestPoint = q > 0 && !empty() ? best[-1] : queries[q];
+            Scalar dist = q > 0 && !empty() ? distanceSquared(bestPoint, queries[q]) : numeric_limits<Scalar>::infinity();
+            nearestPart(base, queries[q], bestPoint, dist);
+            for (const Block& block : levels) nearestPart(block.part(), queries[q], bestPoint, dist);
+            best[0] = bestPoint;
+            bestDist[0] = dist;
+            continue;
+        }
+        size_t found = 0;
+        knnPart(base, queries[q], k, best, bestDist, found);
+        for (const Block& block : levels) knnPart(block.part(), queries[q], k, best, bestDist, found);
+        for (; found < k; ++found) {
+            best[found] = queries[q];
+            bestDist[found] = numeric_limits<Scalar>::infinity();
+        }
+    }
+}
+
+template <size_t Dim, typename Scalar>
+void KDTree<Dim, Scalar>::radiusSearch(span<const Element> queries, Scalar radius, vector<uint32_t>& offsets, vector<Element>& neighbors) const {
+    offsets.assign(1, 0);
+    neighbors.clear();
+    for (const Element& query : queries) {
+        radiusPart(base, query, radius * radius, neighbors);
+        for (const Block& block : levels) radiusPart(block.part(), query, radius * radius, neighbors);
+        offsets.push_back(static_cast<uint32_t>(neighbors.size()));
+    }
+}
+
+template <size_t Dim, typename Scalar>
+vector<typename KDTree<Dim, Scalar>::Element> KDTree<Dim, Scalar>::traverse() const {
+    vector<Element> points(base.pointCount);
+    for (uint32_t i = 0; i < base.pointCount; ++i) points[i] = pointAt(base, i);
+    for (const Block& block : levels) points.insert(points.end(), block.points.begin(), block.points.end());
+    return points;
+}
+
+extern template class KDTree<3, float>; // mesh vertices, instantiated once in KDTree.cpp
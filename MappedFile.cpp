@@ -0,0 +1,53 @@
+#include "MappedFile.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& path) {
+    close();
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) { file = nullptr; return false; }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) { close(); return false; }
+    length = static_cast<size_t>(fileSize.QuadPart);
+    if (length == 0) return true; // CreateFileMapping refuses empty files
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) { close(); return false; }
+    bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!bytes) { close(); return false; }
+    return true;
+}
+
+void MappedFile::close() {
+    if (bytes) UnmapViewOfFile(bytes);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+    bytes = nullptr; mapping = nullptr; file = nullptr; length = 0;
+}
+#else
+bool MappedFile::open(const std::string& path) {
+    close();
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0) { close(); return false; }
+    length = static_cast<size_t>(info.st_size);
+    if (length == 0) return true; // mmap refuses empty files
+    void* address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) { close(); return false; }
+    bytes = static_cast<const char*>(address);
+    return true;
+}
+
+void MappedFile::close() {
+    if (bytes) munmap(const_cast<char*>(bytes), length);
+    if (fd >= 0) ::close(fd);
+    bytes = nullptr; fd = -1; length = 0;
+}
+#endif
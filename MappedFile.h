@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+class MappedFile { // read-only memory map of a whole file, shared with every other process mapping it
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+public:
+    MappedFile() {};
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path); // false if the file can't be opened or mapped (empty files map to size 0)
+    void close();
+    const char* data() const { return bytes; };
+    size_t size() const { return length; };
+};
@@ -0,0 +1,141 @@
+#include "Matrix.h"
+#include "ScoreCache.h"
+#include <cstring>
+#include <sstream>
+
+namespace {
+    const char CSV_HEADER[] = "a,b,score\n";
+
+    string csvField(const string& text) { // quoted only when it has to be
+        if (text.find_first_of(",\"\n") == string::npos) return text;
+        string quoted = "\"";
+        for (char c : text) {
+            if (c == '"') quoted += '"';
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+}
+
+vector<MatrixTile> matrixTiles(const vector<uint32_t>& blockStarts, uint32_t modelCount) {
+    vector<MatrixTile> tiles;
+    for (size_t row = 0; row < blockStarts.size(); ++row) {
+        uint32_t rowEnd = row + 1 < blockStarts.size() ? blockStarts[row + 1] : modelCount;
+        for (size_t column = row; column < blockStarts.size(); ++column) {
+            uint32_t columnEnd = column + 1 < blockStarts.size() ? blockStarts[column + 1] : modelCount;
+            tiles.push_back({blockStarts[row], rowEnd, blockStarts[column], columnEnd});
+        }
+    }
+    return tiles;
+}
+
+string MatrixWriter::checkpointHeader(const string& algorithm, const string& sampling, const vector<string>& names,
+                                      const vector<MatrixTile>& tiles) const {
+    uint64_t namesHash = 0;
+    for (const string& name : names) namesHash = hashBytes(name.c_str(), name.size() + 1, namesHash); // with the terminator, so "ab" "c" != "a" "bc"
+    ostringstream header;
+    header << "matrix " << MATRIX_VERSION << ' ' << algorithm << ' ' << sampling << ' ' << modelCount << ' ' << tiles.size() << ' '
+           << (csv ? "csv" : "binary") << " names " << hex << namesHash << dec << " blocks";
+    for (const MatrixTile& tile : tiles)
+        if (tile.diagonal()) header << ' ' << tile.rowBegin;
+    return header.str();
+}
+
+bool MatrixWriter::resume(const string& header) {
+    ifstream in(checkpointPath);
+    string line;
+    if (!getline(in, line) || line != header) return false;
+    uint64_t csvBytes = sizeof(CSV_HEADER) - 1;
+    while (getline(in, line)) { // a line cut short by the interruption fails to parse and is ignored
+        istringstream entry(line);
+        size_t tile;
+        uint64_t bytes;
+        if (!(entry >> tile >> bytes) || tile >= finished.size()) continue;
+        finished[tile] = true;
+        csvBytes = max(csvBytes, bytes);
+    }
+    std::error_code error;
+    if (csv) filesystem::resize_file(path, csvBytes, error); // drops the rows of a tile that was being written
+    return !error;
+}
+
+bool MatrixWriter::open(const string& outputPath, const string& algorithm, const string& sampling, const vector<string>& names,
+                        const vector<MatrixTile>& tiles) {
+    path = outputPath;
+    checkpointPath = outputPath + ".checkpoint";
+    csv = filesystem::path(outputPath).extension() == ".csv";
+    modelCount = names.size();
+    finished.assign(tiles.size(), false);
+    string header = checkpointHeader(algorithm, sampling, names, tiles);
+    size_t namesBytes = 0;
+    for (const string& name : names) namesBytes += name.size() + 1;
+    scoresOffset = sizeof(MatrixHeader) + (namesBytes + 3) / 4 * 4;
+
+    bool resuming = filesystem::exists(checkpointPath) && filesystem::exists(outputPath);
+    if (resuming) {
+        if (!resume(header)) return false;
+    } else {
+        ofstream fresh(outputPath, ios::binary | ios::trunc);
+        if (csv) fresh << CSV_HEADER;
+        else {
+            MatrixHeader matrix = {};
+            memcpy(matrix.magic, MATRIX_MAGIC, sizeof(MATRIX_MAGIC));
+            matrix.version = MATRIX_VERSION;
+            matrix.algorithm = algorithm == "kdtree" ? 0 : 1;
+            matrix.modelCount = modelCount;
+            matrix.scoresOffset = scoresOffset;
+            fresh.write(reinterpret_cast<const char*>(&matrix), sizeof(matrix));
+            for (const string& name : names) fresh.write(name.c_str(), static_cast<streamsize>(name.size() + 1));
+        }
+        fresh.close();
+        if (!fresh) return false;
+        std::error_code error;
+        if (!csv) filesystem::resize_file(outputPath, scoresOffset + modelCount * modelCount * sizeof(float), error); // zeros until written
+        if (error) return false;
+    }
+    out.open(outputPath, ios::in | ios::out | ios::binary);
+    if (csv) out.seekp(0, ios::end);
+    checkpoint.open(checkpointPath, resuming ? ios::app : ios::trunc);
+    if (!resuming) checkpoint << header << endl;
+    return out && checkpoint;
+}
+
+bool MatrixWriter::write(size_t tile, const MatrixTile& area, const vector<float>& scores, const vector<string>& names) {
+    lock_guard<mutex> guard(writeLock);
+    if (csv) {
+        for (size_t r = 0; r < area.rows(); ++r) {
+            size_t first = area.diagonal() ? r : 0; // the pair and the model against itself, never the mirrored pair
+            for (size_t c = first; c < area.columns(); ++c)
+                out << csvField(names[area.rowBegin + r]) << ',' << csvField(names[area.columnBegin + c]) << ',' << scores[r * area.columns() + c] << '\n';
+        }
+    } else {
+        auto writeRun = [&](size_t row, size_t column, const float* values, size_t count) {
+            out.seekp(static_cast<streamoff>(scoresOffset + (row * modelCount + column) * sizeof(float)));
+            out.write(reinterpret_cast<const char*>(values), static_cast<streamsize>(count * sizeof(float)));
+        };
+        for (size_t r = 0; r < area.rows(); ++r) writeRun(area.rowBegin + r, area.columnBegin, &scores[r * area.columns()], area.columns());
+        if (!area.diagonal()) { // the mirrored tile below the diagonal, one contiguous run per column
+            vector<float> column(area.rows());
+            for (size_t c = 0; c < area.columns(); ++c) {
+                for (size_t r = 0; r < area.rows(); ++r) column[r] = scores[r * area.columns() + c];
+                writeRun(area.columnBegin + c, area.rowBegin, column.data(), column.size());
+            }
+        }
+    }
+    out.flush();
+    if (!out) return false;
+    uint64_t bytes = csv ? static_cast<uint64_t>(out.tellp()) : 0;
+    checkpoint << tile << ' ' << bytes << endl; // only once the scores are out
+    finished[tile] = true;
+    return static_cast<bool>(checkpoint);
+}
+
+bool MatrixWriter::finish() {
+    lock_guard<mutex> guard(writeLock);
+    out.close();
+    checkpoint.close();
+    if (count(finished.begin(), finished.end(), false) > 0 || !out) return false;
+    std::error_code error;
+    filesystem::remove(checkpointPath, error);
+    return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "generic.h"
+#include <mutex>
+
+/**
+ * All pairs similarity matrix of a corpus, written while it is computed and resumable after an interrupted run
+ * the models are cut into blocks of consecutive models small enough that two blocks' trees stay in cache together, a tile
+ * compares one block against another on one thread; only tiles on or above the block diagonal are computed, the scores are
+ * symmetric so the other half is their mirror image
+ * output by extension :: .csv   "a,b,score" rows, every unordered pair once (a at or before b in corpus order), tile by tile as they finish
+ *                        other  MatrixHeader | model names (each null terminated, padded to 4 bytes) | n x n floats, row major
+ * progress goes to <output>.checkpoint: a header line, then "<tile> <output bytes>" once a finished tile's scores are flushed;
+ * a run that finds the checkpoint skips those tiles (a csv is cut back to the last one), it is removed once the matrix is complete
+ * the header names the run: algorithm, sampling, a hash of the model names and the block starts (which follow the models' point
+ * counts and the thread count), so a run that would score or cut the models any other way refuses to resume
+ */
+const char MATRIX_MAGIC[8] = {'S', 'I', 'M', 'M', 'A', 'T', 'X', '\0'};
+const uint32_t MATRIX_VERSION = 1;
+
+struct MatrixHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t algorithm;     // 0 kdtree (squared Hausdorff distance, lower is more similar), 1 octree (percentage, higher is)
+    uint64_t modelCount;
+    uint64_t scoresOffset;  // from the start of the file
+};
+
+struct MatrixTile { // model ranges [begin, end), rowBegin <= columnBegin
+    uint32_t rowBegin, rowEnd, columnBegin, columnEnd;
+    bool diagonal() const { return rowBegin == columnBegin; };
+    size_t rows() const { return rowEnd - rowBegin; };
+    size_t columns() const { return columnEnd - columnBegin; };
+};
+
+vector<MatrixTile> matrixTiles(const vector<uint32_t>& blockStarts, uint32_t modelCount); // every block pair on or above the diagonal
+
+class MatrixWriter { // output file and checkpoint of one matrix run, write() may be called from several threads
+    string path, checkpointPath;
+    bool csv = false;
+    fstream out;
+    ofstream checkpoint;
+    vector<bool> finished;  // per tile
+    size_t modelCount = 0;
+    uint64_t scoresOffset = 0;
+    mutex writeLock;
+
+    string checkpointHeader(const string& algorithm, const string& sampling, const vector<string>& names, const vector<MatrixTile>& tiles) const;
+    bool resume(const string& header); // reads an existing checkpoint, false if there is none or it belongs to another run
+
+public:
+    // starts a new matrix or picks up the checkpointed one, false if the output can't be written or a checkpoint doesn't match
+    // sampling: the samplingName the models were preprocessed with
+    bool open(const string& outputPath, const string& algorithm, const string& sampling, const vector<string>& names, const vector<MatrixTile>& tiles);
+    bool done(size_t tile) const { return finished[tile]; };
+    size_t doneCount() const { return static_cast<size_t>(count(finished.begin(), finished.end(), true)); };
+    // scores: tile.rows() x tile.columns(), row major (both halves filled on diagonal tiles)
+    bool write(size_t tile, const MatrixTile& area, const vector<float>& scores, const vector<string>& names);
+    bool finish(); // true once every tile is written, the checkpoint is then removed
+};
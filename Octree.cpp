@@ -1,143 +1,315 @@
 #include "Octree.h"
+#include "Stats.h"
+#include <cstring>
 
-void Octree::subdivide(OctreeNode* node) { // O(1)
-     
-    Point blbs[8] = {
-        {node->backLeftBottom.x, node->backLeftBottom.y, node->backLeftBottom.z},
-        {node->center.x,         node->backLeftBottom.y, node->backLeftBottom.z},
-        {node->backLeftBottom.x, node->center.y,         node->backLeftBottom.z},
-        {node->center.x,         node->center.y,         node->backLeftBottom.z},
-        {node->backLeftBottom.x, node->backLeftBottom.y, node->center.z},
-        {node->center.x,         node->backLeftBottom.y, node->center.z},
-        {node->backLeftBottom.x, node->center.y,         node->center.z},
-        {node->center.x,         node->center.y,         node->center.z}
-    };
-
-    Point frt[8] = {
-        {node->center.x,         node->center.y,         node->center.z},
-        {node->frontRightTop.x,  node->center.y,         node->center.z},
-        {node->center.x,         node->frontRightTop.y,  node->center.z},
-        {node->frontRightTop.x,  node->frontRightTop.y,  node->center.z},
-        {node->center.x,         node->center.y,         node->frontRightTop.z},
-        {node->frontRightTop.x,  node->center.y,         node->frontRightTop.z},
-        {node->center.x,         node->frontRightTop.y,  node->frontRightTop.z},
-        {node->frontRightTop.x,  node->frontRightTop.y,  node->frontRightTop.z}
-    };
-    
+namespace {
+    uint64_t spreadBits(uint64_t v) { // put the low 21 bits of v into every third bit
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffULL;
+        v = (v | v << 16) & 0x1f0000ff0000ffULL;
+        v = (v | v << 8) & 0x100f00f00f00f00fULL;
+        v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+        v = (v | v << 2) & 0x1249249249249249ULL;
+        return v;
+    }
 
-    for (int i = 0; i < OctreeNode::MAXCHILDREN; ++i) {
-        node->children[i] = new OctreeNode(blbs[i], frt[i]);
+    void radixSort(vector<pair<uint64_t, uint32_t>>& keyed) { // stable LSD sort on the codes, 8 bits per pass
+        vector<pair<uint64_t, uint32_t>> scratch(keyed.size());
+        for (int shift = 0; shift < 64; shift += 8) {
+            size_t counts[257] = {0};
+            for (const auto& key : keyed) counts[(key.first >> shift & 0xff) + 1]++;
+            if (counts[(keyed[0].first >> shift & 0xff) + 1] == keyed.size()) continue; // every code has the same digit
+            for (int i = 0; i < 256; ++i) counts[i + 1] += counts[i];
+            for (const auto& key : keyed) scratch[counts[key.first >> shift & 0xff]++] = key;
+            keyed.swap(scratch);
+        }
     }
 }
 
-void Octree::insertHelper(OctreeNode* node, const Point &point) { // O(log n)
+Octree::Octree(const Point& frontRightTop, const Point& backLeftBottom) : low(backLeftBottom) {
+    side = max(frontRightTop.x - backLeftBottom.x, max(frontRightTop.y - backLeftBottom.y, frontRightTop.z - backLeftBottom.z));
+}
 
-    if(!node->isLeaf()) { // node is internal (has children)
-        insertHelper(node->children[getIndex(node, point)], point); // insert in the proper subquadrant
+Octree& Octree::operator=(Octree&& other) noexcept {
+    if (this != &other) {
+        bool ownsNodes = other.nodeData == other.ownedNodes.data();
+        ownedNodes = std::move(other.ownedNodes); // moving keeps the buffers, so the pointers stay valid
+        ownedPoints = std::move(other.ownedPoints);
+        ownedOccupancy = std::move(other.ownedOccupancy);
+        pending = std::move(other.pending);
+        packed = std::move(other.packed);
+        nodeData = ownsNodes ? ownedNodes.data() : other.nodeData;
+        pointData = ownsNodes && other.pointData ? ownedPoints.data() : other.pointData; // nullptr once compacted
+        occupancyData = ownsNodes ? ownedOccupancy.data() : other.occupancyData;
+        nodeTotal = other.nodeTotal;
+        pointTotal = other.pointTotal;
+        occupancyTotal = other.occupancyTotal;
+        low = other.low;
+        side = other.side;
+        other.ownedNodes.clear();
+        other.ownedPoints.clear();
+        other.ownedOccupancy.clear();
+        other.packed = PackedPoints();
+        other.nodeData = nullptr;
+        other.pointData = nullptr;
+        other.occupancyData = nullptr;
+        other.nodeTotal = other.pointTotal = other.occupancyTotal = 0;
     }
-    else { // node is a leaf
-        if(node->contents.size() < OctreeNode::MAXCHILDREN) {
-            node->contents.push_back(point); // now the point has been added
-        }
-        else {
-            subdivide(node); // modifies the children
-            node->children[getIndex(node, point)]->contents.push_back(point);
+    return *this;
+}
+
+Octree Octree::view(const OctNode* nodes, size_t nodeCount, const Point* points, size_t pointCount, const Point& low, float side,
+                    const uint32_t* occupancy, size_t occupancyWords) {
+    Octree tree;
+    tree.nodeData = nodes;
+    tree.nodeTotal = nodeCount;
+    tree.pointData = points;
+    tree.pointTotal = pointCount;
+    tree.low = low;
+    tree.side = side;
+    tree.occupancyData = occupancy;
+    tree.occupancyTotal = occupancyWords;
+    return tree;
+}
+
+uint64_t Octree::mortonCode(const Point& point) const { // O(1)
+    const float cells = static_cast<float>(1u << MAX_DEPTH);
+    float scale = side > 0.0f ? cells / side : 0.0f;
+    auto cell = [&](float value, float origin) {
+        float c = (value - origin) * scale;
+        return static_cast<uint64_t>(min(max(c, 0.0f), cells - 1.0f)); // the far border belongs to the last cell
+    };
+    return spreadBits(cell(point.x, low.x)) | spreadBits(cell(point.y, low.y)) << 1 | spreadBits(cell(point.z, low.z)) << 2;
+}
+
+void Octree::buildNodes(const vector<uint64_t>& codes) { // O(n) after sorting, breadth first so siblings are adjacent
+    ownedNodes.clear();
+    if (codes.empty()) return;
+    ownedNodes.push_back({0, static_cast<uint32_t>(codes.size()), 0, 0, 0});
+    for (size_t i = 0; i < ownedNodes.size(); ++i) {
+        OctNode node = ownedNodes[i]; // copy, push_back below can move the array
+        if (node.count <= OctNode::MAXCHILDREN || node.depth == MAX_DEPTH) continue;
+        int shift = 3 * (MAX_DEPTH - 1 - node.depth);
+        uint8_t mask = 0;
+        uint32_t firstChild = static_cast<uint32_t>(ownedNodes.size());
+        for (uint32_t begin = node.begin, end = node.begin + node.count; begin < end;) {
+            int octant = static_cast<int>(codes[begin] >> shift & 7);
+            // the node's points are sorted, so each octant is one run
+            uint32_t runEnd = static_cast<uint32_t>(partition_point(codes.begin() + begin, codes.begin() + end,
+                [&](uint64_t code) { return static_cast<int>(code >> shift & 7) <= octant; }) - codes.begin());
+            ownedNodes.push_back({begin, runEnd - begin, 0, 0, static_cast<uint8_t>(node.depth + 1)});
+            mask |= static_cast<uint8_t>(1 << octant);
+            begin = runEnd;
         }
+        ownedNodes[i].childMask = mask;
+        ownedNodes[i].firstChild = firstChild;
     }
 }
 
-bool Octree::searchHelper(const OctreeNode* node, const Point &param) {
-    if (node->isLeaf()){
-       for (const Point& point : node->contents) {
-        if (point == param) return true;
-       }
-       return false;
+void Octree::build(const vector<Point>& points) {
+    pending.clear();
+    if (side <= 0.0f && !points.empty()) { // fit a cube around the points
+        Point high = points[0];
+        low = points[0];
+        for (const Point& p : points) {
+            low = Point(min(low.x, p.x), min(low.y, p.y), min(low.z, p.z));
+            high = Point(max(high.x, p.x), max(high.y, p.y), max(high.z, p.z));
+        }
+        side = max(high.x - low.x, max(high.y - low.y, high.z - low.z));
+        Point center((low.x + high.x) / 2.0f, (low.y + high.y) / 2.0f, (low.z + high.z) / 2.0f);
+        low = Point(center.x - side / 2.0f, center.y - side / 2.0f, center.z - side / 2.0f);
     }
-    else {
-        return searchHelper(node->children[getIndex(node, param)], param);
+    vector<pair<uint64_t, uint32_t>> keyed(points.size()); // (code, input position), ties keep input order
+    for (size_t i = 0; i < points.size(); ++i) keyed[i] = {mortonCode(points[i]), static_cast<uint32_t>(i)};
+    if (!keyed.empty()) radixSort(keyed);
+    packed = PackedPoints();
+    ownedPoints.resize(points.size());
+    vector<uint64_t> codes(points.size());
+    for (size_t i = 0; i < keyed.size(); ++i) {
+        ownedPoints[i] = points[keyed[i].second];
+        codes[i] = keyed[i].first;
     }
+    buildNodes(codes);
+    buildOccupancy(codes);
+    nodeData = ownedNodes.data();
+    nodeTotal = ownedNodes.size();
+    pointData = ownedPoints.data();
+    pointTotal = ownedPoints.size();
+    occupancyData = ownedOccupancy.empty() ? nullptr : ownedOccupancy.data();
+    occupancyTotal = ownedOccupancy.size();
 }
 
-void Octree::traverseHelper(const OctreeNode* node, vector<Point> &accum) {
-    if (node->isLeaf()) {
-       for(const Point& point : node->contents) {
-            accum.push_back(point);
-       }
-    }
-    else {
-        for(const OctreeNode* child : node->children) {
-            traverseHelper(child, accum);
+void Octree::buildOccupancy(const vector<uint64_t>& codes) { // O(n) per level, every level's cells are runs of the sorted codes
+    ownedOccupancy.clear();
+    if (codes.empty()) return;
+    uint32_t levelStart[Occupancy::LEVELS + 1];
+    vector<uint32_t> keys, counts;
+    vector<Point> centroids;
+    vector<uint8_t> masks;
+    for (int level = 0; level < Occupancy::LEVELS; ++level) {
+        levelStart[level] = static_cast<uint32_t>(keys.size());
+        int shift = 3 * (MAX_DEPTH - level), childShift = shift - 3;
+        for (size_t i = 0; i < codes.size();) {
+            uint64_t key = codes[i] >> shift;
+            uint8_t mask = 0;
+            float x = 0.0f, y = 0.0f, z = 0.0f;
+            size_t j = i;
+            for (; j < codes.size() && codes[j] >> shift == key; ++j) {
+                mask |= static_cast<uint8_t>(1 << (codes[j] >> childShift & 7));
+                x += ownedPoints[j].x; y += ownedPoints[j].y; z += ownedPoints[j].z;
+            }
+            float count = static_cast<float>(j - i);
+            keys.push_back(static_cast<uint32_t>(key));
+            counts.push_back(static_cast<uint32_t>(j - i));
+            centroids.push_back(Point(x / count, y / count, z / count));
+            masks.push_back(mask);
+            i = j;
         }
     }
+    size_t cells = keys.size();
+    levelStart[Occupancy::LEVELS] = static_cast<uint32_t>(cells);
+    // levelStart | keys | counts | centroids (3 floats) | masks (4 per word)
+    ownedOccupancy.assign(Occupancy::words(cells), 0);
+    uint32_t* out = ownedOccupancy.data();
+    memcpy(out, levelStart, sizeof(levelStart));
+    out += Occupancy::LEVELS + 1;
+    memcpy(out, keys.data(), cells * sizeof(uint32_t));
+    memcpy(out + cells, counts.data(), cells * sizeof(uint32_t));
+    memcpy(out + 2 * cells, centroids.data(), cells * sizeof(Point));
+    memcpy(out + 5 * cells, masks.data(), cells);
 }
 
-void Octree::deleteOctree(OctreeNode* node) {
-    if (!node) return; // there is no tree to delete
-    if (node->isLeaf()) delete node; // the node has no children
-    else {// it has children
-        for (OctreeNode* child : node->children) {
-            deleteOctree(child);
-        }
-        delete node; // no children after loop
-    }
+Occupancy Octree::occupancy() const {
+    Occupancy result;
+    if (occupancyData == nullptr) return result;
+    size_t cells = occupancyData[Occupancy::LEVELS];
+    result.levelStart = occupancyData;
+    result.keys = occupancyData + Occupancy::LEVELS + 1;
+    result.counts = result.keys + cells;
+    result.centroids = reinterpret_cast<const Point*>(result.counts + cells);
+    result.masks = reinterpret_cast<const uint8_t*>(result.counts + 4 * cells);
+    return result;
 }
 
-unsigned char Octree::getIndex(const OctreeNode* node, const Point &point) const {
-    // centerxyz is
-    // >>> backLeftBottom 000
-    // <>> frontLeftBottom 001
-    // ><> backRightBottom 010
-    // <<> frontRightBottom 011
-    // >>< backLeftTop 100
-    // <>< frontLeftTop 101
-    // ><< backRightTop 110
-    // <<< frontRightTop 111
+void Octree::build() {
+    vector<Point> points = traverse();
+    points.insert(points.end(), pending.begin(), pending.end());
+    build(points);
+}
 
-    unsigned char index = 0b111; // start with all bits set (7)
+void Octree::compact(const Quantizer& grid, bool delta) {
+    if (pointData == nullptr) return;
+    packed = PackedPoints(pointData, pointTotal, grid, delta);
+    vector<Point>().swap(ownedPoints);
+    vector<OctNode>().swap(ownedNodes);
+    pointData = nullptr;
+    nodeData = nullptr;
+    nodeTotal = 0;
+}
 
-    if (node->center.x > point.x) index &= 0b110; // back section  
-    if (node->center.y > point.y) index &= 0b101; // left section  
-    if (node->center.z > point.z) index &= 0b011; // bottom section       
+uint32_t Octree::child(uint32_t node, int octant) const { // O(1)
+    const OctNode& parent = nodeData[node];
+    if (!(parent.childMask >> octant & 1)) return 0;
+    return parent.firstChild + static_cast<uint32_t>(__builtin_popcount(parent.childMask & ((1u << octant) - 1)));
+}
 
-    return index;
+bool Octree::search(const Point& point) const { // O(log n)
+    for (const Point& p : pending)
+        if (p == point) return true;
+    uint64_t code = mortonCode(point);
+    if (!packed.empty()) { // the points are sorted by code, the ones sharing the point's code follow the first of them
+        size_t first = 0, last = packed.size();
+        while (first < last) {
+            size_t middle = first + (last - first) / 2;
+            if (mortonCode(packed.at(middle)) < code) first = middle + 1;
+            else last = middle;
+        }
+        for (size_t i = first; i < packed.size(); ++i) {
+            Point candidate = packed.at(i);
+            if (candidate == point) return true;
+            if (mortonCode(candidate) != code) break;
+        }
+        return false;
+    }
+    if (nodeTotal == 0) return false;
+    uint32_t index = 0;
+    while (!nodeData[index].isLeaf()) {
+        const OctNode& node = nodeData[index];
+        index = child(index, static_cast<int>(code >> 3 * (MAX_DEPTH - 1 - node.depth) & 7));
+        if (index == 0) return false;
+    }
+    for (uint32_t i = nodeData[index].begin; i < nodeData[index].begin + nodeData[index].count; ++i)
+        if (pointData[i] == point) return true;
+    return false;
 }
 
-Octree::OctreeNode* Octree::getRoot() const {
-    return root;
+float Octree::levelSimilarity(const Occupancy& a, size_t totalA, const Occupancy& b, size_t totalB, int level, float tolerance, float& shared) {
+    uint32_t i = a.levelStart[level], endA = a.levelStart[level + 1];
+    uint32_t j = b.levelStart[level], endB = b.levelStart[level + 1];
+    countStat(Counter::OctCellsCompared, (endA - i) + (endB - j));
+    int both = 0, differing = 0;    // occupied octants in both / in only one of the trees
+    float mass = 0.0f;              // fraction of the points the trees share in cells with nearby centroids
+    shared = 0.0f;
+    while (i < endA || j < endB) {  // both levels are sorted by key, so matching cells is one merge
+        if (j == endB || (i < endA && a.keys[i] < b.keys[j])) {
+            differing += __builtin_popcount(a.masks[i++]);
+        } else if (i == endA || b.keys[j] < a.keys[i]) {
+            differing += __builtin_popcount(b.masks[j++]);
+        } else {
+            both += __builtin_popcount(a.masks[i] & b.masks[j]);
+            differing += __builtin_popcount(a.masks[i] ^ b.masks[j]);
+            float common = min(a.counts[i] / static_cast<float>(totalA), b.counts[j] / static_cast<float>(totalB));
+            float near = 1.0f - sqrt(distance(a.centroids[i], b.centroids[j])) / tolerance;
+            if (near > 0.0f) mass += near * common;
+            shared += common;
+            ++i;
+            ++j;
+        }
+    }
+    float overlap = both + differing > 0 ? static_cast<float>(both) / (both + differing) : 1.0f;
+    return (overlap + mass) / 2.0f;
 }
 
-bool Octree::calculatePointSimilarity(const vector<Point> &points1, const vector<Point> &points2, float tolerance) {
-    if (points1.size() != 8 || points2.size() != 8) return false; //
+float Octree::occupancyRatio(const Occupancy& a, const Occupancy& b, int depth) {
+    if (depth >= Occupancy::LEVELS) return 1.0f; // the deepest occupied cells are only known after a pass over the masks
+    float cellsA = static_cast<float>(a.levelStart[depth + 1] - a.levelStart[depth]);
+    float cellsB = static_cast<float>(b.levelStart[depth + 1] - b.levelStart[depth]);
+    return min(cellsA, cellsB) / max(cellsA, cellsB); // |A and B| / |A or B| <= min / max
+}
 
-    for (int i = 0; i < 8; ++i) {
-        if (sqrt(distance(points1[i],points2[i])) > tolerance)
-            return false;
-    }
-    return true;
+float Octree::remainingBound(const Occupancy& a, const Occupancy& b, int from, float shared) {
+    // shared mass only shrinks from one level to the next (min(a1, b1) + min(a2, b2) <= min(a1 + a2, b1 + b2))
+    float bound = 0.0f;
+    for (int level = from; level < Occupancy::LEVELS; ++level) bound += (occupancyRatio(a, b, level + 1) + shared) / 2.0f;
+    return bound;
 }
 
-void Octree::calculateNodeSimilarity(OctreeNode* node1, OctreeNode* node2, float tolerance, float &result, int &nodes, int &similar_nodes) {
-    if (node1 == nullptr && node2 == nullptr) return; // both nullptr, there similar
-    if (node1 == nullptr || node2 == nullptr) {
-        // One is null, the other isn't then count only the non-null as a node
-        nodes += (node1 != nullptr ? 1 : 0) + (node2 != nullptr ? 1 : 0);
-        return;
-    }
-    nodes++;
-    if (calculatePointSimilarity(node1->contents, node2->contents, tolerance)) {
-        similar_nodes++;
-    }
-    for (int i = 0; i < 8; i++) {
-        calculateNodeSimilarity(node1->getChild(i), node2->getChild(i), tolerance, result, nodes, similar_nodes);
+float Octree::similarityOctree(const Octree& tree1, const Octree& tree2, float tolerance, float floor) {
+    if (tree1.occupancyData == nullptr || tree2.occupancyData == nullptr) // an empty tree is only similar to another empty tree
+        return tree1.occupancyData == tree2.occupancyData ? 100.0f : 0.0f;
+    Occupancy a = tree1.occupancy(), b = tree2.occupancy();
+    float total = 0.0f, shared = 1.0f;
+    for (int level = 0; level < Occupancy::LEVELS; ++level) {
+        total += levelSimilarity(a, tree1.pointTotal, b, tree2.pointTotal, level, tolerance, shared);
+        float bound = 100.0f * (total + remainingBound(a, b, level + 1, shared)) / Occupancy::LEVELS;
+        if (bound < floor) {
+            countStat(Counter::OctEarlyExits, 1);
+            return bound;
+        }
     }
+    return 100.0f * total / Occupancy::LEVELS;
+}
+
+float Octree::similarityBound(const Octree& tree1, const Octree& tree2, float tolerance, int levels) {
+    if (tree1.occupancyData == nullptr || tree2.occupancyData == nullptr) return tree1.occupancyData == tree2.occupancyData ? 100.0f : 0.0f;
+    Occupancy a = tree1.occupancy(), b = tree2.occupancy();
+    float total = 0.0f, shared = 1.0f;
+    int scored = levels < Occupancy::LEVELS ? levels : Occupancy::LEVELS;
+    for (int level = 0; level < scored; ++level)
+        total += levelSimilarity(a, tree1.pointTotal, b, tree2.pointTotal, level, tolerance, shared);
+    return 100.0f * (total + remainingBound(a, b, scored, shared)) / Occupancy::LEVELS;
 }
 
-bool Octree::compareOctree(OctreeNode* node1, OctreeNode* node2, float tolerance, float threshold) {
-    float result = 0;
-    int nodes = 0;
-    int similar_nodes = 0;
-    calculateNodeSimilarity(node1, node2, tolerance, result, nodes, similar_nodes);
-    if (nodes == 0) return true;
-    float similarity = 100.0f * similar_nodes / nodes;
-    return similarity >= threshold;
-}
\ No newline at end of file
+bool Octree::compareOctree(const Octree& tree1, const Octree& tree2, float tolerance, float threshold) {
+    return similarityOctree(tree1, tree2, tolerance, threshold) >= threshold; // stops as soon as threshold is out of reach
+}
@@ -1,39 +1,98 @@
 #pragma once
 #include "generic.h"
+#include "Quantized.h"
 
+struct OctNode { // one node of a linear octree, all nodes of a tree live in one array in breadth first order
+    static const int MAXCHILDREN = 8;   // a node holding more points than this is subdivided
+    uint32_t begin, count;              // range of the node's points in the Morton sorted point array
+    uint32_t firstChild;                // index of the first existing child, the others follow in octant order
+    uint8_t childMask;                  // bit i set when octant i has points (0 for leaves)
+    uint8_t depth;                      // root is 0
+    uint8_t padding[2];                 // zeroed, keeps written indexes byte for byte reproducible
+    bool isLeaf() const { return childMask == 0; };
+};
+
+struct Occupancy { // read-only view of an octree's occupancy pyramid, one packed cell array per level (see Octree::buildOccupancy)
+    static const int LEVELS = 6;        // cells at depth 0 to 5, their masks describe depth 1 to 6 (a 64^3 grid)
+    const uint32_t* levelStart = nullptr; // LEVELS + 1 prefix sums into the cell arrays
+    const uint32_t* keys = nullptr;     // Morton prefix of each cell, ascending within a level
+    const uint32_t* counts = nullptr;   // points inside the cell
+    const Point* centroids = nullptr;
+    const uint8_t* masks = nullptr;     // bit i set when octant i of the cell holds points
+    static size_t words(size_t cellCount) { return LEVELS + 1 + 5 * cellCount + (cellCount + 3) / 4; }; // size of the packed form in uint32 words
+};
+
+/**
+ * Linear octree: points sorted by 64 bit Morton code inside a cube around the model, nodes in one contiguous array
+ * built in one bulk pass and released in O(1) (two allocations), or used in place from someone else's memory (a mapped index)
+ * comparisons only read the occupancy pyramid, so a compacted tree keeps nothing else but its points as packed codes (see PackedPoints),
+ * still Morton sorted: a linear octree without its node array, searched by binary search on the points' codes
+ * octant index bits are x (1), y (2), z (4), set when the point is on the high side of the center
+ */
 class Octree {
-    struct OctreeNode { // each of these is effectively a tree but this is just encapsulation to have the helpers in one wrapper class
-        static const int MAXCHILDREN = 8;               // size limit for pushing back new children
-        Point center, frontRightTop, backLeftBottom;    // the center of the region, and the two bounds of the region
-        vector<Point> contents;                         // vector the points in the octree
-        OctreeNode* children[MAXCHILDREN] = {nullptr};  // initialize the children with nullptrs (for a Octree with subtrees these will be OctreeNode*)
-        OctreeNode(const Point &frontRightTop_, const Point& backLeftBottom_) : frontRightTop(frontRightTop_), backLeftBottom(backLeftBottom_) { 
-            center.x = (frontRightTop.x + backLeftBottom.x) / 2.0f;
-            center.y = (frontRightTop.y + backLeftBottom.y) / 2.0f;
-            center.z = (frontRightTop.z + backLeftBottom.z) / 2.0f;
-        }; // constructor with box bounds (finding center of box)
-        bool isLeaf() const {return children[0] == nullptr;} ;  // if the children array has no subtrees then it is a leaf and we can access the contents vector
-        OctreeNode* getChild(int i) {return children[i];};      // getter for the ith octant subtree of the Octree
-        vector<Point> getData() {return contents;};             // returns the vector of points (should only be used on leaves)
-    };
+    static const int MAX_DEPTH = 21;    // 21 bits per axis in a 64 bit Morton code
+
+    vector<OctNode> ownedNodes;
+    vector<Point> ownedPoints;
+    vector<Point> pending;              // inserted since the last build
+    PackedPoints packed;                // the points of a compacted tree, nodeData and pointData are then nullptr
+    const OctNode* nodeData = nullptr;
+    const Point* pointData = nullptr;
+    vector<uint32_t> ownedOccupancy;
+    const uint32_t* occupancyData = nullptr;
+    size_t nodeTotal = 0, pointTotal = 0, occupancyTotal = 0;
+    Point low;                          // corner of the root cube (smallest x, y, z)
+    float side = 0.0f;                  // edge length of the root cube
 
-    OctreeNode* root;
-    OctreeNode* insertHelper(OctreeNode* node, const Point &point); // given a point and node, try to insert - else recurse to proper suboctant
-    bool searchHelper(const OctreeNode* node, const Point &point); // given a point and node, check if the point is in the contents, else go to proper suboctant
-    void traverseHelper(const OctreeNode* node, vector<Point> &accum); // accumulate the nodes from left to right (octants 1->8) 
-    void deleteOctree(OctreeNode* node);  // delete the octree (called by destructor)
-    void subdivide(OctreeNode* node); // function which will subdivide an octant into sub octants and create the subtrees dma
-    unsigned char getIndex(const OctreeNode* node, const Point &point) const; // function which takes a node and a point and returns the index of that node's children that the point should be inserted into
+    uint64_t mortonCode(const Point& point) const; // interleaved cell coordinates at MAX_DEPTH
+    void buildNodes(const vector<uint64_t>& codes);
+    void buildOccupancy(const vector<uint64_t>& codes); // needs the points already in Morton order
+    // score of one level in [0, 1], shared is set to the fraction of points both trees hold in the same cells (an upper bound for finer levels)
+    static float levelSimilarity(const Occupancy& a, size_t totalA, const Occupancy& b, size_t totalB, int level, float tolerance, float& shared);
+    static float occupancyRatio(const Occupancy& a, const Occupancy& b, int depth); // bound on the octant overlap of a level whose masks describe depth
+    static float remainingBound(const Occupancy& a, const Occupancy& b, int from, float shared); // most the levels from `from` on can add
 
 public:
-    Octree() : root(nullptr) {};        // initializes the root to null (when inserting the first node - the bounds are needed)
-    ~Octree() { deleteOctree(root); }   // destructor calls helper
-    void insert(const Point& point) { insertHelper(root, point); };         // insertion public function calls helper
-    bool search(const Point& point) { return searchHelper(root, point); };  // search public function calls helper
-    OctreeNode* getRoot() const;        // const getter to get the Root for comparisons
+    Octree() {};
+    Octree(const Point& frontRightTop, const Point& backLeftBottom);    // fixed root region, points outside it are clamped to its border cells
+    Octree(const Octree&) = delete;     // nodes may point into the tree's own storage, so it can only be moved
+    Octree& operator=(const Octree&) = delete;
+    Octree(Octree&& other) noexcept { *this = std::move(other); };
+    Octree& operator=(Octree&& other) noexcept;
+    static Octree view(const OctNode* nodes, size_t nodeCount, const Point* points, size_t pointCount, const Point& low, float side,
+                       const uint32_t* occupancy, size_t occupancyWords); // memory must outlive the tree
+
+    void build(const vector<Point>& points);    // bulk build, the root cube is fitted to the points unless the tree was given a region
+    void build();                               // rebuild with everything inserted so far
+    void insert(const Point& point) { pending.push_back(point); };  // buffered, only searched linearly until the next build()
+    // keeps the points only as codes on grid, in Morton order and delta encoded if asked, and drops the nodes; the points must
+    // already lie on grid (see Quantizer::snap), so scores don't change; nodes() and points() are nullptr from then on
+    void compact(const Quantizer& grid, bool delta);
+    bool compacted() const { return !packed.empty(); };
+    bool search(const Point& point) const;
+    vector<Point> traverse() const { return pointData || packed.empty() ? vector<Point>(pointData, pointData + pointTotal) : packed.decode(); }; // Morton order
+
+    const OctNode* nodes() const { return nodeData; };
+    size_t nodeCount() const { return nodeTotal; };
+    const Point* points() const { return pointData; };
+    size_t pointCount() const { return pointTotal; };
+    const Point& origin() const { return low; };
+    float size() const { return side; };
+    const uint32_t* occupancyWords() const { return occupancyData; }; // packed form, written as is into the corpus index
+    size_t occupancyWordCount() const { return occupancyTotal; };
+    Occupancy occupancy() const;
+    size_t memoryBytes() const { // owned storage only
+        return ownedNodes.capacity() * sizeof(OctNode) + ownedPoints.capacity() * sizeof(Point) + ownedOccupancy.capacity() * sizeof(uint32_t)
+             + packed.memoryBytes();
+    };
+    uint32_t child(uint32_t node, int octant) const; // index of the node's child in octant, 0 when the octant is empty (0 is the root, never a child)
 
     // static members to run comparison
-    static bool calculatePointSimilarity(const vector<Point>& points1, const vector<Point>& points2, float tolerance);                          // point similarity
-    static void calculateNodeSimilarity(OctreeNode* node1, OctreeNode* node2, float tolerance, float &result, int &nodes, int &similar_nodes);  // node similarity calls point similarity
-    static bool compareOctree(OctreeNode* node1, OctreeNode* node2, float tolerance, float threshold);                                          // highest level comparison logic
-};
\ No newline at end of file
+    // continuous percentage: per level, the overlap of the occupied octants (popcount of AND against XOR of the masks of cells
+    // present in both trees) averaged with the mass the two trees share in cells whose centroids are closer than tolerance
+    // levels are scored coarse to fine, and once the best the remaining levels could add leaves the score below floor the
+    // refinement stops and that upper bound (lower than floor) is returned instead
+    static float similarityOctree(const Octree& tree1, const Octree& tree2, float tolerance, float floor = 0.0f);
+    static float similarityBound(const Octree& tree1, const Octree& tree2, float tolerance, int levels); // upper bound after scoring the first levels only
+    static bool compareOctree(const Octree& tree1, const Octree& tree2, float tolerance, float threshold); // highest level comparison logic
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <thread>
+
+/**
+ * Bounded lock-free multi-producer multi-consumer queue (a ring of cells each carrying a sequence number, after Vyukov)
+ * producers and consumers only contend on one atomic counter each, a full queue makes tryPush fail instead of blocking
+ */
+template <typename T>
+class BoundedQueue {
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{0};    // next cell to push into
+    alignas(64) std::atomic<size_t> tail{0};    // next cell to pop from
+
+public:
+    explicit BoundedQueue(size_t capacity) { // rounded up to a power of two
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+    };
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool tryPush(T& value) { // moves value in on success, leaves it alone when the queue is full
+        size_t position = head.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if (sequence == position) {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (sequence < position) {
+                return false; // the consumer of the previous lap hasn't taken this cell yet
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+    };
+
+    bool tryPop(T& value) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if (sequence == position + 1) {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(position + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (sequence < position + 1) {
+                return false; // empty
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    };
+};
+
+/**
+ * Lets threads that found no work sleep until someone may have given them some (an event count over C++20 atomic wait)
+ * take a ticket before the last look at the queues and wait on it: a notify() in between makes the wait return at once, so a push
+ * is never missed; notify() costs no system call while nobody waits
+ */
+class Wakeup {
+    std::atomic<uint32_t> epoch{0};
+
+public:
+    uint32_t ticket() const { return epoch.load(std::memory_order_acquire); };
+    void wait(uint32_t ticket) const { epoch.wait(ticket, std::memory_order_acquire); };
+    void notify() {
+        epoch.fetch_add(1, std::memory_order_release);
+        epoch.notify_all();
+    };
+};
+
+struct StageCounter { // filled concurrently by every thread running the stage
+    const char* name;
+    std::atomic<size_t> items{0};
+    std::atomic<size_t> bytes{0};
+    std::atomic<long long> busyNanos{0};    // summed over threads
+    explicit StageCounter(const char* name_) : name(name_) {};
+
+    template <typename Work>
+    auto time(Work work) { // runs work and charges its duration to this stage
+        auto start = std::chrono::steady_clock::now();
+        auto result = work();
+        busyNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        items++;
+        return result;
+    };
+};
+
+struct PipelineReport { // what one run of a staged scan spent where
+    static const int STAGES = 4;
+    StageCounter stages[STAGES] = {StageCounter("read"), StageCounter("parse"), StageCounter("build"), StageCounter("compare")};
+    double seconds = 0.0;       // wall clock of the whole run
+    size_t readers = 0, workers = 0;
+
+    // items per busy second of one thread for every stage; the stage with the most busy time per thread that can run it limits the scan
+    void print(std::ostream& out) const {
+        out << "pipeline: " << seconds << " s wall, " << readers << " reader and " << workers << " worker threads" << '\n';
+        for (const StageCounter& stage : stages) {
+            double busy = stage.busyNanos.load() * 1e-9;
+            out << "  " << stage.name << ": " << stage.items.load() << " items, " << busy << " s busy";
+            if (busy > 0.0) out << ", " << stage.items.load() / busy << " items/s per thread";
+            if (stage.bytes.load() > 0 && busy > 0.0) out << ", " << stage.bytes.load() / (busy * 1024.0 * 1024.0) << " MB/s per thread";
+            out << '\n';
+        }
+        out.flush();
+    };
+};
@@ -0,0 +1,63 @@
+#include "PointCloud.h"
+#include "Simd.h"
+#include <cstring>
+
+PointCloud::PointCloud(const Point* points, size_t pointCount) {
+    reallocate(pointCount);
+    float* x = data.get();
+    float* y = x + stride;
+    float* z = y + stride;
+    for (size_t i = 0; i < pointCount; ++i) { // transpose
+        x[i] = points[i].x;
+        y[i] = points[i].y;
+        z[i] = points[i].z;
+    }
+    count = pointCount;
+}
+
+PointCloud& PointCloud::operator=(const PointCloud& other) {
+    if (this == &other) return *this;
+    if (stride < other.count) reallocate(other.count);
+    count = other.count;
+    for (int axis = 0; axis < 3; ++axis)
+        if (count > 0) memcpy(data.get() + axis * stride, other.data.get() + axis * other.stride, count * sizeof(float));
+    return *this;
+}
+
+void PointCloud::reallocate(size_t capacity) { // keeps the points, the padding stays zero
+    size_t newStride = (capacity + LANES - 1) / LANES * LANES;
+    if (newStride == 0) newStride = LANES;
+    unique_ptr<float[], AlignedDelete> fresh(static_cast<float*>(::operator new[](3 * newStride * sizeof(float), align_val_t(64))));
+    memset(fresh.get(), 0, 3 * newStride * sizeof(float));
+    for (int axis = 0; axis < 3; ++axis)
+        if (count > 0) memcpy(fresh.get() + axis * newStride, data.get() + axis * stride, count * sizeof(float));
+    data = std::move(fresh);
+    stride = newStride;
+}
+
+void PointCloud::reserve(size_t capacity) {
+    if (capacity > stride) reallocate(capacity);
+}
+
+void PointCloud::push_back(const Point& p) {
+    if (count == stride) reallocate(stride == 0 ? LANES : 2 * stride);
+    data[count] = p.x;
+    data[stride + count] = p.y;
+    data[2 * stride + count] = p.z;
+    count++;
+}
+
+void PointCloud::bounds(Point& low, Point& high) const {
+    float lows[3], highs[3];
+    pointBounds(xs(), ys(), zs(), count, lows, highs);
+    low = Point(lows[0], lows[1], lows[2]);
+    high = Point(highs[0], highs[1], highs[2]);
+}
+
+size_t PointCloud::nearest(const Point& q, float& distSquared) const {
+    return nearestPoint(xs(), ys(), zs(), count, q.x, q.y, q.z, &distSquared);
+}
+
+void PointCloud::distancesTo(const Point& q, float* out) const {
+    squaredDistances(xs(), ys(), zs(), count, q.x, q.y, q.z, out);
+}
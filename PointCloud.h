@@ -0,0 +1,51 @@
+#pragma once
+#include "generic.h"
+#include <memory>
+#include <utility>
+
+/**
+ * Points as separate x, y, z arrays (structure of arrays), the layout the Simd.h kernels read
+ * one 64 byte aligned allocation holds the three arrays, each starting on a cache line and padded to a whole number of
+ * 16 float vectors, so kernels may load full vectors past the last point (the padding's values mean nothing)
+ */
+class PointCloud {
+    static const size_t LANES = 16; // floats per avx512 vector, every array is padded to a multiple of it
+
+    struct AlignedDelete {
+        void operator()(float* data) const { ::operator delete[](data, align_val_t(64)); };
+    };
+    unique_ptr<float[], AlignedDelete> data;
+    size_t count = 0, stride = 0;   // stride: floats reserved per array
+
+    void reallocate(size_t capacity);
+
+public:
+    PointCloud() {};
+    explicit PointCloud(const vector<Point>& points) : PointCloud(points.data(), points.size()) {};
+    PointCloud(const Point* points, size_t pointCount);
+    PointCloud(const PointCloud& other) : PointCloud() { *this = other; };
+    PointCloud& operator=(const PointCloud& other);
+    PointCloud(PointCloud&& other) noexcept { *this = std::move(other); };
+    PointCloud& operator=(PointCloud&& other) noexcept {
+        data = std::move(other.data);
+        count = exchange(other.count, 0);
+        stride = exchange(other.stride, 0);
+        return *this;
+    };
+
+    size_t size() const { return count; };
+    bool empty() const { return count == 0; };
+    const float* xs() const { return data.get(); };
+    const float* ys() const { return data.get() + stride; };
+    const float* zs() const { return data.get() + 2 * stride; };
+    Point operator[](size_t i) const { return Point(data[i], data[stride + i], data[2 * stride + i]); };
+    void push_back(const Point& p);  // amortized O(1)
+    void reserve(size_t capacity);
+    void clear() { count = 0; };
+
+    // O(n) SIMD kernels, see Simd.h
+    void bounds(Point& low, Point& high) const;                 // at least one point
+    size_t nearest(const Point& q, float& distSquared) const;   // index of the closest point (the lowest on ties), at least one point
+    void distancesTo(const Point& q, float* out) const;         // squared distance to every point, out holds size() floats
+    size_t memoryBytes() const { return 3 * stride * sizeof(float); };
+};
@@ -0,0 +1,87 @@
+#include "Pyramid.h"
+
+namespace {
+    uint32_t compactBits(uint32_t key) { // every third bit of key, packed together (inverse of the Morton spread)
+        uint32_t v = 0;
+        for (int bit = 0; 3 * bit < 32; ++bit) v |= (key >> (3 * bit) & 1) << bit;
+        return v;
+    }
+
+    const int MAX_ROWS = 32 * 32; // rows of the finest grid
+}
+
+Pyramid::Pyramid(const Octree& tree) : low(tree.origin()), side(tree.size()) {
+    Occupancy occupancy = tree.occupancy();
+    if (occupancy.levelStart == nullptr) return;
+    rows.assign(levelOffset(LEVELS), 0);
+    for (int level = 0; level < LEVELS; ++level) {
+        int n = cellsPerAxis(level), depth = FIRST_DEPTH + level;
+        uint32_t* out = rows.data() + levelOffset(level);
+        for (uint32_t cell = occupancy.levelStart[depth]; cell < occupancy.levelStart[depth + 1]; ++cell) {
+            uint32_t key = occupancy.keys[cell];
+            out[compactBits(key >> 2) * n + compactBits(key >> 1)] |= 1u << compactBits(key);
+        }
+    }
+}
+
+float Pyramid::slack(const Pyramid& other) const {
+    float drift = max(fabs(low.x - other.low.x), max(fabs(low.y - other.low.y), fabs(low.z - other.low.z)));
+    return drift + fabs(side - other.side);
+}
+
+void Pyramid::grow(const uint32_t* in, uint32_t* out, int n) { // O(n^2)
+    uint32_t full = n == 32 ? ~0u : (1u << n) - 1;
+    uint32_t alongX[MAX_ROWS], alongY[MAX_ROWS];
+    for (int i = 0; i < n * n; ++i) alongX[i] = (in[i] | in[i] << 1 | in[i] >> 1) & full;
+    for (int z = 0; z < n; ++z) {
+        for (int y = 0; y < n; ++y) {
+            int i = z * n + y;
+            alongY[i] = alongX[i] | (y > 0 ? alongX[i - 1] : 0) | (y + 1 < n ? alongX[i + 1] : 0);
+        }
+    }
+    for (int i = 0; i < n * n; ++i) out[i] = alongY[i] | (i >= n ? alongY[i - n] : 0) | (i + n < n * n ? alongY[i + n] : 0);
+}
+
+bool Pyramid::contains(const uint32_t* outer, const uint32_t* inner, int n) {
+    uint32_t outside = 0;
+    for (int i = 0; i < n * n; ++i) outside |= inner[i] & ~outer[i];
+    return outside == 0;
+}
+
+bool Pyramid::exceeds(const Pyramid& other, int level, float distSquared) const {
+    if (empty() || other.empty()) return false;
+    int n = cellsPerAxis(level);
+    float cell = min(side, other.side) / n;
+    if (cell <= 0.0f) return false;
+    float reach = (sqrt(distSquared) + slack(other)) / cell;
+    if (reach >= n) return false;
+    // cells more than steps apart (in Chebyshev distance) are more than steps * cell > sqrt(distSquared) + slack apart
+    int steps = static_cast<int>(reach) + 1;
+    uint32_t grownA[MAX_ROWS], grownB[MAX_ROWS];
+    const uint32_t *a = grid(level), *b = other.grid(level);
+    copy(a, a + n * n, grownA);
+    copy(b, b + n * n, grownB);
+    for (int step = 0; step < steps; ++step) {
+        grow(grownA, grownA, n);
+        grow(grownB, grownB, n);
+    }
+    return !contains(grownB, a, n) || !contains(grownA, b, n);
+}
+
+float Pyramid::lowerBound(const Pyramid& other, int level) const {
+    if (empty() || other.empty()) return 0.0f;
+    int n = cellsPerAxis(level);
+    uint32_t grownA[MAX_ROWS], grownB[MAX_ROWS];
+    const uint32_t *a = grid(level), *b = other.grid(level);
+    copy(a, a + n * n, grownA);
+    copy(b, b + n * n, grownB);
+    int steps = 0; // smallest growth that makes each grid cover the other
+    while (steps < n && !(contains(grownB, a, n) && contains(grownA, b, n))) {
+        grow(grownA, grownA, n);
+        grow(grownB, grownB, n);
+        ++steps;
+    }
+    // some cell's nearest occupied cell of the other grid is steps cells away, so at least steps - 1 empty cells lie between
+    float gap = (steps - 1) * min(side, other.side) / n - slack(other);
+    return gap > 0.0f ? gap * gap : 0.0f;
+}
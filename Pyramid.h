@@ -0,0 +1,37 @@
+#pragma once
+#include "Octree.h"
+
+/**
+ * Dense occupancy grids of one model at 8^3, 16^3 and 32^3 cells, derived from its octree's occupancy levels
+ * a grid of n^3 cells is n * n rows of n bits (x is the bit, rows ordered by z then y) so growing the occupied region
+ * by one cell is a few shifts and ors per row and testing containment is one and-not per row
+ * used to throw out kd tree candidates before the exact Hausdorff comparison: if some occupied cell of one model has no
+ * occupied cell of the other within r cells, the two surfaces are at least r cells apart there
+ */
+class Pyramid {
+public:
+    static const int LEVELS = 3;        // grids of 8, 16 and 32 cells per axis
+    static const int FIRST_DEPTH = 3;   // octree depth of the coarsest grid
+
+private:
+    vector<uint32_t> rows;              // every level's rows back to back, coarsest first
+    Point low;                          // the octree's root cube
+    float side = 0.0f;
+
+    static int cellsPerAxis(int level) { return 8 << level; };
+    static size_t levelOffset(int level) { size_t total = 0; for (int i = 0; i < level; ++i) total += cellsPerAxis(i) * cellsPerAxis(i); return total; };
+    const uint32_t* grid(int level) const { return rows.data() + levelOffset(level); };
+    float slack(const Pyramid& other) const; // how far the two grids' frames drift apart, in model units
+    static void grow(const uint32_t* in, uint32_t* out, int n); // occupied region grown by one cell in every direction (3x3x3)
+    static bool contains(const uint32_t* outer, const uint32_t* inner, int n); // every cell of inner is set in outer
+
+public:
+    Pyramid() {};
+    explicit Pyramid(const Octree& tree);
+    bool empty() const { return rows.empty(); };
+    size_t memoryBytes() const { return rows.capacity() * sizeof(uint32_t); };
+
+    // squared Hausdorff distance is certainly above distSquared, judged on one level's grids (false when the grids can't tell)
+    bool exceeds(const Pyramid& other, int level, float distSquared) const;
+    float lowerBound(const Pyramid& other, int level) const; // squared Hausdorff distance is at least this
+};
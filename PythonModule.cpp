@@ -0,0 +1,400 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "Corpus.h"
+#include "Stats.h"
+#include "Geometry.h"
+#include <mutex>
+
+/**
+ * similarity_engine: the engine inside the Python process, no subprocess and no OFF text in between
+ * a point array is anything exporting a C contiguous float32 buffer of shape (n, 3) or (3n,) (numpy float32 arrays, memoryviews),
+ * read in place through the buffer protocol; every call releases the GIL while it preprocesses and compares
+ *   compare(a, b, algorithm="kdtree", sampling="none") -> float               one pair, scored like a search scores it
+ *   compare_batch(query, candidates, algorithm="kdtree", sampling="none") -> [float]  the query's trees built once
+ *   stats() -> str                                                            JSON histograms of every query so far (see Stats.h)
+ *   geometry(path, cache_path=None, level=0) -> bytes                         one level of detail of an OFF file's viewer geometry,
+ *                                                                             kept encoded in cache_path (see Geometry.h)
+ *   Corpus(path, prefilter=256, sampling="none", score_cache=None)            a directory or an index, loaded once; pairs
+ *                                                                             it scores are kept in score_cache (see ScoreCache.h)
+ *       .size() -> int, .names() -> [str], .models() -> [(name, vertices, faces)]
+ *       .refresh(directory=None) -> dict   rebuilds only the files added, changed or removed since the load (or the last refresh),
+ *                                           searches on other threads go on meanwhile; an index needs the directory it was built from
+ *       .search(source, algorithm="kdtree", k=5, deadline_ms=None) -> ([(name, score, vertices, faces)], stats json)
+ *        source is a model name inside the corpus, a path to an OFF file or a point array; with deadline_ms the best k of what
+ *        was settled by then (see Corpus::search), the stats' "search" part says how much that was
+ * built as a shared library by setup.py, with -DSIMILARITY_ALLOCATION_STATS=0 so the host keeps its own operator new
+ */
+namespace {
+    class PointsView { // a borrowed point array, held (and so kept from resizing) until destroyed
+        Py_buffer view = {};
+        bool held = false;
+
+    public:
+        PointsView() {};
+        ~PointsView() { if (held) PyBuffer_Release(&view); };
+        PointsView(const PointsView&) = delete;
+        PointsView& operator=(const PointsView&) = delete;
+
+        bool acquire(PyObject* object) { // false with a Python error set when object isn't a float32 point array
+            if (PyObject_GetBuffer(object, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) return false;
+            held = true;
+            const char* format = view.format ? view.format : "B";
+            if (*format == '<' || *format == '=' || *format == '@') format++;
+            bool shaped = (view.ndim == 2 && view.shape[1] == 3) || (view.ndim == 1 && view.shape[0] % 3 == 0);
+            if (strcmp(format, "f") != 0 || view.itemsize != sizeof(float) || !shaped) {
+                PyErr_SetString(PyExc_ValueError, "points must be a C contiguous float32 array of shape (n, 3)");
+                return false;
+            }
+            if (reinterpret_cast<uintptr_t>(view.buf) % alignof(Point) != 0) {
+                PyErr_SetString(PyExc_ValueError, "points must be aligned to 4 bytes");
+                return false;
+            }
+            return true;
+        };
+        const Point* data() const { return static_cast<const Point*>(view.buf); };
+        size_t size() const { return static_cast<size_t>(view.len) / sizeof(Point); };
+        Mesh mesh() const { // the engine normalizes its own copy, the caller's array is never written
+            Mesh result;
+            result.vertices.assign(data(), data() + size());
+            return result;
+        };
+    };
+
+    struct Trees { // one side of a pair comparison, only the algorithm's tree is built
+        KDTree<> kdtree;
+        Octree octree;
+    };
+
+    bool buildTrees(const PointsView& points, bool kdtree, const SampleOptions& sampling, Trees& trees) { // without the GIL
+        Mesh mesh = points.mesh();
+        if (mesh.vertices.empty()) return false;
+        Point center;
+        float scale;
+        preprocess(mesh, sampling, center, scale); // no faces here, so sparse arrays stay as they are
+        ScopedTimer timer(Counter::BuildNanos);
+        if (kdtree) trees.kdtree = fillKD(mesh.vertices);
+        else trees.octree = fillOct(mesh.vertices);
+        return true;
+    }
+
+    float score(const Trees& a, const Trees& b, bool kdtree) {
+        ScopedTimer timer(Counter::CompareNanos);
+        return kdtree ? KDTreeScore(a.kdtree, b.kdtree) : OctTreeScore(a.octree, b.octree);
+    }
+
+    bool parseOptions(const char* algorithm, const char* samplingText, bool& kdtree, SampleOptions& sampling) { // Python error when false
+        kdtree = strcmp(algorithm, "kdtree") == 0;
+        if (!kdtree && strcmp(algorithm, "octree") != 0) {
+            PyErr_Format(PyExc_ValueError, "unknown algorithm %s (kdtree or octree)", algorithm);
+            return false;
+        }
+        if (!parseSampling(samplingText, sampling)) {
+            PyErr_Format(PyExc_ValueError, "bad sampling %s (none, voxel[:budget] or fps[:budget], then optionally ,q<bits>[,delta])", samplingText);
+            return false;
+        }
+        return true;
+    }
+
+    PyObject* compare(PyObject*, PyObject* args, PyObject* kwargs) {
+        static const char* keywords[] = {"a", "b", "algorithm", "sampling", nullptr};
+        PyObject *first, *second;
+        const char *algorithm = "kdtree", *samplingText = "none";
+        if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|ss", const_cast<char**>(keywords), &first, &second, &algorithm, &samplingText))
+            return nullptr;
+        bool kdtree;
+        SampleOptions sampling;
+        PointsView a, b;
+        if (!parseOptions(algorithm, samplingText, kdtree, sampling) || !a.acquire(first) || !b.acquire(second)) return nullptr;
+        Trees treesA, treesB;
+        bool built;
+        float result = 0.0f;
+        Py_BEGIN_ALLOW_THREADS
+        built = buildTrees(a, kdtree, sampling, treesA) && buildTrees(b, kdtree, sampling, treesB);
+        if (built) result = score(treesA, treesB, kdtree);
+        Py_END_ALLOW_THREADS
+        if (!built) {
+            PyErr_SetString(PyExc_ValueError, "points must not be empty");
+            return nullptr;
+        }
+        return PyFloat_FromDouble(result);
+    }
+
+    PyObject* compareBatch(PyObject*, PyObject* args, PyObject* kwargs) {
+        static const char* keywords[] = {"query", "candidates", "algorithm", "sampling", nullptr};
+        PyObject *queryObject, *candidatesObject;
+        const char *algorithm = "kdtree", *samplingText = "none";
+        if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|ss", const_cast<char**>(keywords), &queryObject, &candidatesObject, &algorithm,
+                                         &samplingText))
+            return nullptr;
+        bool kdtree;
+        SampleOptions sampling;
+        PointsView query;
+        if (!parseOptions(algorithm, samplingText, kdtree, sampling) || !query.acquire(queryObject)) return nullptr;
+        PyObject* sequence = PySequence_Fast(candidatesObject, "candidates must be a sequence of point arrays");
+        if (!sequence) return nullptr;
+        size_t count = static_cast<size_t>(PySequence_Fast_GET_SIZE(sequence));
+        vector<PointsView> candidates(count);
+        for (size_t i = 0; i < count; ++i) {
+            if (!candidates[i].acquire(PySequence_Fast_GET_ITEM(sequence, static_cast<Py_ssize_t>(i)))) {
+                Py_DECREF(sequence);
+                return nullptr;
+            }
+        }
+        vector<float> scores(count, NAN);
+        bool built;
+        Py_BEGIN_ALLOW_THREADS
+        Trees queryTrees;
+        built = buildTrees(query, kdtree, sampling, queryTrees);
+        for (size_t i = 0; i < count && built; ++i) {
+            Trees trees;
+            if (buildTrees(candidates[i], kdtree, sampling, trees)) scores[i] = score(queryTrees, trees, kdtree); // NaN for empty ones
+        }
+        Py_END_ALLOW_THREADS
+        candidates.clear(); // release the buffers before the sequence holding their exporters
+        Py_DECREF(sequence);
+        if (!built) {
+            PyErr_SetString(PyExc_ValueError, "query points must not be empty");
+            return nullptr;
+        }
+        PyObject* list = PyList_New(static_cast<Py_ssize_t>(count));
+        if (!list) return nullptr;
+        for (size_t i = 0; i < count; ++i) PyList_SET_ITEM(list, static_cast<Py_ssize_t>(i), PyFloat_FromDouble(scores[i]));
+        return list;
+    }
+
+    PyObject* stats(PyObject*, PyObject*) {
+        return PyUnicode_FromString(statsHistograms().c_str());
+    }
+
+    PyObject* geometry(PyObject*, PyObject* args, PyObject* kwargs) {
+        static const char* keywords[] = {"path", "cache_path", "level", nullptr};
+        const char *path, *cachePath = nullptr;
+        int level = 0;
+        if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|zi", const_cast<char**>(keywords), &path, &cachePath, &level)) return nullptr;
+        if (level < 0) {
+            PyErr_SetString(PyExc_ValueError, "level must be >= 0");
+            return nullptr;
+        }
+        string offPath = path, cache = cachePath ? cachePath : "", error;
+        vector<uint8_t> buffer;
+        bool loaded;
+        Py_BEGIN_ALLOW_THREADS
+        loaded = loadGeometry(offPath, cache, static_cast<uint32_t>(level), buffer, error);
+        Py_END_ALLOW_THREADS
+        if (!loaded) {
+            PyErr_SetString(PyExc_ValueError, error.c_str());
+            return nullptr;
+        }
+        return PyBytes_FromStringAndSize(reinterpret_cast<const char*>(buffer.data()), static_cast<Py_ssize_t>(buffer.size()));
+    }
+
+    struct CorpusObject {
+        PyObject_HEAD
+        Corpus* corpus;
+        mutex* lock; // one search at a time (searches keep per query state in the corpus), taken without the GIL
+    };
+
+    int corpusInit(CorpusObject* self, PyObject* args, PyObject* kwargs) {
+        static const char* keywords[] = {"path", "prefilter", "sampling", "score_cache", nullptr};
+        const char* path;
+        Py_ssize_t prefilter = 256;
+        const char* samplingText = "none";
+        const char* scoreCache = nullptr;
+        if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|nsz", const_cast<char**>(keywords), &path, &prefilter, &samplingText, &scoreCache))
+            return -1;
+        SampleOptions sampling;
+        if (prefilter < 0 || !parseSampling(samplingText, sampling)) {
+            PyErr_SetString(PyExc_ValueError, "prefilter must be >= 0 and sampling none, voxel[:budget] or fps[:budget], then optionally ,q<bits>[,delta]");
+            return -1;
+        }
+        delete self->corpus;
+        self->corpus = new Corpus();
+        if (!self->lock) self->lock = new mutex();
+        self->corpus->setPrefilter(static_cast<size_t>(prefilter));
+        self->corpus->setSampling(sampling);
+        if (scoreCache && !self->corpus->openScoreCache(scoreCache)) {
+            PyErr_Format(PyExc_RuntimeError, "cannot open score cache %s", scoreCache);
+            return -1;
+        }
+        string location = path;
+        bool loaded;
+        Py_BEGIN_ALLOW_THREADS
+        loaded = filesystem::is_regular_file(location) ? self->corpus->loadIndex(location) : self->corpus->load(location);
+        Py_END_ALLOW_THREADS
+        if (!loaded) {
+            PyErr_Format(PyExc_RuntimeError, "cannot open corpus %s", path);
+            return -1;
+        }
+        return 0;
+    }
+
+    void corpusDealloc(CorpusObject* self) {
+        delete self->corpus;
+        delete self->lock;
+        Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+    }
+
+    bool ready(CorpusObject* self) {
+        if (self->corpus) return true;
+        PyErr_SetString(PyExc_RuntimeError, "corpus is not loaded");
+        return false;
+    }
+
+    PyObject* corpusSize(CorpusObject* self, PyObject*) {
+        if (!ready(self)) return nullptr;
+        return PyLong_FromSize_t(self->corpus->size());
+    }
+
+    PyObject* corpusNames(CorpusObject* self, PyObject*) {
+        if (!ready(self)) return nullptr;
+        vector<string> names = self->corpus->names();
+        PyObject* list = PyList_New(static_cast<Py_ssize_t>(names.size()));
+        if (!list) return nullptr;
+        for (size_t i = 0; i < names.size(); ++i) PyList_SET_ITEM(list, static_cast<Py_ssize_t>(i), PyUnicode_FromString(names[i].c_str()));
+        return list;
+    }
+
+    PyObject* corpusModels(CorpusObject* self, PyObject*) {
+        if (!ready(self)) return nullptr;
+        vector<Match> models = self->corpus->models();
+        PyObject* list = PyList_New(static_cast<Py_ssize_t>(models.size()));
+        if (!list) return nullptr;
+        for (size_t i = 0; i < models.size(); ++i) {
+            PyList_SET_ITEM(list, static_cast<Py_ssize_t>(i), Py_BuildValue("(snn)", models[i].name.c_str(), static_cast<Py_ssize_t>(models[i].vertexCount),
+                                                                            static_cast<Py_ssize_t>(models[i].faceCount)));
+        }
+        return list;
+    }
+
+    PyObject* corpusRefresh(CorpusObject* self, PyObject* args, PyObject* kwargs) {
+        static const char* keywords[] = {"directory", nullptr};
+        const char* directoryText = nullptr;
+        if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|z", const_cast<char**>(keywords), &directoryText)) return nullptr;
+        if (!ready(self)) return nullptr;
+        string directory = directoryText ? directoryText : self->corpus->directory();
+        if (directory.empty()) {
+            PyErr_SetString(PyExc_ValueError, "a corpus loaded from an index needs the directory the index was built from");
+            return nullptr;
+        }
+        RefreshReport report;
+        bool refreshed;
+        Py_BEGIN_ALLOW_THREADS
+        refreshed = self->corpus->refresh(directory, report); // not under the search lock, searches carry on with the old snapshot
+        Py_END_ALLOW_THREADS
+        if (!refreshed) {
+            PyErr_Format(PyExc_RuntimeError, "cannot refresh from %s", directory.c_str());
+            return nullptr;
+        }
+        return Py_BuildValue("{s:n,s:n,s:n,s:n,s:n,s:n,s:d}", "added", static_cast<Py_ssize_t>(report.added),
+                             "changed", static_cast<Py_ssize_t>(report.changed), "removed", static_cast<Py_ssize_t>(report.removed),
+                             "touched", static_cast<Py_ssize_t>(report.touched), "unreadable", static_cast<Py_ssize_t>(report.unreadable),
+                             "models", static_cast<Py_ssize_t>(report.models), "seconds", report.seconds);
+    }
+
+    PyObject* corpusSearch(CorpusObject* self, PyObject* args, PyObject* kwargs) {
+        static const char* keywords[] = {"source", "algorithm", "k", "deadline_ms", nullptr};
+        PyObject* source;
+        const char* algorithm = "kdtree";
+        Py_ssize_t k = 5;
+        PyObject* budget = Py_None;
+        if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|snO", const_cast<char**>(keywords), &source, &algorithm, &k, &budget)) return nullptr;
+        Deadline deadline = NO_DEADLINE; // from the call, so waiting for the search lock counts towards it
+        if (budget != Py_None) {
+            double ms = PyFloat_AsDouble(budget);
+            if (ms == -1.0 && PyErr_Occurred()) return nullptr;
+            if (ms < 0.0) {
+                PyErr_SetString(PyExc_ValueError, "deadline_ms must be >= 0");
+                return nullptr;
+            }
+            deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(ms));
+        }
+        if (!ready(self)) return nullptr;
+        if (k < 0) {
+            PyErr_SetString(PyExc_ValueError, "k must be >= 0");
+            return nullptr;
+        }
+        string name, method = algorithm;
+        PointsView points;
+        bool byName = PyUnicode_Check(source);
+        if (byName) {
+            const char* text = PyUnicode_AsUTF8(source);
+            if (!text) return nullptr;
+            name = text;
+        } else if (!points.acquire(source)) {
+            return nullptr;
+        }
+        vector<Match> results;
+        string queryStats;
+        bool found;
+        Py_BEGIN_ALLOW_THREADS
+        {
+            lock_guard<mutex> guard(*self->lock);
+            QueryStats statsOfQuery;
+            found = byName ? self->corpus->search(name, method, static_cast<size_t>(k), results, deadline)
+                           : self->corpus->search(points.mesh(), method, static_cast<size_t>(k), results, deadline);
+            queryStats = statsOfQuery.finish();
+            queryStats.pop_back(); // the closing brace, the search's part goes in before it
+            queryStats += ", \"search\": " + searchStatsJson(self->corpus->lastStats()) + "}";
+        }
+        Py_END_ALLOW_THREADS
+        if (!found) {
+            PyErr_Format(PyExc_ValueError, "cannot search %s with %s", byName ? name.c_str() : "the points", algorithm);
+            return nullptr;
+        }
+        PyObject* list = PyList_New(static_cast<Py_ssize_t>(results.size()));
+        if (!list) return nullptr;
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Match& match = results[i];
+            PyList_SET_ITEM(list, static_cast<Py_ssize_t>(i), Py_BuildValue("(sdnn)", match.name.c_str(), static_cast<double>(match.score),
+                                                                            static_cast<Py_ssize_t>(match.vertexCount), static_cast<Py_ssize_t>(match.faceCount)));
+        }
+        return Py_BuildValue("(Ns)", list, queryStats.c_str());
+    }
+
+    PyMethodDef CORPUS_METHODS[] = {
+        {"size", reinterpret_cast<PyCFunction>(corpusSize), METH_NOARGS, "number of models"},
+        {"names", reinterpret_cast<PyCFunction>(corpusNames), METH_NOARGS, "model names in corpus order"},
+        {"models", reinterpret_cast<PyCFunction>(corpusModels), METH_NOARGS, "[(name, vertices, faces)] in corpus order"},
+        {"refresh", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(corpusRefresh)), METH_VARARGS | METH_KEYWORDS,
+         "refresh(directory=None) -> {added, changed, removed, touched, unreadable, models, seconds}"},
+        {"search", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(corpusSearch)), METH_VARARGS | METH_KEYWORDS,
+         "search(source, algorithm='kdtree', k=5, deadline_ms=None) -> ([(name, score, vertices, faces)], stats json), best first"},
+        {nullptr, nullptr, 0, nullptr},
+    };
+
+    PyTypeObject CORPUS_TYPE = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+    PyMethodDef MODULE_METHODS[] = {
+        {"compare", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(compare)), METH_VARARGS | METH_KEYWORDS,
+         "compare(a, b, algorithm='kdtree', sampling='none') -> float"},
+        {"compare_batch", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(compareBatch)), METH_VARARGS | METH_KEYWORDS,
+         "compare_batch(query, candidates, algorithm='kdtree', sampling='none') -> [float]"},
+        {"stats", stats, METH_NOARGS, "stats() -> JSON histograms of every query so far"},
+        {"geometry", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(geometry)), METH_VARARGS | METH_KEYWORDS,
+         "geometry(path, cache_path=None, level=0) -> bytes, one level of detail of the file's viewer geometry"},
+        {nullptr, nullptr, 0, nullptr},
+    };
+
+    PyModuleDef MODULE = {PyModuleDef_HEAD_INIT, "similarity_engine", "3D model similarity engine, see PythonModule.cpp", -1, MODULE_METHODS};
+}
+
+PyMODINIT_FUNC PyInit_similarity_engine() {
+    CORPUS_TYPE.tp_name = "similarity_engine.Corpus";
+    CORPUS_TYPE.tp_basicsize = sizeof(CorpusObject);
+    CORPUS_TYPE.tp_flags = Py_TPFLAGS_DEFAULT;
+    CORPUS_TYPE.tp_doc = "Corpus(path, prefilter=256, sampling='none', score_cache=None): a directory of OFF files or an index, loaded once";
+    CORPUS_TYPE.tp_new = PyType_GenericNew;
+    CORPUS_TYPE.tp_init = reinterpret_cast<initproc>(corpusInit);
+    CORPUS_TYPE.tp_dealloc = reinterpret_cast<destructor>(corpusDealloc);
+    CORPUS_TYPE.tp_methods = CORPUS_METHODS;
+    if (PyType_Ready(&CORPUS_TYPE) < 0) return nullptr;
+    PyObject* module = PyModule_Create(&MODULE);
+    if (!module) return nullptr;
+    Py_INCREF(&CORPUS_TYPE);
+    if (PyModule_AddObject(module, "Corpus", reinterpret_cast<PyObject*>(&CORPUS_TYPE)) < 0) {
+        Py_DECREF(&CORPUS_TYPE);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    return module;
+}
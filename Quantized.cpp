@@ -0,0 +1,105 @@
+#include "Quantized.h"
+#include <cmath>
+
+namespace {
+    // a step is never finer than 2^-20 of the box's magnitude: float keeps 24 bits, so grid points stay a few ulps apart and
+    // a decoded point always encodes back to its own code (a snapped point snaps to itself)
+    const float MIN_RELATIVE_STEP = 0x1.0p-20f;
+
+    uint32_t zigzag(int32_t value) { return static_cast<uint32_t>(value) << 1 ^ static_cast<uint32_t>(value >> 31); }
+    int32_t unzigzag(uint32_t value) { return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1); }
+
+    void putVarint(vector<uint8_t>& out, uint32_t value) { // 7 bits per byte, low first
+        for (; value >= 0x80; value >>= 7) out.push_back(static_cast<uint8_t>(value | 0x80));
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    uint32_t getVarint(const uint8_t*& in) {
+        uint32_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            uint8_t byte = *in++;
+            value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if (byte < 0x80) return value;
+        }
+    }
+}
+
+Quantizer Quantizer::fit(const vector<Point>& points, uint32_t bits) {
+    Quantizer grid;
+    grid.bits = min(max(bits, 1u), MAX_QUANTIZE_BITS);
+    if (points.empty()) return grid;
+    Point low = points[0], high = points[0];
+    for (const Point& p : points) {
+        low = Point(min(low.x, p.x), min(low.y, p.y), min(low.z, p.z));
+        high = Point(max(high.x, p.x), max(high.y, p.y), max(high.z, p.z));
+    }
+    float lows[3] = {low.x, low.y, low.z}, highs[3] = {high.x, high.y, high.z};
+    float codes = static_cast<float>((1u << grid.bits) - 1);
+    for (int axis = 0; axis < 3; ++axis) {
+        float extent = highs[axis] - lows[axis];
+        grid.origin[axis] = lows[axis];
+        grid.step[axis] = max(extent / codes, (fabs(lows[axis]) + extent) * MIN_RELATIVE_STEP);
+    }
+    return grid;
+}
+
+uint16_t Quantizer::encode(float value, int axis) const {
+    if (step[axis] <= 0.0f) return 0;
+    float code = nearbyint((value - origin[axis]) / step[axis]);
+    return static_cast<uint16_t>(min(max(code, 0.0f), static_cast<float>((1u << bits) - 1)));
+}
+
+void Quantizer::snap(vector<Point>& points) const {
+    for (Point& p : points) p = decode(encode(p.x, 0), encode(p.y, 1), encode(p.z, 2));
+}
+
+PackedPoints::PackedPoints(const Point* points, size_t pointCount, const Quantizer& grid_, bool delta_)
+    : grid(grid_), count(pointCount), delta(delta_) {
+    if (!delta) {
+        codes.resize(3 * count);
+        for (size_t i = 0; i < count; ++i) {
+            codes[3 * i] = grid.encode(points[i].x, 0);
+            codes[3 * i + 1] = grid.encode(points[i].y, 1);
+            codes[3 * i + 2] = grid.encode(points[i].z, 2);
+        }
+        return;
+    }
+    blocks.reserve((count + BLOCK - 1) / BLOCK);
+    uint16_t previous[3] = {0, 0, 0};
+    for (size_t i = 0; i < count; ++i) {
+        uint16_t code[3] = {grid.encode(points[i].x, 0), grid.encode(points[i].y, 1), grid.encode(points[i].z, 2)};
+        if (i % BLOCK == 0) { // a block starts from its own codes, so it decodes without the ones before
+            blocks.push_back(static_cast<uint32_t>(stream.size()));
+            for (uint16_t c : code) {
+                stream.push_back(static_cast<uint8_t>(c));
+                stream.push_back(static_cast<uint8_t>(c >> 8));
+            }
+        } else {
+            for (int axis = 0; axis < 3; ++axis) putVarint(stream, zigzag(static_cast<int32_t>(code[axis]) - previous[axis]));
+        }
+        copy(code, code + 3, previous);
+    }
+    stream.shrink_to_fit();
+}
+
+void PackedPoints::decode(size_t begin, size_t length, Point* out) const {
+    if (!delta) {
+        for (size_t i = begin; i < begin + length; ++i) *out++ = grid.decode(codes[3 * i], codes[3 * i + 1], codes[3 * i + 2]);
+        return;
+    }
+    size_t end = begin + length;
+    for (size_t i = begin / BLOCK * BLOCK; i < end;) { // block by block, skipping the points before begin in the first one
+        const uint8_t* in = stream.data() + blocks[i / BLOCK];
+        uint16_t code[3];
+        for (uint16_t& c : code) {
+            c = static_cast<uint16_t>(in[0] | in[1] << 8);
+            in += 2;
+        }
+        size_t blockEnd = min(i + BLOCK, end);
+        while (true) {
+            if (i >= begin) *out++ = grid.decode(code[0], code[1], code[2]);
+            if (++i == blockEnd) break;
+            for (uint16_t& c : code) c = static_cast<uint16_t>(c + unzigzag(getVarint(in)));
+        }
+    }
+}
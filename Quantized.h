@@ -0,0 +1,51 @@
+#pragma once
+#include "generic.h"
+#include <cstdint>
+
+/**
+ * Fixed point storage for a model's points: every coordinate as an unsigned code of up to 16 bits, relative to the model's
+ * bounding box, point = origin + code * step per axis (one float multiply and one add, in that order, wherever it's decoded)
+ * precision :: a snapped coordinate moves by at most step / 2, step = axis extent / (2^bits - 1); normalized models span at
+ *              most 1 along every axis, so at 16 bits a point moves by at most sqrt(3) * 7.7e-6 ~ 1.3e-5
+ * the points are snapped to the grid before any tree is built (see preprocess), so trees decoding codes hold exactly the
+ * points float trees built from the snapped points would, and both score every pair the same
+ */
+const uint32_t MAX_QUANTIZE_BITS = 16;
+
+struct Quantizer {
+    float origin[3] = {0.0f, 0.0f, 0.0f};  // the bounding box's low corner
+    float step[3] = {0.0f, 0.0f, 0.0f};    // 0 along a flat axis, whose codes are all 0
+    uint32_t bits = MAX_QUANTIZE_BITS;
+
+    static Quantizer fit(const vector<Point>& points, uint32_t bits); // the points' bounding box cut into 2^bits - 1 steps per axis
+    uint16_t encode(float value, int axis) const; // nearest code, values outside the box get the border codes
+    float decode(uint16_t code, int axis) const { return origin[axis] + static_cast<float>(code) * step[axis]; };
+    Point decode(uint16_t x, uint16_t y, uint16_t z) const { return Point(decode(x, 0), decode(y, 1), decode(z, 2)); };
+    void snap(vector<Point>& points) const; // every point to the grid point it encodes to
+};
+
+/**
+ * Quantized points kept in the order given (Morton order for an octree), as x, y, z codes per point or delta encoded:
+ * blocks of BLOCK points, the first one's codes as they are and every next one as zigzag varint differences to the one before,
+ * which Morton order keeps small; a block is found through its byte offset, so a range decodes from the start of its block
+ */
+class PackedPoints {
+    static const size_t BLOCK = 16;
+
+    Quantizer grid;
+    size_t count = 0;
+    bool delta = false;
+    vector<uint16_t> codes;     // 3 per point, without delta encoding
+    vector<uint8_t> stream;     // delta encoded blocks
+    vector<uint32_t> blocks;    // offset of every block in stream
+
+public:
+    PackedPoints() {};
+    PackedPoints(const Point* points, size_t pointCount, const Quantizer& grid_, bool delta_); // the points must lie on grid
+    size_t size() const { return count; };
+    bool empty() const { return count == 0; };
+    void decode(size_t begin, size_t length, Point* out) const; // points [begin, begin + length)
+    Point at(size_t i) const { Point p; decode(i, 1, &p); return p; };
+    vector<Point> decode() const { vector<Point> points(count); decode(0, count, points.data()); return points; };
+    size_t memoryBytes() const { return codes.capacity() * sizeof(uint16_t) + stream.capacity() + blocks.capacity() * sizeof(uint32_t); };
+};
@@ -0,0 +1,189 @@
+#include "Sampling.h"
+#include "PointCloud.h"
+#include "Simd.h"
+#include "Stats.h"
+
+namespace {
+    const uint32_t MAX_RESOLUTION = 1024; // cells per axis of the finest voxel grid, keys stay within 30 bits
+
+    struct Grid {
+        Point low;
+        float cell;
+        uint32_t resolution;
+
+        uint32_t key(const Point& p) const { // cells are ordered x, then y, then z
+            auto axis = [this](float v) { return min(static_cast<uint32_t>(max(v / cell, 0.0f)), resolution - 1); };
+            return (axis(p.x - low.x) * resolution + axis(p.y - low.y)) * resolution + axis(p.z - low.z);
+        };
+    };
+
+    size_t occupiedCells(const vector<Point>& points, const Grid& grid, vector<uint32_t>& keys) {
+        keys.resize(points.size());
+        for (size_t i = 0; i < points.size(); ++i) keys[i] = grid.key(points[i]);
+        sort(keys.begin(), keys.end());
+        return static_cast<size_t>(unique(keys.begin(), keys.end()) - keys.begin());
+    }
+
+    double nextUniform(uint64_t& state) { // [0, 1) from the same LCG as the descriptor's pair sampling
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<double>(state >> 11) * 0x1.0p-53;
+    }
+}
+
+bool parseSampling(const string& text, SampleOptions& options) {
+    SampleOptions parsed;
+    size_t comma = text.find(',');
+    if (comma != string::npos) { // storage after the sampling itself
+        string storage = text.substr(comma + 1), delta = ",delta";
+        if (storage.size() > delta.size() && storage.compare(storage.size() - delta.size(), delta.size(), delta) == 0) {
+            parsed.delta = true;
+            storage.resize(storage.size() - delta.size());
+        }
+        if (storage.size() < 2 || storage.size() > 3 || storage[0] != 'q' || storage.find_first_not_of("0123456789", 1) != string::npos) return false;
+        parsed.bits = static_cast<uint32_t>(stoul(storage.substr(1)));
+        if (parsed.bits == 0 || parsed.bits > MAX_QUANTIZE_BITS) return false;
+    }
+    string sampling = text.substr(0, comma);
+    size_t colon = sampling.find(':');
+    string mode = sampling.substr(0, colon);
+    if (mode == "none") parsed.mode = SampleMode::None;
+    else if (mode == "voxel") parsed.mode = SampleMode::Voxel;
+    else if (mode == "fps") parsed.mode = SampleMode::Farthest;
+    else return false;
+    if (colon != string::npos) {
+        string budget = sampling.substr(colon + 1);
+        if (budget.empty() || budget.find_first_not_of("0123456789") != string::npos || budget.size() > 9) return false;
+        parsed.budget = static_cast<uint32_t>(stoul(budget));
+        if (parsed.budget == 0) return false;
+    }
+    options = parsed;
+    return true;
+}
+
+string samplingName(const SampleOptions& options) {
+    string name = "none";
+    if (options.mode == SampleMode::Voxel) name = "voxel:" + to_string(options.budget);
+    else if (options.mode == SampleMode::Farthest) name = "fps:" + to_string(options.budget);
+    if (options.bits > 0) name += ",q" + to_string(options.bits) + (options.delta ? ",delta" : "");
+    return name;
+}
+
+void preprocess(Mesh& mesh, const SampleOptions& options, Point& center, float& scale, Quantizer* grid) {
+    ScopedTimer timer(Counter::NormalizeNanos);
+    normalize(mesh.vertices, center, scale);
+    if (options.mode != SampleMode::None && !mesh.vertices.empty()) {
+        vector<Point> sampled;
+        if (mesh.vertices.size() < options.budget) {
+            sampleSurface(mesh, options.budget - mesh.vertices.size(), sampled); // read from vertices, so appended afterwards
+            mesh.vertices.insert(mesh.vertices.end(), sampled.begin(), sampled.end());
+        } else {
+            if (options.mode == SampleMode::Voxel) voxelDownsample(mesh.vertices, options.budget, sampled);
+            else farthestPointSample(mesh.vertices, options.budget, sampled);
+            mesh.vertices.swap(sampled);
+        }
+    }
+    if (options.bits == 0) return;
+    Quantizer fitted = Quantizer::fit(mesh.vertices, options.bits); // to the box of the final points
+    fitted.snap(mesh.vertices);
+    if (grid) *grid = fitted;
+}
+
+void voxelDownsample(const vector<Point>& points, size_t budget, vector<Point>& out) {
+    out.clear();
+    if (points.size() <= budget) {
+        out = points;
+        return;
+    }
+    if (budget == 0) return;
+    Point low = points[0], high = points[0];
+    for (const Point& p : points) {
+        low = Point(min(low.x, p.x), min(low.y, p.y), min(low.z, p.z));
+        high = Point(max(high.x, p.x), max(high.y, p.y), max(high.z, p.z));
+    }
+    float extent = max(high.x - low.x, max(high.y - low.y, high.z - low.z));
+    if (extent <= 0.0f) { // one repeated point
+        out.push_back(low);
+        return;
+    }
+
+    // finest grid whose occupied cells still fit the budget (occupancy only grows with the resolution, give or take cell alignment)
+    vector<uint32_t> keys;
+    uint32_t coarse = 1, fine = MAX_RESOLUTION;
+    while (coarse < fine) {
+        uint32_t middle = (coarse + fine + 1) / 2;
+        if (occupiedCells(points, {low, extent / middle, middle}, keys) <= budget) coarse = middle;
+        else fine = middle - 1;
+    }
+    Grid grid = {low, extent / coarse, coarse};
+
+    vector<pair<uint32_t, uint32_t>> cells(points.size()); // (cell key, point index)
+    for (size_t i = 0; i < points.size(); ++i) cells[i] = {grid.key(points[i]), static_cast<uint32_t>(i)};
+    sort(cells.begin(), cells.end());
+    for (size_t begin = 0, end = 0; begin < cells.size(); begin = end) {
+        double x = 0.0, y = 0.0, z = 0.0;
+        for (end = begin; end < cells.size() && cells[end].first == cells[begin].first; ++end) {
+            const Point& p = points[cells[end].second];
+            x += p.x; y += p.y; z += p.z;
+        }
+        double n = static_cast<double>(end - begin);
+        out.push_back(Point(static_cast<float>(x / n), static_cast<float>(y / n), static_cast<float>(z / n)));
+    }
+}
+
+void farthestPointSample(const vector<Point>& points, size_t budget, vector<Point>& out) {
+    out.clear();
+    if (points.size() <= budget) {
+        out = points;
+        return;
+    }
+    if (budget == 0) return;
+    double x = 0.0, y = 0.0, z = 0.0;
+    for (const Point& p : points) { x += p.x; y += p.y; z += p.z; }
+    Point mean(static_cast<float>(x / points.size()), static_cast<float>(y / points.size()), static_cast<float>(z / points.size()));
+
+    PointCloud cloud(points);
+    vector<float> nearest(points.size(), INFINITY); // squared distance of every point to the closest chosen one
+    // start from the point farthest from the mean, so the result doesn't depend on file order
+    size_t next = relaxNearest(cloud.xs(), cloud.ys(), cloud.zs(), cloud.size(), mean.x, mean.y, mean.z, nearest.data());
+    fill(nearest.begin(), nearest.end(), INFINITY);
+    out.reserve(budget);
+    while (out.size() < budget) {
+        Point chosen = points[next];
+        out.push_back(chosen);
+        next = relaxNearest(cloud.xs(), cloud.ys(), cloud.zs(), cloud.size(), chosen.x, chosen.y, chosen.z, nearest.data());
+    }
+}
+
+void sampleSurface(const Mesh& mesh, size_t count, vector<Point>& out) {
+    if (count == 0 || mesh.faceOffsets.size() < 2) return;
+    vector<uint32_t> corners;   // three vertex indices per triangle
+    vector<double> cumulative;  // running total of the triangles' areas
+    double total = 0.0;
+    const vector<Point>& v = mesh.vertices;
+    for (size_t face = 0; face + 1 < mesh.faceOffsets.size(); ++face) {
+        uint32_t begin = mesh.faceOffsets[face], end = mesh.faceOffsets[face + 1];
+        for (uint32_t j = begin + 1; j + 1 < end; ++j) {
+            uint32_t a = mesh.faceIndices[begin], b = mesh.faceIndices[j], c = mesh.faceIndices[j + 1];
+            Point u = v[b] - v[a], w = v[c] - v[a];
+            double cx = u.y * w.z - u.z * w.y, cy = u.z * w.x - u.x * w.z, cz = u.x * w.y - u.y * w.x;
+            double area = 0.5 * sqrt(cx * cx + cy * cy + cz * cz);
+            if (area <= 0.0) continue; // degenerate, never picked anyway
+            total += area;
+            cumulative.push_back(total);
+            corners.insert(corners.end(), {a, b, c});
+        }
+    }
+    if (total <= 0.0) return;
+
+    uint64_t state = 0x9e3779b97f4a7c15ULL ^ v.size(); // fixed seed, the same mesh always gets the same points
+    out.reserve(out.size() + count);
+    for (size_t i = 0; i < count; ++i) {
+        size_t t = static_cast<size_t>(upper_bound(cumulative.begin(), cumulative.end(), nextUniform(state) * total) - cumulative.begin());
+        t = min(t, cumulative.size() - 1);
+        const Point &a = v[corners[3 * t]], &b = v[corners[3 * t + 1]], &c = v[corners[3 * t + 2]];
+        double r1 = sqrt(nextUniform(state)), r2 = nextUniform(state); // uniform over the triangle
+        double wa = 1.0 - r1, wb = r1 * (1.0 - r2), wc = r1 * r2;
+        out.push_back(Point(static_cast<float>(wa * a.x + wb * b.x + wc * c.x), static_cast<float>(wa * a.y + wb * b.y + wc * c.y),
+                            static_cast<float>(wa * a.z + wb * b.z + wc * c.z)));
+    }
+}
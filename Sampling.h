@@ -0,0 +1,33 @@
+#pragma once
+#include "generic.h"
+#include "Quantized.h"
+
+/**
+ * Preprocessing between loading a mesh and building its trees: normalize, then bring the model to a fixed point budget so
+ * comparing two models costs the same however densely they were meshed
+ * dense models are reduced with a voxel grid (the centroid of every occupied cell, the grid as fine as the budget allows)
+ * or with farthest point sampling (an evenly spread subset of the vertices); sparse models keep their vertices and get
+ * the rest of the budget as points spread over their faces in proportion to face area
+ * last, the points can be snapped to a fixed point grid over their bounding box, so a corpus keeps them as 16 bit codes
+ * (see Quantized.h for the precision given up)
+ */
+enum class SampleMode : uint32_t { None, Voxel, Farthest }; // None keeps every raw vertex (normalized only)
+
+struct SampleOptions {
+    SampleMode mode = SampleMode::None;
+    uint32_t budget = 2048;     // points per model, voxel mode keeps at most this many
+    uint32_t bits = 0;          // fixed point bits per coordinate (1 to 16), 0 keeps float coordinates
+    bool delta = false;         // a corpus delta encodes its octrees' quantized points (storage only, scores don't change)
+};
+
+// (none | voxel[:budget] | fps[:budget])[,q<bits>[,delta]], e.g. fps:2048,q16
+bool parseSampling(const string& text, SampleOptions& options);
+string samplingName(const SampleOptions& options); // inverse of parseSampling
+
+// normalize mesh.vertices (see normalize), resample them to the budget and snap them to the options' grid (its grid goes to *grid),
+// faces are only read and only needed for sparse meshes
+void preprocess(Mesh& mesh, const SampleOptions& options, Point& center, float& scale, Quantizer* grid = nullptr);
+
+void voxelDownsample(const vector<Point>& points, size_t budget, vector<Point>& out);      // O(n log n) per tried grid, ~10 grids
+void farthestPointSample(const vector<Point>& points, size_t budget, vector<Point>& out);  // O(n * budget), one SIMD pass per chosen point
+void sampleSurface(const Mesh& mesh, size_t count, vector<Point>& out); // appends count points, faces are triangulated as fans
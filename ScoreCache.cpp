@@ -0,0 +1,178 @@
+#include "ScoreCache.h"
+#include <cstring>
+
+namespace {
+    const uint64_t GOLDEN = 0x9e3779b97f4a7c15ULL;
+
+    uint64_t mix(uint64_t h) { // murmur3's finalizer
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    bool tighter(const CachedScore& next, const CachedScore& known) { // next tells more about the pair than known
+        if (known.bound == ScoreBound::Exact) return false;
+        if (next.bound == ScoreBound::Exact || next.bound != known.bound) return true;
+        return next.bound == ScoreBound::AtLeast ? next.value > known.value : next.value < known.value;
+    }
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t h = seed ^ (size * GOLDEN);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) { // a word at a time, a point cloud hashes at memory speed
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        h = (h ^ mix(word)) * GOLDEN;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    if (i < size) memcpy(&tail, bytes + i, size - i);
+    return mix(h ^ mix(tail ^ GOLDEN));
+}
+
+uint64_t contentHash(const Point* points, size_t count) {
+    return hashBytes(points, count * sizeof(Point));
+}
+
+ScoreKey scoreKey(uint64_t hashA, uint64_t hashB, uint64_t parameters) {
+    return {min(hashA, hashB), max(hashA, hashB), parameters};
+}
+
+uint64_t ScoreCache::keyHash(const ScoreKey& key) {
+    return mix(key.a ^ mix(key.b ^ mix(key.parameters)));
+}
+
+bool ScoreCache::find(const ScoreKey& key, uint64_t hash, CachedScore& score) {
+    auto found = recentByKey.find(hash);
+    if (found != recentByKey.end() && found->second->key == key) {
+        recent.splice(recent.begin(), recent, found->second);
+        score = found->second->score;
+        return true;
+    }
+    auto stored = onDisk.find(hash);
+    if (stored == onDisk.end()) return false;
+    const ScoreRecord& record = stored->second < mappedCount ? mapped[stored->second] : appended[stored->second - mappedCount];
+    if (!(record.key == key)) return false; // another key with the same hash, vanishingly rare
+    score = record.score;
+    remember(key, hash, score);
+    return true;
+}
+
+void ScoreCache::remember(const ScoreKey& key, uint64_t hash, const CachedScore& score) {
+    auto found = recentByKey.find(hash);
+    if (found != recentByKey.end()) {
+        found->second->key = key;
+        found->second->score = score;
+        recent.splice(recent.begin(), recent, found->second);
+        return;
+    }
+    if (capacity == 0) return;
+    if (recent.size() >= capacity) {
+        recentByKey.erase(keyHash(recent.back().key));
+        recent.pop_back();
+    }
+    recent.push_front({key, score});
+    recentByKey[hash] = recent.begin();
+}
+
+bool ScoreCache::open(const string& filePath) {
+    lock_guard<mutex> guard(lock);
+    path = filePath;
+    mapped = nullptr;
+    mappedCount = written = 0;
+    appended.clear();
+    onDisk.clear();
+    if (!filesystem::exists(path)) {
+        ofstream fresh(path, ios::binary);
+        ScoreFileHeader header = {};
+        memcpy(header.magic, SCORE_MAGIC, sizeof(SCORE_MAGIC));
+        header.version = SCORE_VERSION;
+        header.recordSize = sizeof(ScoreRecord);
+        fresh.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!fresh) {
+            path.clear();
+            return false;
+        }
+    }
+    if (!mapFile()) {
+        path.clear();
+        file.close();
+        return false;
+    }
+    return true;
+}
+
+bool ScoreCache::mapFile() {
+    if (!file.open(path) || file.size() < sizeof(ScoreFileHeader)) return false;
+    const ScoreFileHeader* header = reinterpret_cast<const ScoreFileHeader*>(file.data());
+    if (memcmp(header->magic, SCORE_MAGIC, sizeof(SCORE_MAGIC)) != 0 || header->version != SCORE_VERSION
+        || header->recordSize != sizeof(ScoreRecord)) return false;
+    size_t count = (file.size() - sizeof(ScoreFileHeader)) / sizeof(ScoreRecord);
+    size_t whole = sizeof(ScoreFileHeader) + count * sizeof(ScoreRecord);
+    if (file.size() != whole) { // the tail of an append cut short, dropped so later appends stay aligned
+        file.close();
+        std::error_code error;
+        filesystem::resize_file(path, whole, error);
+        if (error || !file.open(path)) return false;
+    }
+    mapped = reinterpret_cast<const ScoreRecord*>(file.data() + sizeof(ScoreFileHeader));
+    // everything since the last mapping, in file order: the records appended here and any another process appended meanwhile
+    for (size_t i = mappedCount; i < count; ++i) onDisk[keyHash(mapped[i].key)] = i;
+    mappedCount = written = count;
+    appended.clear();
+    return true;
+}
+
+bool ScoreCache::lookup(const ScoreKey& key, CachedScore& score) {
+    lock_guard<mutex> guard(lock);
+    return find(key, keyHash(key), score);
+}
+
+void ScoreCache::store(const ScoreKey& key, const CachedScore& score) {
+    lock_guard<mutex> guard(lock);
+    uint64_t hash = keyHash(key);
+    CachedScore known;
+    if (find(key, hash, known) && !tighter(score, known)) return;
+    remember(key, hash, score);
+    if (path.empty()) return;
+    appended.push_back({key, score});
+    onDisk[hash] = mappedCount + appended.size() - 1;
+}
+
+bool ScoreCache::writeAppended() {
+    size_t first = written - mappedCount;
+    if (path.empty() || first == appended.size()) return true;
+    ofstream out(path, ios::binary | ios::app);
+    out.write(reinterpret_cast<const char*>(appended.data() + first), static_cast<streamsize>((appended.size() - first) * sizeof(ScoreRecord)));
+    out.close();
+    if (!out) return false;
+    written = mappedCount + appended.size();
+    if (appended.size() < REMAP_RECORDS || mapFile()) return true;
+    path.clear(); // the file went away underneath, carry on with the memory tier
+    file.close();
+    mapped = nullptr;
+    mappedCount = written = 0;
+    appended.clear();
+    onDisk.clear();
+    return false;
+}
+
+bool ScoreCache::flush() {
+    lock_guard<mutex> guard(lock);
+    return writeAppended();
+}
+
+size_t ScoreCache::memoryEntries() const {
+    lock_guard<mutex> guard(lock);
+    return recent.size();
+}
+
+size_t ScoreCache::diskEntries() const {
+    lock_guard<mutex> guard(lock);
+    return onDisk.size();
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include "generic.h"
+#include "MappedFile.h"
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Pairwise score cache keyed by content: (hash of model A's points, hash of model B's points, hash of algorithm and parameters)
+ * the points hashed are the preprocessed ones the trees hold, so a changed file, another sampling or another frame is another key
+ * and stale entries are never found again; both directions of a pair share one entry (every score is symmetric)
+ * bounds are kept as well: a kd tree distance known to be past the bound its comparison was given, an octree score known to be at
+ * most the value its comparison stopped at (the coarse grid bounds a search orders its candidates by are cheaper to redo, never stored)
+ * tiers :: a bounded LRU in memory, in front of an append-only file mapped on open; new entries are appended on flush() and the
+ *          file is mapped again once enough of them pile up, the last record of a key wins
+ * file  :: ScoreFileHeader | ScoreRecord... (a record cut short by a crash is dropped on open)
+ * every call may come from any thread
+ */
+const char SCORE_MAGIC[8] = {'S', 'C', 'O', 'R', 'E', 'S', '\0', '\0'};
+const uint32_t SCORE_VERSION = 1; // bump whenever the record layout or the way scores are computed changes
+
+enum class ScoreBound : uint32_t {
+    Exact,      // the score itself
+    AtLeast,    // the score is at least value
+    AtMost      // the score is at most value
+};
+
+struct CachedScore {
+    float value;
+    ScoreBound bound;
+};
+
+struct ScoreKey { // a <= b
+    uint64_t a, b, parameters;
+    bool operator==(const ScoreKey& other) const { return a == other.a && b == other.b && parameters == other.parameters; };
+};
+
+struct ScoreFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+};
+
+struct ScoreRecord {
+    ScoreKey key;
+    CachedScore score;
+};
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+uint64_t contentHash(const Point* points, size_t count); // of a model's preprocessed points, in tree order
+ScoreKey scoreKey(uint64_t hashA, uint64_t hashB, uint64_t parameters); // the same key for (A, B) and (B, A)
+
+class ScoreCache {
+    static const size_t REMAP_RECORDS = 4096; // appended records kept in memory until the file is mapped again
+
+    struct Entry {
+        ScoreKey key;
+        CachedScore score;
+    };
+
+    size_t capacity;
+    list<Entry> recent;                                        // most recently used first
+    unordered_map<uint64_t, list<Entry>::iterator> recentByKey; // key hash -> entry
+    string path;
+    MappedFile file;
+    const ScoreRecord* mapped = nullptr;
+    size_t mappedCount = 0;
+    vector<ScoreRecord> appended;           // records past the mapped ones, the first unwritten one at written - mappedCount
+    size_t written = 0;                     // records in the file
+    unordered_map<uint64_t, uint64_t> onDisk; // key hash -> record number, of the latest record of that key
+    mutable mutex lock;
+
+    static uint64_t keyHash(const ScoreKey& key);
+    bool find(const ScoreKey& key, uint64_t hash, CachedScore& score); // LRU first, then the disk tier (promoted into the LRU)
+    void remember(const ScoreKey& key, uint64_t hash, const CachedScore& score); // in the LRU, evicting the oldest when full
+    bool writeAppended(); // caller holds lock
+    bool mapFile();       // caller holds lock, indexes the records added since the last mapping
+
+public:
+    explicit ScoreCache(size_t capacity_ = 65536) : capacity(capacity_) {};
+    ~ScoreCache() { flush(); };
+    ScoreCache(const ScoreCache&) = delete;
+    ScoreCache& operator=(const ScoreCache&) = delete;
+
+    // adds the disk tier, creating the file if needed; false if it can't be written or belongs to another version
+    bool open(const string& filePath);
+    bool lookup(const ScoreKey& key, CachedScore& score);
+    // keeps what is known about the pair: an exact score replaces a bound, a bound only replaces a looser one
+    void store(const ScoreKey& key, const CachedScore& score);
+    bool flush(); // appends the new entries to the file (a no-op without one)
+    size_t memoryEntries() const;
+    size_t diskEntries() const;
+};
@@ -0,0 +1,466 @@
+#include "Shards.h"
+#include "Stats.h"
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <sys/prctl.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace {
+    const char* NUMA_ROOT = "/sys/devices/system/node";
+
+    bool parseCpuList(const string& list, vector<int>& cpus) { // "0-3,8,10-11", the format of the kernel's cpulist files
+        istringstream in(list);
+        string range;
+        while (getline(in, range, ',')) {
+            char* end = nullptr;
+            long first = strtol(range.c_str(), &end, 10), last = first;
+            if (end == range.c_str() || first < 0) return false;
+            if (*end == '-') last = strtol(end + 1, &end, 10);
+            for (long cpu = first; cpu <= last; ++cpu) cpus.push_back(static_cast<int>(cpu));
+        }
+        return !cpus.empty();
+    }
+
+    string cpuList(const vector<int>& cpus, size_t begin, size_t end) { // cpus[begin, end) in the same format, runs as ranges
+        string list;
+        for (size_t i = begin; i < end;) {
+            size_t run = i;
+            while (run + 1 < end && cpus[run + 1] == cpus[run] + 1) run++;
+            list += (list.empty() ? "" : ",") + to_string(cpus[i]) + (run > i ? "-" + to_string(cpus[run]) : "");
+            i = run + 1;
+        }
+        return list;
+    }
+
+    string nodeCpus(const string& node) { // the cpu list of NUMA node <node>, empty if there is no such node
+        ifstream in(string(NUMA_ROOT) + "/node" + node + "/cpulist");
+        string list;
+        getline(in, list);
+        return list;
+    }
+
+    vector<string> numaNodes() { // "node<n>" of every node with cpus, in node order
+        vector<pair<long, string>> nodes;
+        std::error_code error;
+        for (const auto& entry : filesystem::directory_iterator(NUMA_ROOT, error)) {
+            string name = entry.path().filename().string();
+            if (name.rfind("node", 0) != 0 || name.size() == 4 || name.find_first_not_of("0123456789", 4) != string::npos) continue;
+            if (!nodeCpus(name.substr(4)).empty()) nodes.push_back({stol(name.substr(4)), name});
+        }
+        sort(nodes.begin(), nodes.end());
+        vector<string> names;
+        for (auto& node : nodes) names.push_back(node.second);
+        return names;
+    }
+
+    vector<int> allowedCpus() { // the ones this process may run on
+        vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+#endif
+        return cpus;
+    }
+
+    size_t answerLines(const string& request, const string& first) { // lines a worker's answer to request takes, given its first one
+        if (first.rfind("OK ", 0) != 0) return 1;
+        size_t rows = strtoul(first.c_str() + 3, nullptr, 10);
+        return request == "models" ? rows + 1 : rows + 2; // a search's rows end with its STATS line
+    }
+
+    string field(const string& row, size_t n) { // the nth tab separated field of row
+        size_t begin = 0;
+        for (size_t i = 0; i < n; ++i) {
+            begin = row.find('\t', begin);
+            if (begin == string::npos) return string();
+            begin++;
+        }
+        return row.substr(begin, row.find('\t', begin) - begin);
+    }
+
+    double jsonNumber(const string& json, const string& key) { // the value of "key": <number> in a flat json object, 0 if missing
+        size_t at = json.find("\"" + key + "\": ");
+        return at == string::npos ? 0.0 : strtod(json.c_str() + at + key.size() + 4, nullptr);
+    }
+
+    string partialTag(size_t answered, size_t shards) { return answered < shards ? " PARTIAL " + to_string(answered) + "/" + to_string(shards) : ""; }
+
+#ifndef _WIN32
+    bool socketAddress(const string& path, sockaddr_un& address) {
+        memset(&address, 0, sizeof(address));
+        if (path.size() >= sizeof(address.sun_path)) return false;
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size());
+        return true;
+    }
+
+    bool sendAll(int fd, const string& data) {
+        for (size_t sent = 0; sent < data.size();) {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL); // a closed peer is an error, not a signal
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    void serveConnection(int fd, const function<string(const string& request)>& respond) {
+        string pending;
+        char buffer[4096];
+        while (true) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            pending.append(buffer, static_cast<size_t>(n));
+            size_t begin = 0;
+            for (size_t end; (end = pending.find('\n', begin)) != string::npos; begin = end + 1)
+                if (!sendAll(fd, respond(pending.substr(begin, end - begin)))) return;
+            pending.erase(0, begin);
+        }
+    }
+#endif
+}
+
+bool pinToCpus(const string& cpus) {
+#ifdef __linux__
+    vector<int> list;
+    bool node = cpus.rfind("node", 0) == 0;
+    if (!parseCpuList(node ? nodeCpus(cpus.substr(4)) : cpus, list)) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : list)
+        if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0; // threads started later inherit it
+#else
+    return false;
+#endif
+}
+
+vector<string> shardCpuSets(size_t shards) {
+    vector<string> sets;
+    vector<string> nodes = numaNodes();
+    if (nodes.size() > 1 && nodes.size() >= shards) return vector<string>(nodes.begin(), nodes.begin() + shards);
+    vector<int> cpus = allowedCpus();
+    for (size_t s = 0; s < shards; ++s) {
+        if (cpus.empty()) sets.push_back("any");
+        else if (cpus.size() < shards) sets.push_back(to_string(cpus[s % cpus.size()])); // more shards than cpus, they share
+        else sets.push_back(cpuList(cpus, s * cpus.size() / shards, (s + 1) * cpus.size() / shards));
+    }
+    return sets;
+}
+
+#ifndef _WIN32
+bool serveSocket(const string& path, const function<string(const string& request)>& respond) {
+    sockaddr_un address;
+    if (!socketAddress(path, address)) return false;
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) return false;
+    unlink(path.c_str()); // left behind by a worker that crashed
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        close(listener);
+        return false;
+    }
+    while (true) {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0 && errno == EINTR) continue;
+        if (fd < 0) break;
+        thread([fd, &respond] { serveConnection(fd, respond); close(fd); }).detach();
+    }
+    close(listener);
+    return false;
+}
+
+bool ShardCoordinator::spawn(Shard& shard, size_t s) {
+    vector<string> arguments = {options.executable, "--shard", options.corpus, shard.socket, to_string(s), to_string(shards.size()),
+                                shard.cpus, to_string(options.candidates), samplingName(options.sampling)};
+    if (!options.scoreCache.empty()) arguments.push_back(options.scoreCache + "." + to_string(s)); // processes never share a cache file
+    vector<char*> argv;
+    for (string& argument : arguments) argv.push_back(argument.data());
+    argv.push_back(nullptr);
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+#ifdef __linux__
+        prctl(PR_SET_PDEATHSIG, SIGTERM); // a coordinator that dies takes its workers along
+        if (getppid() != parent) _exit(1);
+#endif
+        int null = open("/dev/null", O_RDWR);
+        if (null >= 0) { // stdin and stdout carry the coordinator's own protocol
+            dup2(null, STDIN_FILENO);
+            dup2(null, STDOUT_FILENO);
+        }
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    shard.pid = pid;
+    return true;
+}
+
+bool ShardCoordinator::connectTo(Shard& shard) {
+    if (shard.fd >= 0) return true;
+    sockaddr_un address;
+    if (!socketAddress(shard.socket, address)) return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0); // so workers started later don't hold other shards' connections open
+    if (fd < 0) return false;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) { // not listening yet (or any more)
+        close(fd);
+        return false;
+    }
+    shard.fd = fd;
+    shard.pending.clear();
+    return true;
+}
+
+void ShardCoordinator::drop(Shard& shard, size_t s) {
+    if (shard.fd >= 0) close(shard.fd);
+    shard.fd = -1;
+    shard.pending.clear();
+    if (shard.pid > 0 && waitpid(shard.pid, nullptr, WNOHANG) == shard.pid) {
+        cerr << "shard " << s << " exited, starting it again" << endl;
+        shard.pid = -1;
+        spawn(shard, s); // answers again once it has loaded its models
+    }
+}
+
+vector<vector<string>> ShardCoordinator::gather(const string& request, bool bounded) {
+    vector<vector<string>> answers(shards.size());
+    vector<size_t> expected(shards.size(), 0); // lines of each answer, known from its first line
+    vector<bool> waiting(shards.size(), false);
+    for (size_t s = 0; s < shards.size(); ++s) {
+        if (!connectTo(shards[s]) || !sendAll(shards[s].fd, request + "\n")) drop(shards[s], s);
+        else waiting[s] = true;
+    }
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(options.timeoutMs);
+    char buffer[65536];
+    while (true) {
+        vector<pollfd> fds;
+        vector<size_t> owners;
+        for (size_t s = 0; s < shards.size(); ++s) {
+            if (!waiting[s]) continue;
+            fds.push_back({shards[s].fd, POLLIN, 0});
+            owners.push_back(s);
+        }
+        if (fds.empty()) break;
+        int wait = -1;
+        if (bounded) {
+            auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+            if (left <= 0) break;
+            wait = static_cast<int>(left);
+        }
+        int ready = poll(fds.data(), fds.size(), wait);
+        if (ready < 0 && errno != EINTR) break;
+        for (size_t i = 0; ready > 0 && i < fds.size(); ++i) {
+            if (fds[i].revents == 0) continue;
+            size_t s = owners[i];
+            Shard& shard = shards[s];
+            ssize_t n = recv(shard.fd, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) { // the worker went away mid answer
+                answers[s].clear();
+                waiting[s] = false;
+                drop(shard, s);
+                continue;
+            }
+            shard.pending.append(buffer, static_cast<size_t>(n));
+            size_t begin = 0;
+            for (size_t end; waiting[s] && (end = shard.pending.find('\n', begin)) != string::npos; begin = end + 1) {
+                answers[s].push_back(shard.pending.substr(begin, end - begin));
+                if (answers[s].size() == 1) expected[s] = answerLines(request, answers[s][0]);
+                if (answers[s].size() == expected[s]) waiting[s] = false;
+            }
+            shard.pending.erase(0, begin);
+        }
+    }
+    for (size_t s = 0; s < shards.size(); ++s) {
+        if (!waiting[s]) continue;
+        answers[s].clear();
+        drop(shards[s], s); // the rest of its answer would be read as the next one's
+    }
+    return answers;
+}
+
+bool ShardCoordinator::start(const ShardOptions& options_, size_t shardCount) {
+    stop();
+    options = options_;
+    directory = (filesystem::temp_directory_path() / ("similarity-shards-" + to_string(getpid()))).string();
+    std::error_code error;
+    filesystem::create_directories(directory, error);
+    vector<string> sets = shardCpuSets(shardCount);
+    shards.assign(shardCount, Shard());
+    for (size_t s = 0; s < shardCount; ++s) {
+        shards[s].socket = directory + "/shard" + to_string(s) + ".sock";
+        shards[s].cpus = sets[s];
+        if (!spawn(shards[s], s)) {
+            stop();
+            return false;
+        }
+    }
+    while (true) { // a worker listens once it has loaded its models
+        size_t ready = 0;
+        for (Shard& shard : shards) {
+            if (connectTo(shard)) ready++;
+            else if (waitpid(shard.pid, nullptr, WNOHANG) == shard.pid) {
+                shard.pid = -1;
+                stop();
+                return false;
+            }
+        }
+        if (ready == shards.size()) return true;
+        this_thread::sleep_for(chrono::milliseconds(20));
+    }
+}
+
+void ShardCoordinator::stop() {
+    for (Shard& shard : shards) {
+        if (shard.fd >= 0) close(shard.fd);
+        if (shard.pid > 0) {
+            kill(shard.pid, SIGKILL); // nothing to save, every answer already flushed its score cache
+            waitpid(shard.pid, nullptr, 0);
+        }
+    }
+    shards.clear();
+    std::error_code error;
+    if (!directory.empty()) filesystem::remove_all(directory, error);
+    directory.clear();
+}
+#else
+bool serveSocket(const string&, const function<string(const string& request)>&) { return false; } // needs Unix sockets
+bool ShardCoordinator::spawn(Shard&, size_t) { return false; }
+bool ShardCoordinator::connectTo(Shard&) { return false; }
+void ShardCoordinator::drop(Shard&, size_t) {}
+vector<vector<string>> ShardCoordinator::gather(const string&, bool) { return vector<vector<string>>(shards.size()); }
+bool ShardCoordinator::start(const ShardOptions&, size_t) { return false; }
+void ShardCoordinator::stop() { shards.clear(); }
+#endif
+
+size_t ShardCoordinator::modelCount() {
+    size_t models = 0;
+    for (const vector<string>& answer : gather("models", true))
+        if (!answer.empty()) models += answer.size() - 1;
+    return models;
+}
+
+string ShardCoordinator::respond(const string& request) {
+    ostringstream out;
+    if (request == "stats") {
+        vector<vector<string>> answers = gather(request, true);
+        out << "STATS {\"coordinator\": " << statsHistograms() << ", \"shards\": [";
+        for (size_t s = 0; s < answers.size(); ++s) {
+            bool answered = answers[s].size() == 1 && answers[s][0].rfind("STATS ", 0) == 0;
+            out << (s > 0 ? ", " : "") << (answered ? answers[s][0].substr(6) : "null");
+        }
+        out << "]}\n";
+        return out.str();
+    }
+    if (request == "models") {
+        vector<vector<string>> answers = gather(request, true);
+        vector<pair<string, const string*>> rows; // name, row
+        size_t answered = 0;
+        for (const vector<string>& answer : answers) {
+            if (answer.empty() || answer[0].rfind("OK ", 0) != 0) continue;
+            answered++;
+            for (size_t i = 1; i < answer.size(); ++i) rows.push_back({field(answer[i], 2), &answer[i]});
+        }
+        sort(rows.begin(), rows.end()); // the order one corpus would list them in
+        out << "OK " << rows.size() << partialTag(answered, shards.size()) << '\n';
+        for (const auto& row : rows) out << *row.second << '\n';
+        return out.str();
+    }
+    if (request == "refresh" || request.rfind("refresh ", 0) == 0) {
+        vector<vector<string>> answers = gather(request, false); // a refresh takes as long as it takes
+        const char* counts[] = {"added", "changed", "removed", "touched", "unreadable", "models"};
+        double sums[6] = {0, 0, 0, 0, 0, 0}, seconds = 0.0;
+        size_t answered = 0;
+        for (const vector<string>& answer : answers) {
+            if (answer.empty()) continue;
+            if (answer[0].rfind("REFRESHED ", 0) != 0) return answer[0] + "\n";
+            answered++;
+            for (size_t i = 0; i < 6; ++i) sums[i] += jsonNumber(answer[0], counts[i]);
+            seconds = max(seconds, jsonNumber(answer[0], "seconds")); // the shards refresh side by side
+        }
+        if (answered == 0) return "ERR no shard answered\n";
+        out << "REFRESHED {";
+        for (size_t i = 0; i < 6; ++i) out << "\"" << counts[i] << "\": " << static_cast<size_t>(sums[i]) << ", ";
+        out << "\"seconds\": " << seconds << ", \"shards\": " << shards.size() << ", \"answered\": " << answered
+            << ", \"partial\": " << (answered < shards.size() ? "true" : "false") << "}\n";
+        return out.str();
+    }
+
+    QueryStats queryStats;
+    istringstream parsed(request);
+    string algorithm, source;
+    size_t k = 0;
+    if (!(parsed >> algorithm >> k)) return "ERR malformed request\n";
+    bool kdtree = algorithm == "kdtree";
+    // shards get the timeout as their deadline (less a margin for the answer to travel), so a search the coordinator gives up on
+    // also ends on its worker instead of holding it, and the requests queued behind it, past the timeout
+    double budget = 0.9 * options.timeoutMs;
+    if (!getline(parsed >> ws, source) || source.empty()) return "ERR malformed request\n";
+    if (source.rfind("within ", 0) == 0) {
+        istringstream within(source.substr(7));
+        double ms = -1.0;
+        if (!(within >> ms) || ms < 0.0 || !getline(within >> ws, source) || source.empty()) return "ERR malformed request\n";
+        budget = min(budget, ms);
+    }
+    ostringstream forwarded;
+    forwarded << algorithm << ' ' << k << " within " << budget << ' ' << source;
+    vector<vector<string>> answers = gather(forwarded.str(), true);
+    struct Row {
+        float score;
+        string name;
+        const string* line;
+    };
+    vector<Row> rows;
+    string error;
+    size_t answered = 0;
+    bool deadlineHit = false; // some shard answered with what it had settled by the request's deadline
+    ostringstream shardStats;
+    for (size_t s = 0; s < answers.size(); ++s) {
+        const vector<string>& answer = answers[s];
+        bool ok = !answer.empty() && answer[0].rfind("OK ", 0) == 0;
+        shardStats << (s > 0 ? ", " : "") << (ok ? answer.back().substr(6) : "null");
+        if (ok && answer.back().find("\"deadline_hit\": true") != string::npos) deadlineHit = true;
+        if (!ok) {
+            if (!answer.empty() && error.empty()) error = answer[0];
+            continue;
+        }
+        answered++;
+        for (size_t i = 1; i + 1 < answer.size(); ++i) rows.push_back({strtof(answer[i].c_str(), nullptr), field(answer[i], 3), &answer[i]});
+    }
+    if (answered == 0) return (error.empty() ? "ERR no shard answered" : error) + "\n";
+    // every shard's list is its own top k, the best k of all of them is the top k of the whole corpus
+    sort(rows.begin(), rows.end(), [kdtree](const Row& a, const Row& b) {
+        if (a.score != b.score) return kdtree ? a.score < b.score : a.score > b.score;
+        return a.name < b.name;
+    });
+    if (rows.size() > k) rows.resize(k);
+    out << "OK " << rows.size() << partialTag(answered, shards.size()) << '\n';
+    for (const Row& row : rows) out << *row.line << '\n';
+    string stats = queryStats.finish();
+    stats.pop_back(); // the closing brace, the shards' part goes in before it
+    out << "STATS " << stats << ", \"shards\": " << shards.size() << ", \"answered\": " << answered << ", \"partial\": "
+        << (answered < shards.size() ? "true" : "false") << ", \"deadline_hit\": " << (deadlineHit ? "true" : "false")
+        << ", \"shard_stats\": [" << shardStats.str() << "]}\n";
+    return out.str();
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "Sampling.h"
+#include <functional>
+
+/**
+ * Sharded serving on one machine: the corpus is split by model name (see Corpus::setShard) over worker processes, each pinned to
+ * a NUMA node or a set of cpus before it loads its models (so their memory is first touched, and allocated, there) and answering
+ * serve's protocol (see main.cpp) on a Unix socket; a coordinator sends every request to all of them and merges the answers
+ * a shard that doesn't answer a search within the timeout (slow, crashed, still loading) is left out of it and the answer is flagged
+ * partial; its connection is dropped, and its worker started again if it exited, so a later request finds it back
+ */
+bool pinToCpus(const string& cpus); // "node<n>" or a cpu list like "0-3,8", for the calling thread and every thread it starts later
+vector<string> shardCpuSets(size_t shards); // one per shard: whole NUMA nodes when there are enough, else the allowed cpus cut into even runs
+
+// accepts connections on a Unix socket at path and answers every line received with respond(line), a thread per connection
+// returns only if the socket can't be set up
+bool serveSocket(const string& path, const function<string(const string& request)>& respond);
+
+struct ShardOptions { // what the coordinator starts its workers with
+    string executable;      // similarity_search, run as: executable --shard corpus socket shard shards cpus candidates sampling [score_cache]
+    string corpus;          // directory or index file
+    size_t candidates = 256;
+    SampleOptions sampling;
+    string scoreCache;      // every shard keeps its own file, <scoreCache>.<shard>; empty for none
+    int timeoutMs = 2000;   // a search (or stats, models) a shard hasn't answered by then goes without it, a refresh waits;
+                            // searches reach the shards with 90% of it as their within deadline, so they end about in time
+};
+
+class ShardCoordinator {
+    struct Shard {
+        string socket, cpus;
+        int pid = -1;       // of the worker
+        int fd = -1;        // connection, -1 while there is none
+        string pending;     // received past the last complete line
+    };
+
+    ShardOptions options;
+    string directory;       // holds the workers' sockets
+    vector<Shard> shards;
+
+    bool spawn(Shard& shard, size_t s);
+    bool connectTo(Shard& shard);
+    void drop(Shard& shard, size_t s); // closes the connection, restarting the worker if it exited
+    // sends request to every shard and collects each one's answer, empty for shards that didn't answer (by the timeout when bounded)
+    vector<vector<string>> gather(const string& request, bool bounded);
+
+public:
+    ShardCoordinator() {};
+    ~ShardCoordinator() { stop(); };
+    ShardCoordinator(const ShardCoordinator&) = delete;
+    ShardCoordinator& operator=(const ShardCoordinator&) = delete;
+
+    bool start(const ShardOptions& options_, size_t shardCount); // returns once every worker loaded its part, false if one failed to
+    void stop();
+    size_t size() const { return shards.size(); };
+    const string& cpus(size_t s) const { return shards[s].cpus; };
+    size_t modelCount(); // over every shard that answers
+    // serve's protocol: search results merged best first, model lists merged, refresh reports summed and stats listed per shard
+    // answers missing a shard say so: OK <n> PARTIAL <answered>/<shards> and "partial": true in the json
+    string respond(const string& request);
+};
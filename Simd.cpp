@@ -0,0 +1,397 @@
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+    enum class Level { Scalar, SSE2, AVX2, AVX512 };
+    const char* LEVEL_NAMES[] = {"scalar", "sse2", "avx2", "avx512f"};
+
+    Level pickLevel() {
+        Level level = Level::Scalar;
+#ifdef SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) level = Level::AVX512;
+        else if (__builtin_cpu_supports("avx2")) level = Level::AVX2;
+        else if (__builtin_cpu_supports("sse2")) level = Level::SSE2;
+#endif
+        if (const char* cap = getenv("SIMILARITY_SIMD")) { // can only lower the level, never ask for instructions the cpu lacks
+            for (int i = 0; i < 4; ++i)
+                if (strcmp(cap, LEVEL_NAMES[i]) == 0 && static_cast<int>(level) > i) level = static_cast<Level>(i);
+        }
+        return level;
+    }
+
+    const Level LEVEL = pickLevel();
+
+    inline float squaredDistance(const float* xs, const float* ys, const float* zs, size_t i, float qx, float qy, float qz) {
+        float dx = xs[i] - qx, dy = ys[i] - qy, dz = zs[i] - qz;
+        return dx * dx + dy * dy + dz * dz;
+    }
+
+    void leafDistancesScalar(const float* xs, const float* ys, const float* zs, float qx, float qy, float qz, float* out) {
+        for (int i = 0; i < 8; ++i) out[i] = squaredDistance(xs, ys, zs, i, qx, qy, qz);
+    }
+
+    void quantizedLeafDistancesScalar(const uint16_t* xs, const uint16_t* ys, const uint16_t* zs, const float* origin, const float* step,
+                                      float qx, float qy, float qz, float* out) {
+        for (int i = 0; i < 8; ++i) {
+            float dx = (origin[0] + static_cast<float>(xs[i]) * step[0]) - qx;
+            float dy = (origin[1] + static_cast<float>(ys[i]) * step[1]) - qy;
+            float dz = (origin[2] + static_cast<float>(zs[i]) * step[2]) - qz;
+            out[i] = dx * dx + dy * dy + dz * dz;
+        }
+    }
+
+    void squaredDistancesScalar(const float* xs, const float* ys, const float* zs, size_t count, float qx, float qy, float qz, float* out) {
+        for (size_t i = 0; i < count; ++i) out[i] = squaredDistance(xs, ys, zs, i, qx, qy, qz);
+    }
+
+    size_t nearestPointScalar(const float* xs, const float* ys, const float* zs, size_t count, float qx, float qy, float qz, float* best) {
+        size_t index = 0;
+        float dist = squaredDistance(xs, ys, zs, 0, qx, qy, qz);
+        for (size_t i = 1; i < count; ++i) {
+            float d = squaredDistance(xs, ys, zs, i, qx, qy, qz);
+            if (d < dist) {
+                dist = d;
+                index = i;
+            }
+        }
+        *best = dist;
+        return index;
+    }
+
+    // the tail after the vector part, carrying on from the vector part's best (from < count)
+    size_t relaxTail(const float* xs, const float* ys, const float* zs, size_t from, size_t count, float qx, float qy, float qz,
+                     float* nearest, size_t index, float farthest) {
+        for (size_t i = from; i < count; ++i) {
+            float d = std::min(nearest[i], squaredDistance(xs, ys, zs, i, qx, qy, qz));
+            nearest[i] = d;
+            if (d > farthest) {
+                farthest = d;
+                index = i;
+            }
+        }
+        return index;
+    }
+
+    size_t relaxNearestScalar(const float* xs, const float* ys, const float* zs, size_t count, float qx, float qy, float qz, float* nearest) {
+        return relaxTail(xs, ys, zs, 0, count, qx, qy, qz, nearest, 0, -1.0f);
+    }
+
+    void pointBoundsScalar(const float* xs, const float* ys, const float* zs, size_t count, float* low, float* high) {
+        const float* axes[3] = {xs, ys, zs};
+        for (int axis = 0; axis < 3; ++axis) {
+            float a = axes[axis][0], b = axes[axis][0];
+            for (size_t i = 1; i < count; ++i) {
+                a = std::min(a, axes[axis][i]);
+                b = std::max(b, axes[axis][i]);
+            }
+            low[axis] = a;
+            high[axis] = b;
+        }
+    }
+
+    // best of the per lane winners: smallest (or largest) value, lowest index among equal values
+    template <bool largest>
+    void reduceLanes(const float* values, const uint32_t* indices, int lanes, float& value, size_t& index) {
+        value = values[0];
+        index = indices[0];
+        for (int lane = 1; lane < lanes; ++lane) {
+            bool better = largest ? values[lane] > value : values[lane] < value;
+            if (better || (values[lane] == value && indices[lane] < index)) {
+                value = values[lane];
+                index = indices[lane];
+            }
+        }
+    }
+
+#ifdef SIMD_X86
+    __attribute__((target("sse2")))
+    void leafDistancesSSE2(const float* xs, const float* ys, const float* zs, float qx, float qy, float qz, float* out) {
+        __m128 x = _mm_set1_ps(qx), y = _mm_set1_ps(qy), z = _mm_set1_ps(qz);
+        for (int i = 0; i < 8; i += 4) {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(xs + i), x);
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(ys + i), y);
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(zs + i), z);
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        }
+    }
+
+    __attribute__((target("sse2")))
+    inline __m128 decode4(const uint16_t* codes, float origin, float step) { // 4 codes widened to floats, then origin + code * step
+        __m128i wide = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(codes)), _mm_setzero_si128());
+        return _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(step)));
+    }
+
+    __attribute__((target("sse2")))
+    void quantizedLeafDistancesSSE2(const uint16_t* xs, const uint16_t* ys, const uint16_t* zs, const float* origin, const float* step,
+                                    float qx, float qy, float qz, float* out) {
+        __m128 x = _mm_set1_ps(qx), y = _mm_set1_ps(qy), z = _mm_set1_ps(qz);
+        for (int i = 0; i < 8; i += 4) {
+            __m128 dx = _mm_sub_ps(decode4(xs + i, origin[0], step[0]), x);
+            __m128 dy = _mm_sub_ps(decode4(ys + i, origin[1], step[1]), y);
+            __m128 dz = _mm_sub_ps(decode4(zs + i, origin[2], step[2]), z);
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        }
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256 distances8(const float* xs, const float* ys, const float* zs, __m256 x, __m256 y, __m256 z) {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs), x);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys), y);
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(zs), z);
+        // same operation order as the scalar kernel so every path returns identical distances
+        return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+    }
+
+    __attribute__((target("avx2")))
+    void leafDistancesAVX2(const float* xs, const float* ys, const float* zs, float qx, float qy, float qz, float* out) {
+        _mm256_storeu_ps(out, distances8(xs, ys, zs, _mm256_set1_ps(qx), _mm256_set1_ps(qy), _mm256_set1_ps(qz)));
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256 decode8(const uint16_t* codes, float origin, float step) {
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(codes)));
+        return _mm256_add_ps(_mm256_set1_ps(origin), _mm256_mul_ps(_mm256_cvtepi32_ps(wide), _mm256_set1_ps(step)));
+    }
+
+    __attribute__((target("avx2")))
+    void quantizedLeafDistancesAVX2(const uint16_t* xs, const uint16_t* ys, const uint16_t* zs, const float* origin, const float* step,
+                                    float qx, float qy, float qz, float* out) {
+        __m256 dx = _mm256_sub_ps(decode8(xs, origin[0], step[0]), _mm256_set1_ps(qx));
+        __m256 dy = _mm256_sub_ps(decode8(ys, origin[1], step[1]), _mm256_set1_ps(qy));
+        __m256 dz = _mm256_sub_ps(decode8(zs, origin[2], step[2]), _mm256_set1_ps(qz));
+        _mm256_storeu_ps(out, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz)));
+    }
+
+    __attribute__((target("avx2")))
+    void squaredDistancesAVX2(const float* xs, const float* ys, const float* zs, size_t count, float qx, float qy, float qz, float* out) {
+        __m256 x = _mm256_set1_ps(qx), y = _mm256_set1_ps(qy), z = _mm256_set1_ps(qz);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) _mm256_storeu_ps(out + i, distances8(xs + i, ys + i, zs + i, x, y, z));
+        squaredDistancesScalar(xs + i, ys + i, zs + i, count - i, qx, qy, qz, out + i);
+    }
+
+    __attribute__((target("avx2")))
+    size_t nearestPointAVX2(const float* xs, const float* ys, const float* zs, size_t count, float qx, float qy, float qz, float* best) {
+        if (count < 8) return nearestPointScalar(xs, ys, zs, count, qx, qy, qz, best);
+        __m256 x = _mm256_set1_ps(qx), y = _mm256_set1_ps(qy), z = _mm256_set1_ps(qz);
+        __m256 bestDist = _mm256_set1_ps(INFINITY);
+        __m256i bestIndex = _mm256_setzero_si256(), index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), step = _mm256_set1_epi32(8);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) { // per lane running minimum, strictly smaller so each lane keeps its first minimum
+            __m256 d = distances8(xs + i, ys + i, zs + i, x, y, z);
+            __m256 closer = _mm256_cmp_ps(d, bestDist, _CMP_LT_OQ);
+            bestDist = _mm256_blendv_ps(bestDist, d, closer);
+            bestIndex = _mm256_blendv_epi8(bestIndex, index, _mm256_castps_si256(closer));
+            index = _mm256_add_epi32(index, step);
+        }
+        alignas(32) float values[8];
+        alignas(32) uint32_t indices[8];
+        _mm256_store_ps(values, bestDist);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(indices), bestIndex);
+        float dist;
+        size_t result;
+        reduceLanes<false>(values, indices, 8, dist, result);
+        for (; i < count; ++i) {
+            float d = squaredDistance(xs, ys, zs, i, qx, qy, qz);
+            if (d < dist) {
+                dist = d;
+                result = i;
+            }
+        }
+        *best = dist;
+        return result;
+    }
+
+    __attribute__((target("avx2")))
+    size_t relaxNearestAVX2(const float* xs, const float* ys, const float* zs, size_t count, float qx, float qy, float qz, float* nearest) {
+        if (count < 8) return relaxNearestScalar(xs, ys, zs, count, qx, qy, qz, nearest);
+        __m256 x = _mm256_set1_ps(qx), y = _mm256_set1_ps(qy), z = _mm256_set1_ps(qz);
+        __m256 farthest = _mm256_set1_ps(-1.0f);
+        __m256i farthestIndex = _mm256_setzero_si256(), index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), step = _mm256_set1_epi32(8);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            // min(d, nearest) picks nearest unless d is strictly smaller, like min(nearest[i], d) in the scalar kernel
+            __m256 d = _mm256_min_ps(distances8(xs + i, ys + i, zs + i, x, y, z), _mm256_loadu_ps(nearest + i));
+            _mm256_storeu_ps(nearest + i, d);
+            __m256 farther = _mm256_cmp_ps(d, farthest, _CMP_GT_OQ);
+            farthest = _mm256_blendv_ps(farthest, d, farther);
+            farthestIndex = _mm256_blendv_epi8(farthestIndex, index, _mm256_castps_si256(farther));
+            index = _mm256_add_epi32(index, step);
+        }
+        alignas(32) float values[8];
+        alignas(32) uint32_t indices[8];
+        _mm256_store_ps(values, farthest);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(indices), farthestIndex);
+        float value;
+        size_t result;
+        reduceLanes<true>(values, indices, 8, value, result);
+        return relaxTail(xs, ys, zs, i, count, qx, qy, qz, nearest, result, value);
+    }
+
+    __attribute__((target("avx2")))
+    void pointBoundsAVX2(const float* xs, const float* ys, const float* zs, size_t count, float* low, float* high) {
+        if (count < 8) return pointBoundsScalar(xs, ys, zs, count, low, high);
+        const float* axes[3] = {xs, ys, zs};
+        for (int axis = 0; axis < 3; ++axis) {
+            const float* v = axes[axis];
+            __m256 a = _mm256_loadu_ps(v), b = a;
+            size_t i = 8;
+            for (; i + 8 <= count; i += 8) {
+                __m256 values = _mm256_loadu_ps(v + i);
+                a = _mm256_min_ps(a, values);
+                b = _mm256_max_ps(b, values);
+            }
+            alignas(32) float lows[8], highs[8];
+            _mm256_store_ps(lows, a);
+            _mm256_store_ps(highs, b);
+            float lowest = lows[0], highest = highs[0];
+            for (int lane = 1; lane < 8; ++lane) {
+                lowest = std::min(lowest, lows[lane]);
+                highest = std::max(highest, highs[lane]);
+            }
+            for (; i < count; ++i) {
+                lowest = std::min(lowest, v[i]);
+                highest = std::max(highest, v[i]);
+            }
+            low[axis] = lowest;
+            high[axis] = highest;
+        }
+    }
+
+    // avx512f: 16 lanes, the tail is handled with masked loads instead of a scalar loop
+    __attribute__((target("avx512f")))
+    inline __m512 distances16(const float* xs, const float* ys, const float* zs, __mmask16 mask, __m512 x, __m512 y, __m512 z) {
+        __m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, xs), x);
+        __m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, ys), y);
+        __m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, zs), z);
+        return _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)), _mm512_mul_ps(dz, dz));
+    }
+
+    inline __mmask16 laneMask(size_t remaining) { return remaining >= 16 ? 0xffff : static_cast<__mmask16>((1u << remaining) - 1); }
+
+    __attribute__((target("avx512f")))
+    void squaredDistancesAVX512(const float* xs, const float* ys, const float* zs, size_t count, float qx, float qy, float qz, float* out) {
+        __m512 x = _mm512_set1_ps(qx), y = _mm512_set1_ps(qy), z = _mm512_set1_ps(qz);
+        for (size_t i = 0; i < count; i += 16) {
+            __mmask16 mask = laneMask(count - i);
+            _mm512_mask_storeu_ps(out + i, mask, distances16(xs + i, ys + i, zs + i, mask, x, y, z));
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    size_t nearestPointAVX512(const float* xs, const float* ys, const float* zs, size_t count, float qx, float qy, float qz, float* best) {
+        __m512 x = _mm512_set1_ps(qx), y = _mm512_set1_ps(qy), z = _mm512_set1_ps(qz);
+        __m512 bestDist = _mm512_set1_ps(INFINITY);
+        __m512i bestIndex = _mm512_setzero_si512(), step = _mm512_set1_epi32(16);
+        __m512i index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        for (size_t i = 0; i < count; i += 16) {
+            __mmask16 mask = laneMask(count - i);
+            __m512 d = distances16(xs + i, ys + i, zs + i, mask, x, y, z);
+            __mmask16 closer = _mm512_mask_cmp_ps_mask(mask, d, bestDist, _CMP_LT_OQ);
+            bestDist = _mm512_mask_blend_ps(closer, bestDist, d);
+            bestIndex = _mm512_mask_blend_epi32(closer, bestIndex, index);
+            index = _mm512_add_epi32(index, step);
+        }
+        alignas(64) float values[16];
+        alignas(64) uint32_t indices[16];
+        _mm512_store_ps(values, bestDist);
+        _mm512_store_si512(indices, bestIndex);
+        size_t result;
+        reduceLanes<false>(values, indices, static_cast<int>(count < 16 ? count : 16), *best, result);
+        return result;
+    }
+
+    __attribute__((target("avx512f")))
+    size_t relaxNearestAVX512(const float* xs, const float* ys, const float* zs, size_t count, float qx, float qy, float qz, float* nearest) {
+        __m512 x = _mm512_set1_ps(qx), y = _mm512_set1_ps(qy), z = _mm512_set1_ps(qz);
+        __m512 farthest = _mm512_set1_ps(-1.0f);
+        __m512i farthestIndex = _mm512_setzero_si512(), step = _mm512_set1_epi32(16);
+        __m512i index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        for (size_t i = 0; i < count; i += 16) {
+            __mmask16 mask = laneMask(count - i);
+            __m512 d = _mm512_min_ps(distances16(xs + i, ys + i, zs + i, mask, x, y, z), _mm512_maskz_loadu_ps(mask, nearest + i));
+            _mm512_mask_storeu_ps(nearest + i, mask, d);
+            __mmask16 farther = _mm512_mask_cmp_ps_mask(mask, d, farthest, _CMP_GT_OQ);
+            farthest = _mm512_mask_blend_ps(farther, farthest, d);
+            farthestIndex = _mm512_mask_blend_epi32(farther, farthestIndex, index);
+            index = _mm512_add_epi32(index, step);
+        }
+        alignas(64) float values[16];
+        alignas(64) uint32_t indices[16];
+        _mm512_store_ps(values, farthest);
+        _mm512_store_si512(indices, farthestIndex);
+        float value;
+        size_t result;
+        reduceLanes<true>(values, indices, static_cast<int>(count < 16 ? count : 16), value, result);
+        return result;
+    }
+
+    __attribute__((target("avx512f")))
+    void pointBoundsAVX512(const float* xs, const float* ys, const float* zs, size_t count, float* low, float* high) {
+        const float* axes[3] = {xs, ys, zs};
+        for (int axis = 0; axis < 3; ++axis) {
+            const float* v = axes[axis];
+            __m512 a = _mm512_set1_ps(v[0]), b = a; // masked off lanes load the first value, which never changes the result
+            for (size_t i = 0; i < count; i += 16) {
+                __m512 values = _mm512_mask_loadu_ps(a, laneMask(count - i), v + i);
+                a = _mm512_min_ps(a, values);
+                b = _mm512_max_ps(b, values);
+            }
+            low[axis] = _mm512_reduce_min_ps(a);
+            high[axis] = _mm512_reduce_max_ps(b);
+        }
+    }
+#endif
+
+    template <typename Kernel>
+    Kernel pick(Kernel scalar, [[maybe_unused]] Kernel avx2, [[maybe_unused]] Kernel avx512) {
+#ifdef SIMD_X86
+        if (LEVEL == Level::AVX512) return avx512;
+        if (LEVEL == Level::AVX2) return avx2;
+#endif
+        return scalar;
+    }
+
+    LeafKernel pickLeafKernel() { // a bucket is 8 points, avx512 has nothing to add
+#ifdef SIMD_X86
+        if (LEVEL >= Level::AVX2) return leafDistancesAVX2;
+        if (LEVEL == Level::SSE2) return leafDistancesSSE2;
+#endif
+        return leafDistancesScalar;
+    }
+
+    QuantizedLeafKernel pickQuantizedLeafKernel() {
+#ifdef SIMD_X86
+        if (LEVEL >= Level::AVX2) return quantizedLeafDistancesAVX2;
+        if (LEVEL == Level::SSE2) return quantizedLeafDistancesSSE2;
+#endif
+        return quantizedLeafDistancesScalar;
+    }
+}
+
+#ifdef SIMD_X86
+#define SIMD_KERNELS(name) pick<decltype(&name##Scalar)>(name##Scalar, name##AVX2, name##AVX512)
+#else
+#define SIMD_KERNELS(name) name##Scalar
+#endif
+
+const LeafKernel leafDistances = pickLeafKernel();
+const QuantizedLeafKernel quantizedLeafDistances = pickQuantizedLeafKernel();
+const DistanceKernel squaredDistances = SIMD_KERNELS(squaredDistances);
+const NearestKernel nearestPoint = SIMD_KERNELS(nearestPoint);
+const RelaxKernel relaxNearest = SIMD_KERNELS(relaxNearest);
+const BoundsKernel pointBounds = SIMD_KERNELS(pointBounds);
+
+const char* simdLevel() {
+    return LEVEL_NAMES[static_cast<int>(LEVEL)];
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Distance kernels over points stored as separate x, y, z arrays
+ * the best implementation the cpu supports (avx512f, avx2, sse2 or plain C++) is picked once at startup, SIMILARITY_SIMD=scalar,
+ * sse2 or avx2 in the environment caps it (to compare paths); every path does the same float operations in the same order
+ * (no fused multiply-add), so they all return identical distances and break ties the same way
+ */
+// squared distances from (qx, qy, qz) to 8 consecutive points, i.e. one full kd tree leaf bucket (the arrays must be readable that far)
+using LeafKernel = void (*)(const float* xs, const float* ys, const float* zs, float qx, float qy, float qz, float* out);
+extern const LeafKernel leafDistances;
+// the same over 16 bit codes, each coordinate decoded as origin + code * step before the distance (see Quantized.h)
+using QuantizedLeafKernel = void (*)(const uint16_t* xs, const uint16_t* ys, const uint16_t* zs, const float* origin, const float* step,
+                                     float qx, float qy, float qz, float* out);
+extern const QuantizedLeafKernel quantizedLeafDistances;
+
+// one to many kernels over count points, only the first count entries of each array are read
+// squared distances from (qx, qy, qz) to every point
+using DistanceKernel = void (*)(const float* xs, const float* ys, const float* zs, size_t count, float qx, float qy, float qz, float* out);
+extern const DistanceKernel squaredDistances;
+// index of the point closest to (qx, qy, qz), the lowest one on ties, its squared distance goes to *best (count > 0)
+using NearestKernel = size_t (*)(const float* xs, const float* ys, const float* zs, size_t count, float qx, float qy, float qz, float* best);
+extern const NearestKernel nearestPoint;
+// one farthest point sampling step: nearest[i] = min(nearest[i], squared distance of point i to (qx, qy, qz)),
+// returns the index of the largest nearest[i] afterwards, the lowest one on ties (count > 0)
+using RelaxKernel = size_t (*)(const float* xs, const float* ys, const float* zs, size_t count, float qx, float qy, float qz, float* nearest);
+extern const RelaxKernel relaxNearest;
+// smallest and largest coordinate along each axis, low and high get 3 floats each (count > 0)
+using BoundsKernel = void (*)(const float* xs, const float* ys, const float* zs, size_t count, float* low, float* high);
+extern const BoundsKernel pointBounds;
+
+const char* simdLevel(); // name of the picked implementation, for benchmarks
@@ -0,0 +1,77 @@
+#include "Similarity.h"
+
+float KD_TOLERANCE = 0.1; // Tolerance for point distance
+float OCT_TOLERANCE = 0.1; // Cells whose centroids are closer than tolerance share their points
+
+float OCT_THRESHOLD = 65; // Similarity threshold percentage, results with higher percentage are more similar
+
+float hausdorff(const KDTree<>& treeA, const KDTree<>& treeB, float bound, ThreadPool& pool, Deadline deadline, bool* unfinished) {
+    const size_t CHUNK = 256; // queries per task, small enough that a cancelled comparison stops quickly
+    vector<Point> dataA = treeA.traverse(), dataB = treeB.traverse();
+    size_t chunksA = (dataA.size() + CHUNK - 1) / CHUNK, chunksB = (dataB.size() + CHUNK - 1) / CHUNK;
+    vector<float> chunkMax(chunksA + chunksB, 0.0f);
+    atomic<bool> exceeded(false), late(false);
+    bool timed = deadline != NO_DEADLINE;
+    // tasks of both directions share one loop so a dissimilar region is found whichever side it is on
+    pool.parallelFor(chunksA + chunksB, [&](size_t chunk) {
+        bool fromA = chunk < chunksA;
+        const vector<Point>& queries = fromA ? dataA : dataB;
+        const KDTree<>& other = fromA ? treeB : treeA;
+        size_t begin = (fromA ? chunk : chunk - chunksA) * CHUNK, end = std::min(begin + CHUNK, queries.size());
+        const size_t BATCH = 32; // queries per batched knn call between cancellation checks
+        Point nearest[BATCH];
+        float dist[BATCH];
+        float worst = 0.0f;
+        for (size_t i = begin; i < end; i += BATCH) {
+            if (exceeded.load(memory_order_relaxed)) return;
+            if (timed && (late.load(memory_order_relaxed) || chrono::steady_clock::now() >= deadline)) {
+                late.store(true, memory_order_relaxed);
+                break; // what this chunk got to still counts towards the lower bound
+            }
+            size_t count = std::min(BATCH, end - i);
+            other.knn(span<const Point>(queries.data() + i, count), 1, span<Point>(nearest, count), span<float>(dist, count));
+            for (size_t j = 0; j < count; ++j) worst = std::max(worst, dist[j]);
+            if (worst > bound) {
+                exceeded.store(true, memory_order_relaxed);
+                return;
+            }
+        }
+        chunkMax[chunk] = worst;
+    });
+    if (unfinished) *unfinished = late && !exceeded;
+    if (exceeded) {
+        countStat(Counter::KDEarlyExits, 1);
+        return INFINITY;
+    }
+    float result = 0.0f;
+    for (float worst : chunkMax) result = std::max(result, worst);
+    return result;
+}
+
+float KDTreeScore(const KDTree<>& treeA, const KDTree<>& treeB, float bound) {
+    return hausdorff(treeA, treeB, bound);
+}
+
+float OctTreeScore(const Octree& treeA, const Octree& treeB, float floor) {
+    return Octree::similarityOctree(treeA, treeB, OCT_TOLERANCE, floor);
+}
+
+bool KDTreeComparison(KDTree<>& treeA, KDTree<>& treeB) {
+    return hausdorff(treeA, treeB, KD_TOLERANCE) <= KD_TOLERANCE; // bounded, so dissimilar pairs stop early
+}
+
+bool OctTreeComparison(const Octree& treeA, const Octree& treeB) {
+    return Octree::compareOctree(treeA, treeB, OCT_TOLERANCE, OCT_THRESHOLD);
+}
+
+KDTree<> fillKD(const std::vector<Point>& vertices) {
+    KDTree<> tree;
+    tree.build(vertices); // one balanced bulk build instead of inserting in file order
+    return tree;
+}
+
+Octree fillOct(const std::vector<Point>& vertices) {
+    Octree tree;
+    tree.build(vertices); // Morton sort and one pass over the sorted codes, the root cube is fitted to the vertices
+    return tree;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "Octree.h"
+#include "KDTree.h"
+#include "ThreadPool.h"
+#include <chrono>
+
+// Variables that are used for tree comparisons
+extern float KD_TOLERANCE;  // Tolerance for point distance
+extern float OCT_TOLERANCE; // Cells whose centroids are closer than tolerance share their points
+extern float OCT_THRESHOLD; // Similarity threshold percentage, results with higher percentage are more similar
+
+using Deadline = chrono::steady_clock::time_point;
+const Deadline NO_DEADLINE = Deadline::max();
+
+// symmetric Hausdorff distance (squared) with both directions split across the pool
+// stops every thread as soon as one nearest neighbor distance exceeds bound and then returns infinity
+// once deadline passes every thread stops as well and the largest distance met so far, a lower bound of the whole one, is
+// returned with *unfinished set
+float hausdorff(const KDTree<>& treeA, const KDTree<>& treeB, float bound = INFINITY, ThreadPool& pool = ThreadPool::shared(),
+                Deadline deadline = NO_DEADLINE, bool* unfinished = nullptr);
+float KDTreeScore(const KDTree<>& treeA, const KDTree<>& treeB, float bound = INFINITY); // symmetric Hausdorff distance (squared), lower is more similar, infinity once above bound
+float OctTreeScore(const Octree& treeA, const Octree& treeB, float floor = 0.0f);  // occupancy similarity percentage, higher is more similar (see similarityOctree for floor)
+bool KDTreeComparison(KDTree<>& treeA, KDTree<>& treeB);
+bool OctTreeComparison(const Octree& treeA, const Octree& treeB);
+
+KDTree<> fillKD(const vector<Point>& vertices);
+Octree fillOct(const vector<Point>& vertices);
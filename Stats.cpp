@@ -0,0 +1,182 @@
+#include "Stats.h"
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <sstream>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace {
+    const size_t MAX_SLOTS = 256;   // threads alive at once, any beyond share the last slot and may lose a few counts
+    const int BUCKETS = 64;         // log2 buckets, bucket b holds values in [2^(b-1), 2^b)
+
+    StatsSlot slots[MAX_SLOTS];
+    bool slotUsed[MAX_SLOTS];
+    uint64_t retired[COUNTERS];     // totals of threads that have exited
+    mutex slotLock;                 // claiming, releasing and summing slots, never taken while counting
+
+    const char* NAMES[COUNTERS] = {
+        "parse_us", "normalize_us", "build_us", "prefilter_us", "compare_us",
+        "kd_nodes_visited", "kd_leaves_scanned", "kd_subtrees_pruned", "kd_early_exits",
+        "oct_cells_compared", "oct_early_exits",
+        "score_cache_hits", "score_cache_misses",
+        "allocations", "allocated_bytes",
+    };
+
+    bool isTimer(size_t counter) { return counter <= static_cast<size_t>(Counter::CompareNanos); }
+
+    struct SlotRelease { // folds an exiting thread's slot into the retired totals so it can be reused
+        ~SlotRelease() {
+            StatsSlot* slot = threadStatsSlot;
+            threadStatsSlot = nullptr;
+            if (slot == nullptr || slot == &slots[MAX_SLOTS - 1]) return;
+            lock_guard<mutex> guard(slotLock);
+            for (size_t i = 0; i < COUNTERS; ++i) {
+                retired[i] += slot->values[i].load(memory_order_relaxed);
+                slot->values[i].store(0, memory_order_relaxed);
+            }
+            slotUsed[slot - slots] = false;
+        };
+    };
+
+    struct Histogram {
+        uint64_t count = 0, sum = 0, max = 0;
+        uint64_t buckets[BUCKETS] = {};
+
+        void add(uint64_t value) {
+            int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+            buckets[min(bucket, BUCKETS - 1)]++;
+            count++;
+            sum += value;
+            max = std::max(max, value);
+        };
+        void print(ostream& out) const { // non-empty buckets as [upper bound, count]
+            out << "{\"sum\": " << sum << ", \"max\": " << max << ", \"buckets\": [";
+            bool first = true;
+            for (int b = 0; b < BUCKETS; ++b) {
+                if (buckets[b] == 0) continue;
+                out << (first ? "" : ", ") << "[" << (b == 0 ? 0 : (1ULL << b) - 1) << ", " << buckets[b] << "]";
+                first = false;
+            }
+            out << "]}";
+        };
+    };
+
+    mutex histogramLock;
+    uint64_t queries = 0;
+    Histogram wallHistogram, rssGrowthHistogram, counterHistograms[COUNTERS];
+
+    uint64_t reported(const StatsSnapshot& delta, size_t counter) { return isTimer(counter) ? delta.values[counter] / 1000 : delta.values[counter]; }
+}
+
+thread_local StatsSlot* threadStatsSlot = nullptr;
+
+StatsSlot* claimStatsSlot() {
+    StatsSlot* slot = &slots[MAX_SLOTS - 1];
+    {
+        lock_guard<mutex> guard(slotLock);
+        for (size_t i = 0; i + 1 < MAX_SLOTS; ++i) {
+            if (!slotUsed[i]) {
+                slotUsed[i] = true;
+                slot = &slots[i];
+                break;
+            }
+        }
+    }
+    threadStatsSlot = slot;
+    thread_local SlotRelease release; // registered on first use, runs when the thread exits
+    (void)release;
+    return slot;
+}
+
+const char* counterName(Counter counter) {
+    return NAMES[static_cast<size_t>(counter)];
+}
+
+StatsSnapshot statsSnapshot() {
+    StatsSnapshot snapshot;
+#if SIMILARITY_STATS
+    lock_guard<mutex> guard(slotLock);
+    for (size_t i = 0; i < COUNTERS; ++i) {
+        snapshot.values[i] = retired[i];
+        for (const StatsSlot& slot : slots) snapshot.values[i] += slot.values[i].load(memory_order_relaxed);
+    }
+#endif
+    return snapshot;
+}
+
+size_t peakRSSBytes() {
+#ifdef _WIN32
+    return 0;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return static_cast<size_t>(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+}
+
+string QueryStats::finish() {
+    uint64_t wall = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    StatsSnapshot delta = statsSnapshot();
+    for (size_t i = 0; i < COUNTERS; ++i) delta.values[i] -= before.values[i];
+    size_t rss = peakRSSBytes();
+    size_t growth = rss > rssBefore ? rss - rssBefore : 0;
+
+    ostringstream out;
+    out << "{\"enabled\": " << (SIMILARITY_STATS ? "true" : "false") << ", \"wall_us\": " << wall;
+    for (size_t i = 0; i < COUNTERS; ++i) out << ", \"" << NAMES[i] << "\": " << reported(delta, i);
+    out << ", \"peak_rss_kb\": " << rss / 1024 << ", \"peak_rss_growth_kb\": " << growth / 1024 << "}";
+
+    lock_guard<mutex> guard(histogramLock);
+    queries++;
+    wallHistogram.add(wall);
+    rssGrowthHistogram.add(growth / 1024);
+    for (size_t i = 0; i < COUNTERS; ++i) counterHistograms[i].add(reported(delta, i));
+    return out.str();
+}
+
+string statsHistograms() {
+    lock_guard<mutex> guard(histogramLock);
+    ostringstream out;
+    out << "{\"enabled\": " << (SIMILARITY_STATS ? "true" : "false") << ", \"queries\": " << queries << ", \"wall_us\": ";
+    wallHistogram.print(out);
+    for (size_t i = 0; i < COUNTERS; ++i) {
+        out << ", \"" << NAMES[i] << "\": ";
+        counterHistograms[i].print(out);
+    }
+    out << ", \"peak_rss_growth_kb\": ";
+    rssGrowthHistogram.print(out);
+    out << ", \"peak_rss_kb\": " << peakRSSBytes() / 1024 << "}";
+    return out.str();
+}
+
+#if SIMILARITY_ALLOCATION_STATS
+// every allocation in the process goes through here (all of the unaligned forms, so new and delete always pair up),
+// nested allocations (a thread's first slot claim) aren't counted
+namespace {
+    thread_local bool countingAllocation = false;
+
+    void countAllocation(size_t size) {
+        if (countingAllocation) return;
+        countingAllocation = true;
+        countStat(Counter::Allocations, 1);
+        countStat(Counter::AllocatedBytes, size);
+        countingAllocation = false;
+    }
+}
+
+void* operator new(size_t size) {
+    countAllocation(size);
+    if (void* memory = malloc(size > 0 ? size : 1)) return memory;
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const nothrow_t&) noexcept { countAllocation(size); return malloc(size > 0 ? size : 1); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { countAllocation(size); return malloc(size > 0 ? size : 1); }
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { free(memory); }
+void operator delete[](void* memory) noexcept { free(memory); }
+void operator delete[](void* memory, size_t) noexcept { free(memory); }
+#endif
@@ -0,0 +1,100 @@
+#pragma once
+#include "generic.h"
+#include <atomic>
+#include <chrono>
+
+#ifndef SIMILARITY_STATS
+#define SIMILARITY_STATS 1 // build with -DSIMILARITY_STATS=0 to compile every timer and counter out of the hot paths
+#endif
+#ifndef SIMILARITY_ALLOCATION_STATS
+#define SIMILARITY_ALLOCATION_STATS SIMILARITY_STATS // counting allocations replaces operator new, which a library must not do to its host
+#endif
+
+/**
+ * Engine instrumentation: stage timers and algorithm counters, summed into one slot per thread (no locks, no shared cache lines)
+ * a query's stats are the difference of two snapshots taken around it, exact as long as queries don't overlap (the server
+ * answers one at a time); every finished query is also added to process wide log2 histograms
+ * hot loops count into a LocalCounter on the stack, which adds to the thread's slot once when it goes out of scope
+ */
+enum class Counter : uint32_t {
+    ParseNanos, NormalizeNanos, BuildNanos, PrefilterNanos, CompareNanos, // stage timers
+    KDNodesVisited, KDLeavesScanned, KDSubtreesPruned, KDEarlyExits,       // nearest neighbor searches and Hausdorff comparisons
+    OctCellsCompared, OctEarlyExits,                                        // occupancy comparisons
+    ScoreCacheHits, ScoreCacheMisses,                                       // pairs settled by the score cache, pairs compared
+    Allocations, AllocatedBytes,                                            // operator new calls
+    Count
+};
+const size_t COUNTERS = static_cast<size_t>(Counter::Count);
+const char* counterName(Counter counter); // snake case, as it appears in the JSON
+
+struct StatsSlot { // one thread's running totals, only ever written by that thread
+    alignas(64) atomic<uint64_t> values[COUNTERS];
+};
+StatsSlot* claimStatsSlot();
+extern thread_local StatsSlot* threadStatsSlot;
+
+inline void countStat(Counter counter, uint64_t amount) {
+#if SIMILARITY_STATS
+    if (threadStatsSlot == nullptr) threadStatsSlot = claimStatsSlot();
+    atomic<uint64_t>& value = threadStatsSlot->values[static_cast<size_t>(counter)];
+    value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed); // single writer, a plain add is enough
+#else
+    (void)counter;
+    (void)amount;
+#endif
+}
+
+class LocalCounter {
+#if SIMILARITY_STATS
+    Counter counter;
+    uint64_t value = 0;
+
+public:
+    explicit LocalCounter(Counter counter_) : counter(counter_) {};
+    ~LocalCounter() { if (value > 0) countStat(counter, value); };
+    void operator++() { ++value; };
+    void operator+=(uint64_t amount) { value += amount; };
+#else
+public:
+    explicit LocalCounter(Counter) {};
+    void operator++() {};
+    void operator+=(uint64_t) {};
+#endif
+    LocalCounter(const LocalCounter&) = delete;
+    LocalCounter& operator=(const LocalCounter&) = delete;
+};
+
+class ScopedTimer { // charges its lifetime to a stage timer
+#if SIMILARITY_STATS
+    Counter counter;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+public:
+    explicit ScopedTimer(Counter counter_) : counter(counter_) {};
+    ~ScopedTimer() { countStat(counter, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count()); };
+#else
+public:
+    explicit ScopedTimer(Counter) {};
+#endif
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+struct StatsSnapshot {
+    uint64_t values[COUNTERS] = {};
+    uint64_t operator[](Counter counter) const { return values[static_cast<size_t>(counter)]; };
+};
+StatsSnapshot statsSnapshot(); // every thread's totals summed, all zero when compiled out
+size_t peakRSSBytes();         // of the whole process so far, 0 where the platform doesn't say
+
+class QueryStats { // started on construction, finish() once the response is ready
+    StatsSnapshot before;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    size_t rssBefore;
+
+public:
+    QueryStats() : before(statsSnapshot()), rssBefore(peakRSSBytes()) {};
+    string finish(); // one line JSON object of this query's timers and counters, also added to the histograms
+};
+
+string statsHistograms(); // one line JSON object: per query histogram of every finished query's wall time, timers and counters
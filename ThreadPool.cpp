@@ -0,0 +1,76 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+ThreadPool::ThreadPool(size_t threads) {
+    for (size_t i = 1; i < threads; ++i) // the caller is the last thread
+        workers.emplace_back([this] { workerLoop(); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void ThreadPool::drain(const std::function<void(size_t)>* body, size_t count) {
+    for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1))
+        (*body)(i);
+}
+
+void ThreadPool::workerLoop() {
+    unsigned long long seen = 0;
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [&] { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+        // take the job under the lock so a late wake up never mixes two jobs
+        const std::function<void(size_t)>* body = job;
+        size_t count = jobCount;
+        active++;
+        guard.unlock();
+        if (body) drain(body, count);
+        guard.lock();
+        if (--active == 0) done.notify_all();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body) {
+    if (workers.empty() || count <= 1) {
+        for (size_t i = 0; i < count; ++i) body(i);
+        return;
+    }
+    std::lock_guard<std::mutex> caller(callerLock);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        job = &body;
+        jobCount = count;
+        next = 0;
+        generation++;
+    }
+    wake.notify_all();
+    drain(&body, count);
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [&] { return active == 0; }); // every index is claimed, wait for the ones still running
+    job = nullptr;
+    jobCount = 0;
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+size_t ThreadPool::cores() {
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) return std::max(1, CPU_COUNT(&set));
+#endif
+    return std::max(1u, std::thread::hardware_concurrency());
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool { // fixed set of workers running one parallel loop at a time, the calling thread helps out
+    std::vector<std::thread> workers;
+    std::mutex lock;                        // guards everything below except next
+    std::mutex callerLock;                  // one parallelFor at a time
+    std::condition_variable wake, done;
+    const std::function<void(size_t)>* job = nullptr;
+    size_t jobCount = 0;
+    std::atomic<size_t> next{0};            // next loop index to hand out
+    size_t active = 0;                      // workers still inside the current job
+    unsigned long long generation = 0;      // bumped for every job so sleeping workers notice it
+    bool stopping = false;
+
+    void workerLoop();
+    void drain(const std::function<void(size_t)>* body, size_t count); // claim indices until none are left
+
+public:
+    explicit ThreadPool(size_t threads = cores());
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    size_t size() const { return workers.size() + 1; };
+    void parallelFor(size_t count, const std::function<void(size_t)>& body); // body(i) for every i < count, returns once all are done
+    static ThreadPool& shared(); // sized to the machine, created on first use
+    static size_t cores(); // cpus this process may run on (its affinity mask, so a pinned shard sizes itself to its cpu set), at least 1
+};
@@ -1,16 +1,24 @@
 from fastapi import FastAPI, HTTPException, Response
+from fastapi.concurrency import run_in_threadpool
 from fastapi.middleware.cors import CORSMiddleware
 # from fastapi.staticfiles import StaticFiles  # Not needed - removed static file serving
 from pydantic import BaseModel
 import json
 import os
 import subprocess
+import sys
+import threading
 import time
-from typing import List, Dict, Any
+from typing import List, Dict, Any, Optional, Tuple
 import open3d as o3d
 import numpy as np
 from pathlib import Path
 
+try:
+    import similarity_engine  # the C++ engine as an extension module, built next to this file by setup.py (see PythonModule.cpp)
+except ImportError:
+    similarity_engine = None
+
 app = FastAPI(title="3D Model Similarity Search API")
 
 # Enable CORS for React frontend
@@ -34,17 +42,15 @@ class SimilarityRequest(BaseModel):
     source_model: str
     top_k: int = 5
     algorithm: str = "kdtree"  # Algorithm choice: 'kdtree' or 'octree'
+    deadline_ms: Optional[float] = None  # latency budget, the best top_k found within it; None for get_deadline_ms()
 
 class ModelGeometry(BaseModel):
     vertices: List[List[float]]
     faces: List[List[int]]
     normals: List[List[float]]
 
-# Cache storage
-_model_cache: List[ModelInfo] = []
-_model_cache_timestamp: float = 0
+# Cache storage (the model list itself is the engine's, see get_cached_models)
 _geometry_cache: Dict[str, Dict[str, Any]] = {}
-CACHE_DURATION = 300  # 5 minutes for model list cache
 
 def get_data_dir() -> str:
     """Get the absolute path to the ModelNet10 directory"""
@@ -54,30 +60,63 @@ def get_data_dir() -> str:
     modelnet_dir = backend_dir.parent / "ModelNet10"
     return str(modelnet_dir)
 
-def is_model_cache_expired() -> bool:
-    """Check if the model cache has expired"""
-    return time.time() - _model_cache_timestamp > CACHE_DURATION
+def get_index_path() -> str:
+    """Get the path of the prebuilt corpus index (similarity_search --build-index ModelNet10 ModelNet10.idx)"""
+    return str(Path(__file__).parent.parent / "ModelNet10.idx")
+
+def get_score_cache_path() -> str:
+    """Get the path of the engine's persistent pairwise score cache (appended to as pairs are scored)"""
+    return str(Path(__file__).parent.parent / "similarity_scores.cache")
+
+def get_geometry_cache_dir() -> str:
+    """Get the directory of the models' encoded viewer geometry"""
+    return str(Path(__file__).parent.parent / "geometry_cache")
+
+def get_geometry_cache_path(model_path: str) -> str:
+    """Get the path of a model's encoded viewer geometry (every level of detail, rewritten when the OFF file changes)"""
+    return str(Path(get_geometry_cache_dir()) / (model_path + ".geom"))
+
+def resolve_model_path(model_path: str) -> Tuple[str, str]:
+    """The OFF file and geometry cache file of a model path from a request, 404 unless both stay under the data directory and
+    the cache directory once resolved (a '..' or a symlink out of them would read, or write, any file the server can)"""
+    data_dir = Path(get_data_dir()).resolve()
+    off_path = (data_dir / model_path.replace('/', os.sep)).resolve()
+    if not off_path.is_relative_to(data_dir) or off_path == data_dir:
+        raise HTTPException(status_code=404, detail="Model file not found")
+    cache_dir = Path(get_geometry_cache_dir()).resolve()
+    cache_path = Path(get_geometry_cache_path(off_path.relative_to(data_dir).as_posix())).resolve()
+    if not cache_path.is_relative_to(cache_dir):
+        raise HTTPException(status_code=404, detail="Model file not found")
+    return str(off_path), str(cache_path)
+
+def get_executable_path() -> str:
+    """Get the path of the similarity_search binary built by setup.py"""
+    name = "similarity_search.exe" if sys.platform == "win32" else "similarity_search"
+    return str(Path(__file__).parent.parent / name)
+
+def get_deadline_ms() -> Optional[float]:
+    """Default latency budget of a similarity search (SIMILARITY_DEADLINE_MS, 0 for none): the engine answers with the best
+    matches it has settled by then rather than the exact top k"""
+    budget = float(os.environ.get("SIMILARITY_DEADLINE_MS", "1000"))
+    return budget if budget > 0 else None
 
 def get_cached_models() -> List[ModelInfo]:
-    """Get cached model list or scan directory if cache is expired"""
-    global _model_cache, _model_cache_timestamp
-    
-    if not _model_cache or is_model_cache_expired():
-        print("DEBUG: Refreshing model cache...")
-        _model_cache = scan_models_directory()
-        _model_cache_timestamp = time.time()
-        print(f"DEBUG: Cached {len(_model_cache)} models")
-    else:
-        print(f"DEBUG: Using cached models ({len(_model_cache)} models)")
-    
-    return _model_cache
+    """The engine's models, brought up to date first: a refresh only stats the files and rebuilds those added, changed or removed"""
+    data_dir = get_data_dir()
+    if os.path.isdir(data_dir):
+        report = _similarity_engine.refresh(data_dir)
+        if report["added"] or report["changed"] or report["removed"]:
+            print(f"DEBUG: Corpus refreshed in {report['seconds']:.3f}s: {report}")
+            _geometry_cache.clear()  # geometry of a changed file would be stale
+    return [
+        ModelInfo(filename=name, category=name.split('/')[0], vertices=vertices, faces=faces)
+        for name, vertices, faces in _similarity_engine.models()
+    ]
 
-def get_cached_geometry(filename: str) -> Dict[str, Any]:
-    """Get cached geometry or load from file if not cached"""
+def get_cached_geometry(filename: str, off_path: str) -> Dict[str, Any]:
+    """Get cached geometry or load from file if not cached (off_path as resolve_model_path gives it)"""
     if filename not in _geometry_cache:
         print(f"DEBUG: Loading and caching geometry for {filename}")
-        modelnet_dir = get_data_dir()
-        off_path = os.path.join(modelnet_dir, filename.replace('/', os.sep))
         _geometry_cache[filename] = off_to_json(off_path)
         print(f"DEBUG: Geometry cached. Cache size: {len(_geometry_cache)}")
     else:
@@ -85,23 +124,148 @@ def get_cached_geometry(filename: str) -> Dict[str, Any]:
     
     return _geometry_cache[filename]
 
-def write_geometry_to_off(geometry: Dict[str, Any], filepath: str):
-    """Write geometry data back to OFF file format for C++ processing"""
-    vertices = geometry['vertices']
-    faces = geometry['faces']
-    
-    with open(filepath, 'w') as f:
-        # Write OFF header
-        f.write("OFF\n")
-        f.write(f"{len(vertices)} {len(faces)} 0\n")
-        
-        # Write vertices
-        for vertex in vertices:
-            f.write(f"{vertex[0]} {vertex[1]} {vertex[2]}\n")
-        
-        # Write faces
-        for face in faces:
-            f.write(f"{len(face)} {' '.join(map(str, face))}\n")
+def get_binary_geometry(model_path: str, lod: int) -> bytes:
+    """One level of detail of a model as the engine's compact binary geometry (see Geometry.h): 16 bit positions, oct encoded
+    normals and 16/32 bit indices, served straight from its cache file once encoded"""
+    off_path, cache_path = resolve_model_path(model_path)
+    if similarity_engine:
+        return similarity_engine.geometry(off_path, cache_path, lod)
+    result = subprocess.run([get_executable_path(), "--geometry", off_path, cache_path, str(lod)], capture_output=True)
+    if result.returncode != 0:
+        raise RuntimeError(result.stderr.decode(errors="replace").strip() or f"cannot encode {model_path}")
+    return result.stdout
+
+class SimilarityServer:
+    """Resident C++ similarity engine (similarity_search --serve) that keeps every model's trees in memory"""
+
+    def __init__(self, corpus_dir: str):
+        self.corpus_dir = corpus_dir
+        self.process = None
+        self.lock = threading.Lock()
+
+    def executable(self) -> str:
+        return get_executable_path()
+
+    def start(self):
+        """Spawn the engine and wait until it has loaded the corpus"""
+        print(f"DEBUG: Starting similarity server over {self.corpus_dir}")
+        self.process = subprocess.Popen(
+            [self.executable(), "--serve", self.corpus_dir, "256", "none", get_score_cache_path()],
+            stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True, bufsize=1
+        )
+        ready = self.process.stdout.readline().split()
+        if not ready or ready[0] != "READY":
+            self.process.kill()
+            self.process = None
+            raise RuntimeError(f"Similarity server failed to start: {' '.join(ready)}")
+        print(f"DEBUG: Similarity server ready with {ready[1]} models")
+
+    def read_stats(self) -> Dict[str, Any]:
+        """The STATS <json> line the engine ends every answer with"""
+        line = self.process.stdout.readline().rstrip("\n")
+        if not line.startswith("STATS "):
+            raise RuntimeError(line or "Similarity server closed the connection")
+        return json.loads(line[len("STATS "):])
+
+    def stats(self) -> Dict[str, Any]:
+        """Histograms over every query the engine has answered since it started"""
+        with self.lock:
+            if self.process is None or self.process.poll() is not None:
+                self.start()
+            self.process.stdin.write("stats\n")
+            self.process.stdin.flush()
+            return self.read_stats()
+
+    def models(self) -> List[Tuple[str, int, int]]:
+        """Every model the engine holds as (filename, vertices, faces), in corpus order"""
+        with self.lock:
+            if self.process is None or self.process.poll() is not None:
+                self.start()
+            self.process.stdin.write("models\n")
+            self.process.stdin.flush()
+            status = self.process.stdout.readline().strip()
+            if not status.startswith("OK "):
+                raise RuntimeError(status or "Similarity server closed the connection")
+            models = []
+            for _ in range(int(status.split()[1])):
+                vertices, faces, filename = self.process.stdout.readline().rstrip("\n").split("\t", 2)
+                models.append((filename, int(vertices), int(faces)))
+            return models
+
+    def refresh(self, directory: str) -> Dict[str, Any]:
+        """Reload the files of directory that were added, changed or removed since the engine last looked"""
+        with self.lock:
+            if self.process is None or self.process.poll() is not None:
+                self.start()
+            self.process.stdin.write(f"refresh {directory}\n")
+            self.process.stdin.flush()
+            line = self.process.stdout.readline().rstrip("\n")
+            if not line.startswith("REFRESHED "):
+                raise RuntimeError(line or "Similarity server closed the connection")
+            return json.loads(line[len("REFRESHED "):])
+
+    def search(self, source: str, algorithm: str, top_k: int, deadline_ms: Optional[float] = None) -> Tuple[List[Dict[str, Any]], Dict[str, Any]]:
+        """One round trip: source -> top-k matches ordered best first, and the engine's stats for the query"""
+        with self.lock:
+            if self.process is None or self.process.poll() is not None:
+                self.start()
+            within = f"within {deadline_ms} " if deadline_ms is not None else ""
+            self.process.stdin.write(f"{algorithm} {top_k} {within}{source}\n")
+            self.process.stdin.flush()
+            status = self.process.stdout.readline().strip()
+            if not status.startswith("OK "):
+                raise RuntimeError(status or "Similarity server closed the connection")
+            matches = []
+            for _ in range(int(status.split()[1])):
+                score, vertices, faces, filename = self.process.stdout.readline().rstrip("\n").split("\t", 3)
+                matches.append({
+                    "filename": filename,
+                    "score": float(score),
+                    "vertices": int(vertices),
+                    "faces": int(faces),
+                })
+            return matches, self.read_stats()
+
+class InProcessEngine:
+    """The C++ engine loaded into this process: no subprocess, no pipe protocol, the GIL is released while it searches"""
+
+    def __init__(self, corpus_path: str):
+        self.corpus_path = corpus_path
+        self.corpus = None
+        self.lock = threading.Lock()
+
+    def load(self):
+        with self.lock:
+            if self.corpus is None:
+                print(f"DEBUG: Loading similarity engine over {self.corpus_path}")
+                self.corpus = similarity_engine.Corpus(self.corpus_path, score_cache=get_score_cache_path())
+                print(f"DEBUG: Similarity engine ready with {self.corpus.size()} models")
+        return self.corpus
+
+    def stats(self) -> Dict[str, Any]:
+        """Histograms over every query the engine has answered since it was loaded"""
+        return json.loads(similarity_engine.stats())
+
+    def models(self) -> List[Tuple[str, int, int]]:
+        """Every model the engine holds as (filename, vertices, faces), in corpus order"""
+        return self.load().models()
+
+    def refresh(self, directory: str) -> Dict[str, Any]:
+        """Reload the files of directory that were added, changed or removed; searches meanwhile use the models as they were"""
+        return self.load().refresh(directory)
+
+    def search(self, source, algorithm: str, top_k: int, deadline_ms: Optional[float] = None) -> Tuple[List[Dict[str, Any]], Dict[str, Any]]:
+        """source is a model name or a float32 (N, 3) array, read in place; returns matches best first and the query's stats"""
+        results, stats = self.load().search(source, algorithm, top_k, deadline_ms)
+        matches = [
+            {"filename": filename, "score": score, "vertices": vertices, "faces": faces}
+            for filename, score, vertices, faces in results
+        ]
+        return matches, json.loads(stats)
+
+# A prebuilt index is mapped in milliseconds, otherwise the engine parses the whole corpus on startup
+_corpus_path = get_index_path() if os.path.exists(get_index_path()) else get_data_dir()
+_similarity_engine = InProcessEngine(_corpus_path) if similarity_engine else SimilarityServer(_corpus_path)
 
 def off_to_json(off_path: str) -> Dict[str, Any]:
     """Convert OFF file to JSON format compatible with Three.js"""
@@ -125,61 +289,6 @@ def off_to_json(off_path: str) -> Dict[str, Any]:
     except Exception as e:
         raise HTTPException(status_code=500, detail=f"Error converting OFF file: {str(e)}")
 
-def scan_models_directory() -> List[ModelInfo]:
-    """Scan the ModelNet10 directory and return model information"""
-    models = []
-    data_dir = get_data_dir()
-    
-    print(f"DEBUG: Looking for ModelNet10 directory at: {data_dir}")
-    print(f"DEBUG: ModelNet10 directory exists: {os.path.exists(data_dir)}")
-    
-    if not os.path.exists(data_dir):
-        print(f"DEBUG: ModelNet10 directory not found at {data_dir}")
-        return models
-    
-    categories = os.listdir(data_dir)
-    print(f"DEBUG: Found categories: {categories}")
-    
-    for category in categories:
-        category_path = os.path.join(data_dir, category)
-        if not os.path.isdir(category_path):
-            print(f"DEBUG: Skipping non-directory: {category}")
-            continue
-        
-        print(f"DEBUG: Processing category: {category}")
-        
-        for split in ["train", "test"]:
-            split_path = os.path.join(category_path, split)
-            if not os.path.exists(split_path):
-                print(f"DEBUG: Split not found: {split_path}")
-                continue
-            
-            files = [f for f in os.listdir(split_path) if f.endswith(".off")]
-            print(f"DEBUG: Found {len(files)} .off files in {category}/{split}")
-            
-            for filename in files[:5]:  # Limit to first 5 files for debugging
-                try:
-                    off_path = os.path.join(split_path, filename)
-                    print(f"DEBUG: Loading {off_path}")
-                    mesh = o3d.io.read_triangle_mesh(off_path)
-                    
-                    if len(mesh.vertices) == 0:
-                        print(f"DEBUG: Empty mesh in {filename}")
-                        continue
-                    
-                    models.append(ModelInfo(
-                        filename=f"{category}/{split}/{filename}",
-                        category=category,
-                        vertices=len(mesh.vertices),
-                        faces=len(mesh.triangles)
-                    ))
-                    print(f"DEBUG: Successfully loaded {filename}: {len(mesh.vertices)} vertices")
-                except Exception as e:
-                    print(f"DEBUG: Error loading {filename}: {e}")
-                    continue
-    
-    return models
-
 @app.get("/")
 async def root():
     return {"message": "3D Model Similarity Search API"}
@@ -192,7 +301,7 @@ async def test():
 @app.get("/list")
 async def list_direct():
     print("DEBUG: Direct /list endpoint called!")
-    return get_cached_models()
+    return await run_in_threadpool(get_cached_models)  # a refresh stats every file, off the event loop
 
 @app.get("/categories")  
 async def categories_direct():
@@ -210,7 +319,7 @@ async def categories_direct():
 async def list_models():
     """Get list of all available 3D models"""
     print("DEBUG: Correct /models/list endpoint called!")
-    return get_cached_models()
+    return await run_in_threadpool(get_cached_models)
 
 @app.get("/models/categories")
 async def get_categories():
@@ -226,17 +335,30 @@ async def get_categories():
     return {"categories": categories}
 
 @app.get("/models/geometry/{category}/{split}/{filename}")
-async def get_model_geometry(category: str, split: str, filename: str, response: Response):
-    """Get 3D model geometry data for Three.js rendering"""
+async def get_model_geometry(category: str, split: str, filename: str, response: Response, format: str = "json", lod: int = 0):
+    """Get 3D model geometry data for Three.js rendering; format=binary sends one level of detail (0 the full mesh, past the
+    coarsest the coarsest) as the engine's compact binary geometry"""
     model_path = f"{category}/{split}/{filename}"
-    modelnet_dir = get_data_dir()
-    off_path = os.path.join(modelnet_dir, category, split, filename)
+    off_path, _ = resolve_model_path(model_path)
     
-    if not os.path.exists(off_path):
+    if not os.path.isfile(off_path):
         raise HTTPException(status_code=404, detail="Model file not found")
     
+    if format == "binary":
+        if lod < 0:
+            raise HTTPException(status_code=400, detail="lod must be >= 0")
+        try:
+            data = await run_in_threadpool(get_binary_geometry, model_path, lod)
+        except Exception as e:
+            raise HTTPException(status_code=500, detail=str(e))
+        stat = os.stat(off_path)
+        return Response(content=data, media_type="application/octet-stream", headers={
+            "Cache-Control": "public, max-age=3600",
+            "ETag": f'"{stat.st_size:x}-{stat.st_mtime_ns:x}-{lod}"',  # changes with the file
+        })
+    
     try:
-        geometry_data = get_cached_geometry(model_path)
+        geometry_data = get_cached_geometry(model_path, off_path)
         
         # Add cache headers for browser-level caching
         response.headers["Cache-Control"] = "public, max-age=3600"  # Cache for 1 hour
@@ -248,150 +370,75 @@ async def get_model_geometry(category: str, split: str, filename: str, response:
 
 @app.post("/models/similar")
 async def find_similar_models(request: SimilarityRequest):
-    """Find similar models using C++ algorithms with geometry caching"""
+    """Find similar models using the C++ engine (in process when the extension is built, else the resident server)"""
     
-    # Load and cache source model geometry once
     print(f"DEBUG: Starting similarity search for {request.source_model}")
     print(f"DEBUG: Using {request.algorithm.upper()} algorithm")
     
-    try:
-        source_geometry = get_cached_geometry(request.source_model)
-        print(f"DEBUG: Source geometry loaded/cached - {len(source_geometry['vertices'])} vertices")
-    except Exception as e:
-        raise HTTPException(status_code=404, detail=f"Source model not found: {e}")
+    if request.algorithm not in ("kdtree", "octree"):
+        raise HTTPException(status_code=400, detail=f"Unknown algorithm: {request.algorithm}")
     
-    # Get all available models to compare against
-    all_models = get_cached_models()
-    model_scores = []  # List of (model, similarity_score) tuples
+    source_path, _ = resolve_model_path(request.source_model)
+    if not os.path.isfile(source_path):
+        raise HTTPException(status_code=404, detail="Source model not found")
     
     search_start_time = time.time()
-    print(f"DEBUG: Comparing against {len(all_models)} total models")
-    
-    # Create temporary files for C++ processing (reuse source file)
-    temp_dir = "temp_similarity"
-    os.makedirs(temp_dir, exist_ok=True)
-    source_temp_path = os.path.join(temp_dir, "source.off")
-    compare_temp_path = os.path.join(temp_dir, "compare.off")
-    
-    # Write source geometry to temp file once
-    write_geometry_to_off(source_geometry, source_temp_path)
-    print(f"DEBUG: Source geometry written to temp file")
-    
-    # Compare against each model 
-    for model in all_models:
-        if model.filename == request.source_model:
-            continue  # Skip comparing with itself
-            
-        try:
-            start_time = time.time()
-            
-            if request.algorithm == "kdtree":
-                # KDTree: Use direct file access with proper working directory
-                modelnet_dir = get_data_dir()
-                source_direct_path = os.path.join(modelnet_dir, request.source_model.replace('/', os.sep))
-                compare_direct_path = os.path.join(modelnet_dir, model.filename.replace('/', os.sep))
-                
-                if not os.path.exists(compare_direct_path):
-                    continue
-                
-                # Convert to relative paths from project root
-                project_root = os.path.dirname(os.getcwd())  # Parent of backend/
-                source_rel = os.path.relpath(source_direct_path, project_root)
-                compare_rel = os.path.relpath(compare_direct_path, project_root)
-                
-                # Use full path to executable to avoid "file not found" issues
-                exe_path = os.path.join(project_root, "similarity_search.exe")
-                cmd = [exe_path, source_rel, compare_rel, request.algorithm]
-                
-                # DEBUG: Print exact command and working directory
-                print(f"DEBUG: Running command: {' '.join(cmd)}")
-                print(f"DEBUG: Working directory: {project_root}")
-                print(f"DEBUG: Executable exists: {os.path.exists(exe_path)}")
-                print(f"DEBUG: Source path exists: {os.path.exists(source_direct_path)}")
-                print(f"DEBUG: Compare path exists: {os.path.exists(compare_direct_path)}")
-                    
-                result = subprocess.run(cmd, capture_output=True, text=True, timeout=15, cwd=project_root)
-                
-            else:
-                # Octree: Use cached system (works fine)
-                compare_geometry = get_cached_geometry(model.filename)
-                write_geometry_to_off(compare_geometry, compare_temp_path)
-                
-                result = subprocess.run([
-                    "../similarity_search.exe",
-                    source_temp_path,
-                    compare_temp_path,
-                    request.algorithm
-                ], capture_output=True, text=True, timeout=15)
-            
-            duration = time.time() - start_time
-            
-            if result.returncode == 0:
-                # DEBUG: Print raw output to diagnose parsing issues
-                raw_stdout = result.stdout.strip()
-                raw_stderr = result.stderr.strip() if result.stderr else "No stderr"
-                print(f"DEBUG: Raw stdout: '{raw_stdout}'")
-                print(f"DEBUG: Raw stderr: '{raw_stderr}'")
-                
-                try:
-                    similarity_score = float(raw_stdout)
-                    model_scores.append((model, similarity_score))
-                    print(f"DEBUG: {model.filename} - Similarity: {similarity_score:.3f}% ({duration:.2f}s)")
-                except ValueError as e:
-                    print(f"DEBUG: Failed to parse similarity score for {model.filename}: {e}")
-                    print(f"DEBUG: Stdout content: '{raw_stdout}'")
-            else:
-                print(f"DEBUG: Error with {model.filename} - Return code: {result.returncode} ({duration:.2f}s)")
-                print(f"DEBUG: Error stdout: '{result.stdout}'")
-                print(f"DEBUG: Error stderr: '{result.stderr}'")
-                
-        except subprocess.TimeoutExpired:
-            print(f"DEBUG: Timeout (>15s) comparing {model.filename}")
-            continue
-        except Exception as e:
-            print(f"DEBUG: Error comparing {model.filename}: {e}")
-            continue
-    
-    # Cleanup temp files
     try:
-        os.remove(source_temp_path)
-        os.remove(compare_temp_path)
-        os.rmdir(temp_dir)
-    except:
-        pass  # Ignore cleanup errors
+        deadline_ms = request.deadline_ms if request.deadline_ms is not None else get_deadline_ms()
+        matches, engine_stats = await run_in_threadpool(_similarity_engine.search, request.source_model, request.algorithm, request.top_k, deadline_ms)
+    except Exception as e:
+        raise HTTPException(status_code=500, detail=f"Similarity search failed: {e}")
     
-    # Sort by similarity score (highest first) and take top-k
-    model_scores.sort(key=lambda x: x[1], reverse=True)
-    similar_models = [model for model, score in model_scores[:request.top_k]]
+    similar_models = [
+        ModelInfo(
+            filename=match["filename"],
+            category=match["filename"].split('/')[0],
+            vertices=match["vertices"],
+            faces=match["faces"]
+        )
+        for match in matches
+    ]
     
     total_duration = time.time() - search_start_time
-    print(f"DEBUG: Found {len(similar_models)} similar models in {total_duration:.1f} seconds")
-    print(f"DEBUG: Top scores: {[(model.filename, score) for model, score in model_scores[:request.top_k]]}")
-    
-    # Avoid division by zero if no models were successfully processed
-    if len(model_scores) > 0:
-        print(f"DEBUG: Average time per comparison: {total_duration/len(model_scores):.2f}s")
-    else:
-        print(f"DEBUG: No models were successfully compared")
-    print(f"DEBUG: Geometry cache size: {len(_geometry_cache)}")
+    print(f"DEBUG: Found {len(similar_models)} similar models in {total_duration:.3f} seconds")
+    print(f"DEBUG: Top scores: {[(match['filename'], match['score']) for match in matches]}")
     
     return {
         "source_model": request.source_model,
         "similar_models": similar_models,
-        "similarity_scores": [score for model, score in model_scores[:request.top_k]],
-        "method": f"{'direct' if request.algorithm == 'kdtree' else 'cached'}_{request.algorithm}_similarity_scores"
+        "similarity_scores": [match["score"] for match in matches],
+        "method": f"{'in_process' if similarity_engine else 'resident'}_{request.algorithm}_similarity_scores",
+        "engine_stats": engine_stats
     }
 
+@app.get("/models/stats")
+async def similarity_stats():
+    """Histograms of the C++ engine's per query timers and counters since it started"""
+    try:
+        return _similarity_engine.stats()
+    except Exception as e:
+        raise HTTPException(status_code=500, detail=f"Cannot read engine stats: {e}")
+
 @app.get("/models/compare/{model1_path:path}/vs/{model2_path:path}")
-async def compare_models(model1_path: str, model2_path: str):
-    """Compare two models side by side (similar to Jupyter notebook functionality)"""
-    modelnet_dir = get_data_dir()
-    full_path1 = os.path.join(modelnet_dir, model1_path.replace('/', os.sep))
-    full_path2 = os.path.join(modelnet_dir, model2_path.replace('/', os.sep))
+async def compare_models(model1_path: str, model2_path: str, format: str = "json", lod: int = 0):
+    """Compare two models side by side (similar to Jupyter notebook functionality); format=binary sends both models' binary
+    geometry back to back, the first one ends where the block of its level does"""
+    full_path1, _ = resolve_model_path(model1_path)
+    full_path2, _ = resolve_model_path(model2_path)
     
-    if not os.path.exists(full_path1) or not os.path.exists(full_path2):
+    if not os.path.isfile(full_path1) or not os.path.isfile(full_path2):
         raise HTTPException(status_code=404, detail="One or both model files not found")
     
+    if format == "binary":
+        if lod < 0:
+            raise HTTPException(status_code=400, detail="lod must be >= 0")
+        try:
+            data1 = await run_in_threadpool(get_binary_geometry, model1_path, lod)
+            data2 = await run_in_threadpool(get_binary_geometry, model2_path, lod)
+        except Exception as e:
+            raise HTTPException(status_code=500, detail=str(e))
+        return Response(content=data1 + data2, media_type="application/octet-stream")
+    
     try:
         geometry1 = off_to_json(full_path1)
         geometry2 = off_to_json(full_path2)
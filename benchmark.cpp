@@ -0,0 +1,525 @@
+#include "generic.h"
+#include "Similarity.h"
+#include "Corpus.h"
+#include "Geometry.h"
+#include "PointCloud.h"
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <unistd.h>
+
+/**
+ * ./benchmark [directory] > results.json
+ * runs the same suite over deterministic synthetic point clouds (uniform, clustered, uniform sorted along x, degenerate:
+ * duplicated points on a plane) written as OFF files to a scratch directory, and then over every .off under directory if given
+ * the suite: OFF parse throughput (loadOFF against loadMesh), KDTree insert against bulk build and Octree build, nearest
+ * neighbor latency one query at a time and batched (every vertex of a model queried against its neighbour, in tree order as
+ * the Hausdorff comparison issues them), per pair comparison time (exact and bounded Hausdorff, KDTreeComparison,
+ * OctTreeScore, OctTreeComparison), the viewer geometry encoder, the SIMD point cloud kernels against plain loops, each sampling mode's cost, corpus load
+ * through the pipeline and its memory against fixed point corpora (with the score drift they cost), top-k search and one pass scan queries per second with the share of candidates pruned, and the recall
+ * of the descriptor prefilter
+ * prints one JSON object with one record per measurement on its own line, so two runs diff line by line
+ */
+namespace {
+    using Clock = chrono::steady_clock;
+
+    const size_t SYNTHETIC_MODELS = 16;     // files per synthetic input
+    const size_t SYNTHETIC_POINTS = 4096;   // points per synthetic file
+
+    double since(Clock::time_point start) { return chrono::duration<double>(Clock::now() - start).count(); }
+
+    string quoted(const string& text) {
+        string out = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') out += '\\';
+            if (static_cast<unsigned char>(c) < 0x20) out += ' ';
+            else out += c;
+        }
+        return out + "\"";
+    }
+
+    class Record { // one measurement: which input, which benchmark, then its numbers
+        string fields;
+
+    public:
+        Record(const string& input, const string& benchmark) { add("input", input).add("benchmark", benchmark); };
+        Record& add(const string& key, const string& value) {
+            fields += (fields.empty() ? "" : ", ") + quoted(key) + ": " + quoted(value);
+            return *this;
+        };
+        Record& add(const string& key, double value) {
+            ostringstream number;
+            if (isfinite(value)) number << setprecision(6) << value;
+            else number << "null";
+            fields += (fields.empty() ? "" : ", ") + quoted(key) + ": " + number.str();
+            return *this;
+        };
+        const string& json() const { return fields; };
+    };
+
+    vector<Record> results;
+
+    Record& record(const string& input, const string& benchmark) {
+        results.emplace_back(input, benchmark);
+        return results.back();
+    }
+
+    // synthetic inputs, every cloud drawn from a fixed seed so each run measures the same points
+
+    struct Random {
+        uint64_t state;
+        float uniform() { // [0, 1)
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            return static_cast<float>(state >> 40) * 0x1.0p-24f;
+        };
+    };
+
+    vector<Point> uniformCloud(Random& random, size_t count) {
+        vector<Point> points(count);
+        for (Point& p : points) p = Point(random.uniform(), random.uniform(), random.uniform());
+        return points;
+    }
+
+    vector<Point> clusteredCloud(Random& random, size_t count) { // 8 tight blobs, the kind of imbalance real scans have
+        Point centers[8];
+        for (Point& c : centers) c = Point(random.uniform(), random.uniform(), random.uniform());
+        vector<Point> points(count);
+        for (Point& p : points) {
+            const Point& c = centers[static_cast<size_t>(random.uniform() * 8) % 8];
+            auto spread = [&random]() { return 0.05f * (random.uniform() + random.uniform() + random.uniform() - 1.5f); };
+            p = Point(c.x + spread(), c.y + spread(), c.z + spread());
+        }
+        return points;
+    }
+
+    vector<Point> sortedCloud(Random& random, size_t count) { // worst order for one at a time inserts
+        vector<Point> points = uniformCloud(random, count);
+        sort(points.begin(), points.end(), [](const Point& a, const Point& b) { return a.x < b.x; });
+        return points;
+    }
+
+    vector<Point> degenerateCloud(Random& random, size_t count) { // flat and full of duplicates: a 16 x 16 lattice on z = 0
+        vector<Point> points(count);
+        for (Point& p : points) p = Point(floor(random.uniform() * 16) / 16, floor(random.uniform() * 16) / 16, 0.0f);
+        return points;
+    }
+
+    bool writeOFF(const filesystem::path& path, const vector<Point>& points) {
+        ofstream out(path);
+        out << "OFF\n" << points.size() << " 0 0\n" << setprecision(9);
+        for (const Point& p : points) out << p.x << ' ' << p.y << ' ' << p.z << '\n';
+        return static_cast<bool>(out);
+    }
+
+    template <typename Generator>
+    string writeSynthetic(const filesystem::path& root, const string& name, uint64_t seed, Generator generate) {
+        filesystem::path directory = root / name;
+        filesystem::create_directories(directory);
+        Random random = {seed};
+        for (size_t i = 0; i < SYNTHETIC_MODELS; ++i) {
+            ostringstream file;
+            file << name << '_' << setw(4) << setfill('0') << i << ".off";
+            writeOFF(directory / file.str(), generate(random, SYNTHETIC_POINTS));
+        }
+        return directory.string();
+    }
+
+    // the suite
+
+    template <typename Loader>
+    void timeLoader(const string& input, const string& name, const vector<filesystem::path>& paths, Loader load) {
+        size_t files = 0, bytes = 0, vertices = 0;
+        auto start = Clock::now();
+        for (const auto& path : paths) {
+            size_t count = 0;
+            if (!load(path.string(), count)) continue;
+            files++;
+            bytes += filesystem::file_size(path);
+            vertices += count;
+        }
+        double seconds = since(start);
+        record(input, "parse " + name).add("files", files).add("vertices", vertices).add("seconds", seconds)
+            .add("mb_per_s", bytes / (1024.0 * 1024.0) / seconds).add("files_per_s", files / seconds);
+    }
+
+    // every vertex of the model, nudged off the surface, is one nearest neighbor query
+    void timeKDTree(const string& input, const string& name, const vector<vector<Point>>& models, bool bulk) {
+        double buildSeconds = 0.0, querySeconds = 0.0;
+        size_t queries = 0;
+        float checksum = 0.0f; // keeps the queries from being optimized away
+        for (const auto& vertices : models) {
+            auto start = Clock::now();
+            KDTree<> tree;
+            if (bulk) tree.build(vertices);
+            else for (const Point& p : vertices) tree.insert(p);
+            auto built = Clock::now();
+            for (const Point& p : vertices) checksum += tree.nearestNeighbor(Point(p.x + 1e-3f, p.y - 1e-3f, p.z + 1e-3f)).x;
+            buildSeconds += chrono::duration<double>(built - start).count();
+            querySeconds += since(built);
+            queries += vertices.size();
+        }
+        if (checksum == 1234.5f) cerr << "";
+        record(input, name).add("ms_per_model", 1e3 * buildSeconds / max<size_t>(models.size(), 1))
+            .add("ns_per_nearest_neighbor", 1e9 * querySeconds / max<size_t>(queries, 1)).add("queries", queries);
+    }
+
+    void runSuite(const string& input, const string& directory) {
+        vector<filesystem::path> paths;
+        for (const auto& entry : filesystem::recursive_directory_iterator(directory)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".off") paths.push_back(entry.path());
+        }
+        sort(paths.begin(), paths.end());
+        if (paths.empty()) return;
+
+        // one untimed pass so every loader reads from a warm page cache
+        auto vertexOnly = [](const string& path, size_t& vertices) { Mesh mesh; bool ok = loadMesh(path, mesh, false); vertices = mesh.vertices.size(); return ok; };
+        for (const auto& path : paths) { size_t vertices; vertexOnly(path.string(), vertices); }
+        timeLoader(input, "loadOFF", paths, [](const string& path, size_t& vertices) {
+            vector<Point> points;
+            vector<Face> faces;
+            bool ok = loadOFF(path, points, faces);
+            vertices = points.size();
+            return ok;
+        });
+        timeLoader(input, "loadMesh", paths, [](const string& path, size_t& vertices) {
+            Mesh mesh;
+            bool ok = loadMesh(path, mesh);
+            vertices = mesh.vertices.size();
+            return ok;
+        });
+        timeLoader(input, "loadMesh vertices only", paths, vertexOnly);
+
+        vector<Mesh> meshes;
+        vector<vector<Point>> models, sortedModels; // file order and scanned (sorted by x) order
+        for (const auto& path : paths) {
+            Mesh mesh;
+            if (!loadMesh(path.string(), mesh)) continue;
+            models.push_back(mesh.vertices);
+            sortedModels.push_back(mesh.vertices);
+            sort(sortedModels.back().begin(), sortedModels.back().end(), [](const Point& a, const Point& b) { return a.x < b.x; });
+            meshes.push_back(std::move(mesh));
+        }
+        // the viewer's binary geometry: every level of detail encoded, and what the full and the coarsest level weigh against the file
+        size_t fileBytes = 0, fullBytes = 0, coarseBytes = 0, levels = 0;
+        auto start = Clock::now();
+        for (const Mesh& mesh : meshes) {
+            vector<uint8_t> all, level;
+            if (!encodeGeometry(mesh, 0, 0, all)) continue;
+            geometryLevel(all.data(), all.size(), 0, level);
+            fullBytes += level.size();
+            geometryLevel(all.data(), all.size(), GEOMETRY_LEVELS, level);
+            coarseBytes += level.size();
+            levels += reinterpret_cast<const GeometryHeader*>(all.data())->levels;
+        }
+        double encodeSeconds = since(start);
+        for (const auto& path : paths) fileBytes += filesystem::file_size(path);
+        size_t meshCount = max<size_t>(meshes.size(), 1);
+        record(input, "geometry encode").add("ms_per_model", 1e3 * encodeSeconds / meshCount).add("levels_per_model", static_cast<double>(levels) / meshCount)
+            .add("off_bytes_per_model", fileBytes / meshCount).add("full_bytes_per_model", fullBytes / meshCount).add("coarsest_bytes_per_model", coarseBytes / meshCount);
+
+        timeKDTree(input, "kdtree insert", models, false);
+        timeKDTree(input, "kdtree build", models, true);
+        timeKDTree(input, "kdtree insert sorted input", sortedModels, false);
+        timeKDTree(input, "kdtree build sorted input", sortedModels, true);
+
+        vector<KDTree<>> trees;
+        vector<vector<Point>> normalizedModels;
+        for (const auto& vertices : models) {
+            vector<Point> normalized = vertices;
+            Point center;
+            float scale;
+            normalize(normalized, center, scale);
+            trees.push_back(fillKD(normalized));
+            normalizedModels.push_back(trees.back().traverse());
+        }
+        size_t pairs = max<size_t>(trees.size(), 2) - 1;
+
+        vector<Octree> octrees;
+        size_t octreeBytes = 0, octreeNodes = 0, octreePoints = 0;
+        start = Clock::now();
+        for (const auto& vertices : normalizedModels) octrees.push_back(fillOct(vertices));
+        double seconds = since(start);
+        for (const Octree& tree : octrees) {
+            octreeBytes += tree.memoryBytes();
+            octreeNodes += tree.nodeCount();
+            octreePoints += tree.pointCount();
+        }
+        size_t count = max<size_t>(octrees.size(), 1);
+        record(input, "octree build").add("ms_per_model", 1e3 * seconds / count).add("bytes_per_model", octreeBytes / count)
+            .add("bytes_per_point", static_cast<double>(octreeBytes) / max<size_t>(octreePoints, 1)).add("nodes_per_model", octreeNodes / count);
+
+        vector<PointCloud> clouds;
+        for (const auto& vertices : normalizedModels) clouds.emplace_back(vertices);
+
+        // brute force nearest point over a whole model, array of points against the SIMD kernel over x, y, z arrays
+        const size_t KERNEL_QUERIES = 64; // per model, taken from the neighbouring model
+        auto timeKernel = [&](const string& name, auto nearest) {
+            size_t distances = 0, checksum = 0;
+            auto begin = Clock::now();
+            for (size_t i = 1; i < clouds.size(); ++i) {
+                for (size_t q = 0; q < min(KERNEL_QUERIES, normalizedModels[i].size()); ++q) checksum += nearest(i - 1, normalizedModels[i][q]);
+                distances += min(KERNEL_QUERIES, normalizedModels[i].size()) * clouds[i - 1].size();
+            }
+            record(input, name).add("ns_per_distance", 1e9 * since(begin) / max<size_t>(distances, 1)).add("checksum", checksum);
+        };
+        timeKernel("nearest point scalar loop", [&](size_t model, const Point& q) {
+            const vector<Point>& points = normalizedModels[model];
+            size_t best = 0;
+            float bestDist = distance(points[0], q);
+            for (size_t j = 1; j < points.size(); ++j) {
+                float d = distance(points[j], q);
+                if (d < bestDist) {
+                    bestDist = d;
+                    best = j;
+                }
+            }
+            return best;
+        });
+        timeKernel("nearest point kernel", [&](size_t model, const Point& q) {
+            float dist;
+            return clouds[model].nearest(q, dist);
+        });
+        start = Clock::now();
+        Point low, high;
+        for (size_t repeat = 0; repeat < 64; ++repeat)
+            for (const PointCloud& cloud : clouds) cloud.bounds(low, high);
+        record(input, "bounding box kernel").add("ns_per_point", 1e9 * since(start) / max<size_t>(64 * octreePoints, 1));
+
+        auto timeQueries = [&](const string& name, auto query) { // query(tree, points of the neighbouring model)
+            size_t queries = 0;
+            auto begin = Clock::now();
+            for (size_t i = 1; i < trees.size(); ++i) {
+                query(trees[i - 1], normalizedModels[i]);
+                queries += normalizedModels[i].size();
+            }
+            record(input, name).add("ns_per_query", 1e9 * since(begin) / max<size_t>(queries, 1)).add("queries", queries);
+        };
+        vector<Point> neighbors;
+        vector<float> distances;
+        vector<uint32_t> offsets;
+        timeQueries("nearestNeighbor one at a time", [&](const KDTree<>& tree, const vector<Point>& queries) {
+            for (const Point& q : queries) distances.assign(1, tree.nearestNeighbor(q).x);
+        });
+        for (size_t k : {1, 8}) {
+            timeQueries("knn batched k=" + to_string(k), [&](const KDTree<>& tree, const vector<Point>& queries) {
+                neighbors.resize(queries.size() * k);
+                distances.resize(queries.size() * k);
+                tree.knn(queries, k, neighbors, distances);
+            });
+        }
+        timeQueries("radiusSearch batched r=0.02", [&](const KDTree<>& tree, const vector<Point>& queries) {
+            tree.radiusSearch(queries, 0.02f, offsets, neighbors);
+        });
+
+        auto timePairs = [&](const string& name, auto compare) { // compare(i - 1, i) returns whether the pair counts as similar
+            size_t similar = 0;
+            double worst = 0.0;
+            auto begin = Clock::now();
+            for (size_t i = 1; i < trees.size(); ++i) {
+                auto pairStart = Clock::now();
+                similar += compare(i - 1, i);
+                worst = max(worst, since(pairStart));
+            }
+            record(input, name).add("us_per_pair", 1e6 * since(begin) / pairs).add("worst_us", 1e6 * worst).add("similar_pairs", similar)
+                .add("threads", ThreadPool::shared().size());
+        };
+        timePairs("hausdorff exact", [&](size_t a, size_t b) { return hausdorff(trees[a], trees[b]) <= KD_TOLERANCE; });
+        timePairs("hausdorff bounded", [&](size_t a, size_t b) { return hausdorff(trees[a], trees[b], KD_TOLERANCE) <= KD_TOLERANCE; });
+        timePairs("KDTreeComparison", [&](size_t a, size_t b) { return KDTreeComparison(trees[a], trees[b]); });
+        timePairs("OctTreeScore", [&](size_t a, size_t b) { return OctTreeScore(octrees[a], octrees[b]) >= OCT_THRESHOLD; });
+        timePairs("OctTreeComparison", [&](size_t a, size_t b) { return OctTreeComparison(octrees[a], octrees[b]); });
+
+        for (const char* mode : {"voxel:1024", "fps:1024", "voxel:4096", "fps:4096"}) {
+            SampleOptions sampling;
+            parseSampling(mode, sampling);
+            vector<vector<Point>> sampled;
+            start = Clock::now();
+            for (const Mesh& original : meshes) {
+                Mesh mesh = original;
+                Point center;
+                float scale;
+                preprocess(mesh, sampling, center, scale);
+                sampled.push_back(std::move(mesh.vertices));
+            }
+            double preprocessSeconds = since(start);
+            size_t points = 0;
+            for (const auto& vertices : sampled) points += vertices.size();
+            vector<KDTree<>> kdtrees;
+            vector<Octree> sampledOctrees;
+            for (const auto& vertices : sampled) {
+                kdtrees.push_back(fillKD(vertices));
+                sampledOctrees.push_back(fillOct(vertices));
+            }
+            double kdWorst = 0.0, octWorst = 0.0, kdTotal = 0.0, octTotal = 0.0;
+            for (size_t i = 1; i < sampled.size(); ++i) {
+                start = Clock::now();
+                KDTreeScore(kdtrees[i - 1], kdtrees[i]);
+                double kd = since(start);
+                start = Clock::now();
+                OctTreeScore(sampledOctrees[i - 1], sampledOctrees[i]);
+                double oct = since(start);
+                kdTotal += kd; octTotal += oct;
+                kdWorst = max(kdWorst, kd); octWorst = max(octWorst, oct);
+            }
+            record(input, string("sampling ") + mode).add("ms_per_model", 1e3 * preprocessSeconds / max<size_t>(sampled.size(), 1))
+                .add("points_per_model", points / max<size_t>(sampled.size(), 1)).add("kdtree_us_per_pair", 1e6 * kdTotal / pairs)
+                .add("kdtree_worst_us", 1e6 * kdWorst).add("octree_us_per_pair", 1e6 * octTotal / pairs).add("octree_worst_us", 1e6 * octWorst);
+        }
+
+        Corpus corpus;
+        start = Clock::now();
+        corpus.load(directory);
+        seconds = since(start);
+        Record& load = record(input, "corpus load").add("models", corpus.size()).add("seconds", seconds).add("models_per_s", corpus.size() / seconds)
+            .add("bytes_per_model", corpus.memoryBytes() / max<size_t>(corpus.size(), 1));
+        if (const PipelineReport* report = corpus.scanReport()) {
+            load.add("readers", report->readers).add("workers", report->workers);
+            for (const StageCounter& stage : report->stages) load.add(string(stage.name) + "_busy_s", stage.busyNanos.load() * 1e-9);
+        }
+        RefreshReport refreshed;
+        corpus.refresh(directory, refreshed); // nothing changed: one stat per file and no new snapshot
+        record(input, "corpus refresh unchanged").add("models", refreshed.models).add("ms", 1e3 * refreshed.seconds);
+        const size_t DRIFT_QUERIES = min<size_t>(paths.size(), 8);
+        vector<vector<Match>> exact(2 * DRIFT_QUERIES); // kdtree and octree top 10 of each query on float points
+        for (size_t i = 0; i < exact.size(); ++i) corpus.search(paths[i / 2].string(), i % 2 ? "octree" : "kdtree", 10, exact[i]);
+        for (const char* storage : {"none,q16", "none,q16,delta", "none,q8,delta"}) { // fixed point corpora against the float one
+            SampleOptions options;
+            parseSampling(storage, options);
+            Corpus quantized;
+            quantized.setSampling(options);
+            quantized.load(directory);
+            double kdDrift = 0.0, octDrift = 0.0; // largest score change of a model in both top 10s
+            size_t queries = 0;
+            vector<Match> approximate;
+            start = Clock::now();
+            for (size_t i = 0; i < exact.size(); ++i) {
+                if (!quantized.search(paths[i / 2].string(), i % 2 ? "octree" : "kdtree", 10, approximate)) continue;
+                queries++;
+                double& drift = i % 2 ? octDrift : kdDrift;
+                for (const Match& match : exact[i])
+                    for (const Match& other : approximate)
+                        if (other.name == match.name) drift = max(drift, fabs(static_cast<double>(other.score) - match.score));
+            }
+            seconds = since(start);
+            record(input, string("corpus ") + storage).add("bytes_per_model", quantized.memoryBytes() / max<size_t>(quantized.size(), 1))
+                .add("memory_ratio", static_cast<double>(corpus.memoryBytes()) / max<size_t>(quantized.memoryBytes(), 1))
+                .add("kdtree_max_drift", kdDrift).add("octree_max_drift", octDrift).add("ms_per_query", 1e3 * seconds / max<size_t>(queries, 1));
+        }
+        for (size_t prefilter : {size_t(0), size_t(256)}) {
+            corpus.setPrefilter(prefilter);
+            for (const string algorithm : {"kdtree", "octree"}) {
+                for (size_t k : {1, 10}) {
+                    size_t queries = 0, refined = 0, cutOff = 0, candidates = 0;
+                    vector<Match> matches;
+                    start = Clock::now();
+                    for (const auto& path : paths) {
+                        if (!corpus.search(path.string(), algorithm, k, matches)) continue;
+                        queries++;
+                        candidates += corpus.lastStats().candidates;
+                        refined += corpus.lastStats().refined;
+                        cutOff += corpus.lastStats().cutOff;
+                    }
+                    seconds = since(start);
+                    double perQuery = static_cast<double>(max<size_t>(queries, 1));
+                    record(input, "search " + algorithm + " k=" + to_string(k) + " prefilter=" + to_string(prefilter))
+                        .add("qps", queries / seconds).add("ms_per_query", 1e3 * seconds / perQuery).add("candidates", candidates / perQuery)
+                        .add("refined", refined / perQuery).add("cut_off", cutOff / perQuery);
+                }
+            }
+        }
+        for (const string algorithm : {"kdtree", "octree"}) { // one pass over the directory per query, nothing kept resident
+            vector<Match> matches;
+            size_t queries = 0;
+            size_t sample = min<size_t>(paths.size(), 4);
+            start = Clock::now();
+            for (size_t i = 0; i < sample; ++i) queries += corpus.scan(directory, paths[i].string(), algorithm, 10, matches);
+            seconds = since(start);
+            record(input, "scan " + algorithm + " k=10").add("qps", queries / seconds).add("ms_per_query", 1e3 * seconds / max<size_t>(queries, 1));
+        }
+
+        const size_t K = 10;
+        for (const string algorithm : {"kdtree", "octree"}) {
+            vector<vector<Match>> exact(paths.size());
+            corpus.setPrefilter(0);
+            for (size_t i = 0; i < paths.size(); ++i) corpus.search(paths[i].string(), algorithm, K, exact[i]);
+            for (size_t candidates = 4; candidates < 2 * corpus.size() && candidates <= 1024; candidates *= 2) {
+                corpus.setPrefilter(candidates);
+                size_t expected = 0, found = 0;
+                vector<Match> matches;
+                start = Clock::now();
+                for (size_t i = 0; i < paths.size(); ++i) {
+                    if (!corpus.search(paths[i].string(), algorithm, K, matches)) continue;
+                    expected += exact[i].size();
+                    for (const Match& match : exact[i])
+                        found += any_of(matches.begin(), matches.end(), [&](const Match& m) { return m.name == match.name; });
+                }
+                seconds = since(start);
+                record(input, "prefilter " + algorithm + " candidates=" + to_string(candidates))
+                    .add("recall_at_10", static_cast<double>(found) / max<size_t>(expected, 1)).add("ms_per_query", 1e3 * seconds / max<size_t>(paths.size(), 1));
+            }
+        }
+
+        // anytime searches: latency against the deadline and the share of the unbounded top 10 still found, each budget on a
+        // fresh corpus so that no pair is settled by what the score cache learned from the unbounded searches
+        const size_t DEADLINE_QUERIES = min<size_t>(paths.size(), 64);
+        corpus.setPrefilter(256);
+        vector<vector<Match>> unbounded(2 * DEADLINE_QUERIES); // kdtree and octree top 10 of each query
+        for (size_t i = 0; i < unbounded.size(); ++i)
+            corpus.search(paths[i / 2 * paths.size() / DEADLINE_QUERIES].string(), i % 2 ? "octree" : "kdtree", K, unbounded[i]);
+        for (double budget : {2.0, 10.0, 50.0}) {
+            Corpus timed;
+            timed.load(directory);
+            for (size_t a = 0; a < 2; ++a) {
+                vector<double> latencies;
+                size_t expected = 0, found = 0, interrupted = 0, skipped = 0, hit = 0;
+                vector<Match> matches;
+                for (size_t i = a; i < unbounded.size(); i += 2) {
+                    auto begin = Clock::now();
+                    Deadline deadline = begin + chrono::duration_cast<Clock::duration>(chrono::duration<double, milli>(budget));
+                    if (!timed.search(paths[i / 2 * paths.size() / DEADLINE_QUERIES].string(), a ? "octree" : "kdtree", K, matches, deadline)) continue;
+                    latencies.push_back(1e3 * since(begin));
+                    expected += unbounded[i].size();
+                    for (const Match& match : unbounded[i])
+                        found += any_of(matches.begin(), matches.end(), [&](const Match& m) { return m.name == match.name; });
+                    interrupted += timed.lastStats().interrupted;
+                    skipped += timed.lastStats().skipped;
+                    hit += timed.lastStats().deadlineHit;
+                }
+                if (latencies.empty()) continue;
+                sort(latencies.begin(), latencies.end());
+                double perQuery = static_cast<double>(latencies.size());
+                ostringstream name;
+                name << "deadline " << (a ? "octree" : "kdtree") << " within=" << budget << "ms";
+                record(input, name.str()).add("p50_ms", latencies[latencies.size() / 2]).add("p99_ms", latencies[latencies.size() * 99 / 100])
+                    .add("max_ms", latencies.back()).add("recall_at_10", static_cast<double>(found) / max<size_t>(expected, 1))
+                    .add("deadline_hit", hit / perQuery).add("interrupted", interrupted / perQuery).add("skipped", skipped / perQuery);
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 2 || (argc == 2 && !filesystem::is_directory(argv[1]))) {
+        cerr << "usage: benchmark [directory]" << endl;
+        return -1;
+    }
+    filesystem::path scratch = filesystem::temp_directory_path() / ("benchmark-" + to_string(getpid()));
+    vector<pair<string, string>> inputs = {
+        {"uniform", writeSynthetic(scratch, "uniform", 1, uniformCloud)},
+        {"clustered", writeSynthetic(scratch, "clustered", 2, clusteredCloud)},
+        {"sorted", writeSynthetic(scratch, "sorted", 3, sortedCloud)},
+        {"degenerate", writeSynthetic(scratch, "degenerate", 4, degenerateCloud)},
+    };
+    if (argc == 2) inputs.push_back({argv[1], argv[1]});
+    for (const auto& [name, directory] : inputs) {
+        cerr << "benchmarking " << name << endl; // progress only, the results go to stdout
+        runSuite(name, directory);
+    }
+    filesystem::remove_all(scratch);
+
+    cout << "{\n  \"simd\": " << quoted(simdLevel()) << ",\n  \"threads\": " << ThreadPool::shared().size()
+         << ",\n  \"synthetic\": {\"models\": " << SYNTHETIC_MODELS << ", \"points\": " << SYNTHETIC_POINTS << "},\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) cout << "    {" << results[i].json() << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    cout << "  ]\n}" << endl;
+    return 0;
+}
@@ -23,6 +23,7 @@ import ModelViewer from './components/ModelViewer';
 import ModelList from './components/ModelList';
 import { ModelInfo, ModelGeometry } from './types';
 import { apiService } from './services/api';
+import { COARSEST_LEVEL } from './services/geometry';
 
 const theme = createTheme({
   palette: {
@@ -55,16 +56,23 @@ function App() {
     loadInitialData();
   }, []);
 
-  const loadGeometryWithCache = useCallback(async (filename: string): Promise<ModelGeometry> => {
+  // onPreview gets the coarsest level of detail first, a small fraction of the full mesh, to show while the full one loads
+  const loadGeometryWithCache = useCallback(async (filename: string, onPreview?: (geometry: ModelGeometry) => void): Promise<ModelGeometry> => {
     // Check if geometry is already cached
     if (geometryCache.has(filename)) {
       console.log(`Using cached geometry for ${filename}`);
       return geometryCache.get(filename)!;
     }
 
-    // Load geometry from API
+    let preview: ModelGeometry | null = null;
+    if (onPreview) {
+      preview = await apiService.getModelGeometry(filename, COARSEST_LEVEL);
+      if (preview.level > 0) onPreview(preview);
+    }
+
+    // Load geometry from API (a model with a single level already came as the preview)
     console.log(`Loading geometry for ${filename}`);
-    const geometry = await apiService.getModelGeometry(filename);
+    const geometry = preview && preview.level === 0 ? preview : await apiService.getModelGeometry(filename);
     
     // Cache the result
     setGeometryCache(prev => new Map(prev).set(filename, geometry));
@@ -108,7 +116,7 @@ function App() {
       setCurrentSimilarIndex(0);
       setCurrentSimilarGeometry(null);
       
-      const geometry = await loadGeometryWithCache(model.filename);
+      const geometry = await loadGeometryWithCache(model.filename, setModelGeometry1);
       setModelGeometry1(geometry);
     } catch (error) {
       console.error('Error loading model geometry:', error);
@@ -129,7 +137,7 @@ function App() {
         setCurrentSimilarIndex(0);
         
         // Load geometry for the first similar model immediately
-        const firstGeometry = await loadGeometryWithCache(response.similar_models[0].filename);
+        const firstGeometry = await loadGeometryWithCache(response.similar_models[0].filename, setCurrentSimilarGeometry);
         setCurrentSimilarGeometry(firstGeometry);
         
         // Preload all other similar model geometries in the background
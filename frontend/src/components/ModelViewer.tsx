@@ -173,18 +173,13 @@ const ModelViewer: React.FC<ModelViewerProps> = ({ geometry, position }) => {
     // Create Three.js geometry from our data
     const threeGeometry = new THREE.BufferGeometry();
 
-    // Convert vertices array to Float32Array
-    const vertices = new Float32Array(geometry.vertices.flat());
-    threeGeometry.setAttribute('position', new THREE.BufferAttribute(vertices, 3));
-
-    // Convert faces to indices
-    const indices = new Uint32Array(geometry.faces.flat());
-    threeGeometry.setIndex(new THREE.BufferAttribute(indices, 1));
+    // Copies of the decoded arrays: centering and scaling below rewrite them, the cached geometry must stay as decoded
+    threeGeometry.setAttribute('position', new THREE.BufferAttribute(geometry.positions.slice(), 3));
+    threeGeometry.setIndex(new THREE.BufferAttribute(geometry.indices, 1));
 
     // Add normals if available
-    if (geometry.normals && geometry.normals.length > 0) {
-      const normals = new Float32Array(geometry.normals.flat());
-      threeGeometry.setAttribute('normal', new THREE.BufferAttribute(normals, 3));
+    if (geometry.normals.length > 0) {
+      threeGeometry.setAttribute('normal', new THREE.BufferAttribute(geometry.normals.slice(), 3));
     } else {
       threeGeometry.computeVertexNormals();
     }
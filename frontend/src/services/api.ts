@@ -1,5 +1,6 @@
 import axios from 'axios';
 import { ModelInfo, ModelGeometry, SimilarityResponse, ComparisonResponse } from '../types';
+import { decodeGeometry } from './geometry';
 
 const API_BASE_URL = 'http://localhost:8000';
 
@@ -21,12 +22,16 @@ export const apiService = {
     return response.data;
   },
 
-  async getModelGeometry(filename: string): Promise<ModelGeometry> {
+  async getModelGeometry(filename: string, lod: number = 0): Promise<ModelGeometry> {
     // Parse filename to extract category, split, and filename
     const parts = filename.split('/');
     const [category, split, file] = parts;
-    const response = await apiClient.get(`/models/geometry/${category}/${split}/${file}`);
-    return response.data;
+    // Binary geometry, level of detail lod (0 is the full mesh)
+    const response = await apiClient.get(`/models/geometry/${category}/${split}/${file}`, {
+      params: { format: 'binary', lod },
+      responseType: 'arraybuffer',
+    });
+    return decodeGeometry(response.data);
   },
 
   async findSimilarModels(sourceModel: string, topK: number = 5, algorithm: string = 'kdtree'): Promise<SimilarityResponse> {
@@ -38,9 +43,18 @@ export const apiService = {
     return response.data;
   },
 
-  async compareModels(model1Path: string, model2Path: string): Promise<ComparisonResponse> {
-    const response = await apiClient.get(`/models/compare/${model1Path}/vs/${model2Path}`);
-    return response.data;
+  async compareModels(model1Path: string, model2Path: string, lod: number = 0): Promise<ComparisonResponse> {
+    const response = await apiClient.get(`/models/compare/${model1Path}/vs/${model2Path}`, {
+      params: { format: 'binary', lod },
+      responseType: 'arraybuffer',
+    });
+    // The two models' buffers back to back
+    const geometry1 = decodeGeometry(response.data);
+    const geometry2 = decodeGeometry(response.data, geometry1.metadata.byte_length);
+    return {
+      model1: { path: model1Path, geometry: geometry1 },
+      model2: { path: model2Path, geometry: geometry2 },
+    };
   },
 };
 
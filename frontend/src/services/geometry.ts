@@ -0,0 +1,70 @@
+import { ModelGeometry } from '../types';
+
+// Decoder for the engine's compact binary geometry (Geometry.h): a 64 byte header, one 16 byte level entry per level in the
+// buffer, then each level's block of uint16 position codes, int8 oct encoded normals and uint16/uint32 indices (4 byte aligned)
+const HEADER_BYTES = 64;
+const LEVEL_BYTES = 16;
+
+// GEOMETRY_LEVELS - 1: the server serves the coarsest level a model has for anything past it
+export const COARSEST_LEVEL = 3;
+
+const padded = (bytes: number) => (bytes + 3) & ~3;
+
+// Decodes the first level held by the buffer starting at byteOffset; metadata.byte_length is where that buffer ends
+export function decodeGeometry(buffer: ArrayBuffer, byteOffset: number = 0): ModelGeometry {
+  const view = new DataView(buffer, byteOffset);
+  const magic = String.fromCharCode(view.getUint8(0), view.getUint8(1), view.getUint8(2), view.getUint8(3));
+  if (magic !== 'GEOM' || view.getUint32(4, true) !== 1) {
+    throw new Error('Not a binary geometry buffer (or another version)');
+  }
+  const levels = view.getUint32(8, true);
+  const level = view.getUint32(12, true);
+  const origin = [view.getFloat32(40, true), view.getFloat32(44, true), view.getFloat32(48, true)];
+  const step = [view.getFloat32(52, true), view.getFloat32(56, true), view.getFloat32(60, true)];
+  const vertexCount = view.getUint32(HEADER_BYTES, true);
+  const indexCount = view.getUint32(HEADER_BYTES + 4, true);
+  const blockOffset = byteOffset + view.getUint32(HEADER_BYTES + 8, true);
+  const blockSize = view.getUint32(HEADER_BYTES + 12, true);
+
+  // position = origin + code * step per axis
+  const codes = new Uint16Array(buffer, blockOffset, 3 * vertexCount);
+  const positions = new Float32Array(3 * vertexCount);
+  for (let i = 0; i < positions.length; i++) {
+    positions[i] = origin[i % 3] + codes[i] * step[i % 3];
+  }
+
+  // oct decoding: unfold the lower half of the octahedron, then normalize
+  const normalsOffset = blockOffset + padded(6 * vertexCount);
+  const oct = new Int8Array(buffer, normalsOffset, 2 * vertexCount);
+  const normals = new Float32Array(3 * vertexCount);
+  for (let v = 0; v < vertexCount; v++) {
+    let x = oct[2 * v] / 127;
+    let y = oct[2 * v + 1] / 127;
+    const z = 1 - Math.abs(x) - Math.abs(y);
+    const t = Math.max(-z, 0);
+    x += x >= 0 ? -t : t;
+    y += y >= 0 ? -t : t;
+    const length = Math.hypot(x, y, z) || 1;
+    normals[3 * v] = x / length;
+    normals[3 * v + 1] = y / length;
+    normals[3 * v + 2] = z / length;
+  }
+
+  const indicesOffset = normalsOffset + padded(2 * vertexCount);
+  const indices = vertexCount <= 65536
+    ? new Uint16Array(buffer, indicesOffset, indexCount)
+    : new Uint32Array(buffer, indicesOffset, indexCount);
+
+  return {
+    positions,
+    normals,
+    indices,
+    level,
+    levels,
+    metadata: {
+      vertex_count: vertexCount,
+      face_count: indexCount / 3,
+      byte_length: blockOffset - byteOffset + blockSize,
+    },
+  };
+}
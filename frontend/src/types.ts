@@ -6,12 +6,15 @@ export interface ModelInfo {
 }
 
 export interface ModelGeometry {
-  vertices: number[][];
-  faces: number[][];
-  normals: number[][];
+  positions: Float32Array;            // x, y, z per vertex
+  normals: Float32Array;              // x, y, z per vertex
+  indices: Uint16Array | Uint32Array; // 3 per triangle
+  level: number;                      // level of detail, 0 is the full mesh
+  levels: number;                     // how many the model has
   metadata: {
     vertex_count: number;
     face_count: number;
+    byte_length: number;              // of the binary buffer it was decoded from
   };
 }
 
@@ -1,4 +1,7 @@
 #include "generic.h"
+#include "MappedFile.h"
+#include "Stats.h"
+#include <charconv>
 
 bool loadOFF(const std::string& path, std::vector<Point>& vertices, std::vector<Face>& faces) {
     std::ifstream file(path); // since OFF are text files this is fine
@@ -6,10 +9,14 @@ bool loadOFF(const std::string& path, std::vector<Point>& vertices, std::vector<
 
     std::string header;
     file >> header;
-    if (header != "OFF") return false;
+    if (header.compare(0, 3, "OFF") != 0) return false;
 
     int vCount, fCount, _;
-    file >> vCount >> fCount >> _; // get header info and read out a dummy value from the header;
+    if (header.size() > 3) { // some ModelNet files glue the counts to the header (OFF490 518 0)
+        vCount = stoi(header.substr(3));
+        file >> fCount >> _;
+    }
+    else file >> vCount >> fCount >> _; // get header info and read out a dummy value from the header;
     vertices.resize(vCount); // initialize the vector to the size of the number of vertices we will be adding
     for (int i = 0; i < vCount; ++i)
         file >> vertices[i].x >> vertices[i].y >> vertices[i].z; // read in line by line until there are no more....
@@ -24,10 +31,95 @@ bool loadOFF(const std::string& path, std::vector<Point>& vertices, std::vector<
     return true;
 }
 
+namespace {
+    struct Cursor { // walks the mapped text of an OFF file
+        const char* at;
+        const char* end;
+
+        void skipSpace() { // whitespace and # comments
+            while (at < end) {
+                if (*at == '#') while (at < end && *at != '\n') ++at;
+                else if (*at == ' ' || *at == '\t' || *at == '\r' || *at == '\n') ++at;
+                else return;
+            }
+        }
+        template <typename T>
+        bool read(T& value) {
+            skipSpace();
+            if (at < end && *at == '+') ++at; // from_chars does not take an explicit sign
+            auto [next, error] = from_chars(at, end, value);
+            if (error != errc()) return false;
+            at = next;
+            return true;
+        }
+    };
+}
+
+bool loadMesh(const string& path, Mesh& mesh, bool withFaces) {
+    MappedFile file;
+    return file.open(path) && parseMesh(file.data(), file.size(), mesh, withFaces);
+}
+
+bool parseMesh(const char* data, size_t size, Mesh& mesh, bool withFaces) {
+    ScopedTimer timer(Counter::ParseNanos);
+    Cursor cursor{data, data + size};
+    cursor.skipSpace();
+    if (cursor.end - cursor.at < 3 || string(cursor.at, 3) != "OFF") return false;
+    cursor.at += 3; // the counts may follow directly (OFF490 518 0)
+
+    size_t vCount, fCount, edges;
+    if (!cursor.read(vCount) || !cursor.read(fCount) || !cursor.read(edges)) return false;
+    // counts from a corrupt header must not size anything: a vertex takes at least "0 0 0 " and a face "0\n" of what is left
+    // (the last record may go without its separator)
+    if (vCount > (static_cast<size_t>(cursor.end - cursor.at) + 1) / 6) return false;
+    mesh.vertices.resize(vCount);
+    for (Point& p : mesh.vertices) {
+        if (!cursor.read(p.x) || !cursor.read(p.y) || !cursor.read(p.z)) return false;
+    }
+    if (fCount > (static_cast<size_t>(cursor.end - cursor.at) + 1) / 2) return false;
+    mesh.faceCount = fCount;
+    mesh.faceOffsets.clear();
+    mesh.faceIndices.clear();
+    if (!withFaces) return true; // vertex-only callers never touch the face section
+
+    mesh.faceOffsets.reserve(fCount + 1);
+    mesh.faceIndices.reserve(min(fCount * 3, static_cast<size_t>(cursor.end - cursor.at) / 2)); // ModelNet is almost all triangles, an index takes "0 " at least
+    mesh.faceOffsets.push_back(0);
+    for (size_t i = 0; i < fCount; ++i) {
+        uint32_t n;
+        if (!cursor.read(n)) return false;
+        for (uint32_t j = 0; j < n; ++j) {
+            uint32_t index;
+            if (!cursor.read(index) || index >= vCount) return false;
+            mesh.faceIndices.push_back(index);
+        }
+        while (cursor.at < cursor.end && *cursor.at != '\n') ++cursor.at; // drop optional per-face colors
+        mesh.faceOffsets.push_back(static_cast<uint32_t>(mesh.faceIndices.size()));
+    }
+    return true;
+}
+
 float distance(const Point& p1, const Point& p2) { // distance between 3d points O(1)
     float dist = 0.0;
     dist += (p1.x - p2.x) * (p1.x - p2.x);
     dist += (p1.y - p2.y) * (p1.y - p2.y);
     dist += (p1.z - p2.z) * (p1.z - p2.z);
     return dist;
+}
+
+void normalize(vector<Point>& vertices, Point& center, float& scale) { // O(n)
+    center = Point();
+    scale = 1.0f;
+    if (vertices.empty()) return;
+    Point low = vertices[0], high = vertices[0];
+    for (const Point& p : vertices) { // bounding box
+        low = Point(min(low.x, p.x), min(low.y, p.y), min(low.z, p.z));
+        high = Point(max(high.x, p.x), max(high.y, p.y), max(high.z, p.z));
+    }
+    center = Point((low.x + high.x) / 2.0f, (low.y + high.y) / 2.0f, (low.z + high.z) / 2.0f);
+    float extent = max(high.x - low.x, max(high.y - low.y, high.z - low.z));
+    if (extent > 0.0f) scale = 1.0f / extent; // a single repeated point only gets centered
+    for (Point& p : vertices) {
+        p = Point((p.x - center.x) * scale, (p.y - center.y) * scale, (p.z - center.z) * scale);
+    }
 }
\ No newline at end of file
@@ -3,30 +3,44 @@
 #include <string>
 #include <filesystem>
 #include <cmath>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <cstdint>
+#include <type_traits>
 using namespace std;
 
 struct Point { // all operations O(1)
     float x, y, z;
     Point(float x_ = 0.0f, float y_ = 0.0f, float z_= 0.0f) : x(x_), y(y_), z(z_) {}; // initialize given xyz
-    Point(const Point& p) { // copy constructor from another poitn
-        this->x = p.x;
-        this->y = p.y;
-        this->z = p.z;
-    };
     bool operator==(const Point& rhs) const {
         return (x == rhs.x && y == rhs.y && z == rhs.z);
     };
     Point operator-(const Point& rhs) const {
         return Point(x - rhs.x, y - rhs.y, z - rhs.z);
     }
+    float operator[](uint32_t axis) const { // coordinate along axis 0, 1, 2 (x, y, z)
+        return axis == 0 ? x : (axis == 1 ? y : z);
+    }
     
 };
 
+static_assert(sizeof(Point) == 3 * sizeof(float), "Point must stay three packed floats, mapped files rely on it");
+static_assert(is_trivially_copyable_v<Point>, "Point is copied as raw floats (memcpy, mapped files, SIMD transposes)");
+
 struct Face {
     vector<int> indices;
 };
 
+struct Mesh { // faces in CSR layout: face i is faceIndices[faceOffsets[i] .. faceOffsets[i + 1])
+    vector<Point> vertices;
+    vector<uint32_t> faceOffsets;
+    vector<uint32_t> faceIndices;
+    size_t faceCount = 0; // from the header, so it is known even when the faces are skipped
+};
+
 bool loadOFF(const string& path, vector<Point>& vertices, vector<Face>& faces);
-float distance(const Point& p1, const Point& p2);
\ No newline at end of file
+bool loadMesh(const string& path, Mesh& mesh, bool withFaces = true); // mapped + from_chars, much faster than loadOFF
+bool parseMesh(const char* data, size_t size, Mesh& mesh, bool withFaces = true); // the same parser over OFF text already in memory
+float distance(const Point& p1, const Point& p2);
+void normalize(vector<Point>& vertices, Point& center, float& scale); // center on the bounding box and scale the largest extent to 1, returns the transform used
\ No newline at end of file
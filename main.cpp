@@ -1,104 +1,351 @@
-#include "Octree.h"
-#include "KDTree.h"
+#include "Similarity.h"
+#include "Corpus.h"
+#include "Shards.h"
+#include "Geometry.h"
+#include <charconv>
+#include <cstring>
+#include <sstream>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
-// Variables that are used for tree comparisons
-float KD_TOLERANCE = 0.1; // Tolerance for point distance
-float OCT_TOLERANCE = 0.1; // Results with lower than tolerance mean similar points
+/**
+ * Resident mode: load the corpus (a directory of OFF files or an index file) once and answer requests on stdin until EOF or "quit"
+ * each request compares the source against the candidates models with the closest descriptors (0 for the whole corpus)
+ * a directory's models and every query are preprocessed with sampling, an index keeps the sampling it was built with
+ * with a score cache file, every pair scored is kept there (see ScoreCache.h) and a later run answers repeated pairs from it
+ * request  :: <algorithm> <k> [within <ms>] <source>   (source is a corpus model name or a path to an OFF file)
+ *             within answers after about ms milliseconds at most, with the best k of the candidates settled by then
+ * response :: OK <n> followed by n lines of <score>\t<vertices>\t<faces>\t<name> and STATS <json>, or ERR <reason>
+ *             the json holds the query's wall time, stage timers, tree counters, allocations and peak RSS (see Stats.h), and under
+ *             "search" the candidates refined, cut off, cached, interrupted and skipped and whether the deadline was hit
+ * request  :: stats                              histograms over every query answered so far
+ * response :: STATS <json>
+ * request  :: models                             every model of the corpus
+ * response :: OK <n> followed by n lines of <vertices>\t<faces>\t<name>
+ * request  :: refresh [directory]                reload only what changed in the directory (by default the one loaded, an index
+ *                                                needs the directory it was built from), see Corpus::refresh
+ * response :: REFRESHED <json> with the added, changed, removed, touched and unreadable file counts, models and seconds, or ERR
+ */
+// one request of serve's protocol, the whole answer; a within budget counts from received (a shard's requests may queue for a while)
+string respond(Corpus& corpus, const string& line, chrono::steady_clock::time_point received = chrono::steady_clock::now()) {
+    ostringstream out;
+    if (line == "stats") {
+        out << "STATS " << statsHistograms() << '\n';
+        return out.str();
+    }
+    if (line == "models") {
+        vector<Match> models = corpus.models();
+        out << "OK " << models.size() << '\n';
+        for (const Match& model : models) out << model.vertexCount << '\t' << model.faceCount << '\t' << model.name << '\n';
+        return out.str();
+    }
+    if (line == "refresh" || line.rfind("refresh ", 0) == 0) {
+        string directory = line.size() > 8 ? line.substr(8) : corpus.directory();
+        RefreshReport report;
+        if (directory.empty() || !corpus.refresh(directory, report))
+            return "ERR cannot refresh from " + (directory.empty() ? string("an index without its directory") : directory) + "\n";
+        out << "REFRESHED {\"added\": " << report.added << ", \"changed\": " << report.changed << ", \"removed\": " << report.removed
+            << ", \"touched\": " << report.touched << ", \"unreadable\": " << report.unreadable << ", \"models\": " << report.models
+            << ", \"seconds\": " << report.seconds << "}\n";
+        return out.str();
+    }
+    QueryStats queryStats;
+    istringstream request(line);
+    string algorithm, source;
+    long long k = 0; // signed, so -1 is refused rather than wrapped to the whole corpus
+    Deadline deadline = NO_DEADLINE;
+    if (!(request >> algorithm >> k) || !getline(request >> ws, source) || source.empty()) return "ERR malformed request\n";
+    if (k <= 0) return "ERR k must be positive\n";
+    if (source.rfind("within ", 0) == 0) { // loading the query counts towards the budget
+        istringstream budget(source.substr(7));
+        double ms = -1.0;
+        if (!(budget >> ms) || ms < 0.0 || !getline(budget >> ws, source) || source.empty()) return "ERR malformed request\n";
+        deadline = received + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(ms));
+    }
+    vector<Match> results;
+    if (!corpus.search(source, algorithm, static_cast<size_t>(k), results, deadline)) return "ERR cannot search " + source + " with " + algorithm + "\n";
+    out << "OK " << results.size() << '\n';
+    for (const Match& match : results)
+        out << match.score << '\t' << match.vertexCount << '\t' << match.faceCount << '\t' << match.name << '\n';
+    string stats = queryStats.finish();
+    stats.pop_back(); // the closing brace, the search's part goes in before it
+    out << "STATS " << stats << ", \"search\": " << searchStatsJson(corpus.lastStats()) << "}\n";
+    return out.str();
+}
 
-float OCT_THRESHOLD = 0.65; // Similarity threshold percentage, results with higher percentage are more similar
+// loads the corpus for serve and shard workers, false with the reason in error if it can't
+bool openCorpus(Corpus& corpus, const string& corpus_dir, size_t candidates, const SampleOptions& sampling, const string& score_cache, string& error) {
+    corpus.setPrefilter(candidates);
+    corpus.setSampling(sampling);
+    if (!score_cache.empty() && !corpus.openScoreCache(score_cache)) {
+        error = "cannot open score cache " + score_cache;
+        return false;
+    }
+    bool loaded = filesystem::is_regular_file(corpus_dir) ? corpus.loadIndex(corpus_dir) : corpus.load(corpus_dir);
+    if (!loaded) {
+        error = "cannot open corpus " + corpus_dir;
+        return false;
+    }
+    if (corpus.scanReport()) corpus.scanReport()->print(cerr); // stdout belongs to the protocol
+    return true;
+}
 
-bool KDTreeComparison(KDTree& treeA, KDTree& treeB) {
-    // distance from A to B
-    float max_dist_A_to_B = 0.0;
-    vector<Point> dataA = treeA.traverse();
-    for (const auto& pA : dataA) {
-        Point nearest_pB = treeB.nearestNeighbor(pA);
-        float dist = distance(pA, nearest_pB);
-        if (dist > max_dist_A_to_B) {
-            max_dist_A_to_B = dist;
-        }
+int serve(const string& corpus_dir, size_t candidates, const SampleOptions& sampling, const string& score_cache) {
+    Corpus corpus;
+    string error;
+    if (!openCorpus(corpus, corpus_dir, candidates, sampling, score_cache, error)) {
+        cout << "ERR " << error << endl;
+        return -1;
     }
-    // distance from B to A
-    float max_dist_B_to_A = 0.0;
-    vector<Point> dataB = treeB.traverse();
-    for (const auto& pB : dataB) {
-        Point nearest_pA = treeA.nearestNeighbor(pB);
-        float dist = distance(pB, nearest_pA);
-        if (dist > max_dist_B_to_A) {
-            max_dist_B_to_A = dist;
-        }
+    cout << "READY " << corpus.size() << endl; // the backend waits for this line before sending requests
+
+    string line;
+    while (getline(cin, line) && line != "quit") {
+        cout << respond(corpus, line);
+        cout.flush(); // one flush per response so the reader never waits on a partial answer
     }
-    if (std::max(max_dist_A_to_B, max_dist_B_to_A) <= KD_TOLERANCE) {
-        return true;
+    return 0;
+}
+
+/**
+ * Shard worker, started by --serve-shards: pins itself to cpus ("any" to leave it), loads its part of the corpus (see
+ * Corpus::setShard) and answers serve's protocol on a Unix socket at socket_path until it is stopped
+ */
+int shard(const string& corpus_dir, const string& socket_path, size_t shard, size_t shards, const string& cpus, size_t candidates,
+          const SampleOptions& sampling, const string& score_cache) {
+    if (cpus != "any" && !pinToCpus(cpus)) cerr << "shard " << shard << ": cannot pin to cpus " << cpus << ", running unpinned" << endl;
+    Corpus corpus; // loaded after pinning, so its memory comes from the pinned cpus' node
+    corpus.setShard(shard, shards);
+    string error;
+    if (!openCorpus(corpus, corpus_dir, candidates, sampling, score_cache, error)) {
+        cerr << "shard " << shard << ": " << error << endl;
+        return -1;
     }
-    return false;
+    mutex requestLock; // one request at a time, like serve
+    bool served = serveSocket(socket_path, [&](const string& line) {
+        auto received = chrono::steady_clock::now(); // the coordinator's deadline runs while this waits for the lock
+        lock_guard<mutex> guard(requestLock);
+        return respond(corpus, line, received);
+    });
+    if (!served) cerr << "shard " << shard << ": cannot listen on " << socket_path << endl;
+    return served ? 0 : -1;
 }
 
-bool OctTreeComparison(Octree& treeA, Octree& treeB) {
-    return Octree::compareOctree(treeA.getRoot(), treeB.getRoot(), OCT_TOLERANCE, OCT_THRESHOLD);
+string executablePath(const char* argv0) { // for starting shard workers
+    std::error_code error;
+    filesystem::path self = filesystem::read_symlink("/proc/self/exe", error);
+    return error ? filesystem::absolute(argv0).string() : self.string();
 }
 
-KDTree fillKD(const std::vector<Point>& vertices) {
-    KDTree tree;
-    for (Point p : vertices) {
-        tree.insert(p);
+/**
+ * Sharded resident mode: the same protocol as serve, answered by shards worker processes that each keep part of the corpus
+ * (see Shards.h); a search waits at most timeout_ms for every shard and answers OK <n> PARTIAL <answered>/<shards> without the
+ * ones it didn't hear from; READY <models> once every worker has loaded
+ */
+int serveShards(const ShardOptions& options, size_t shards) {
+    ShardCoordinator coordinator;
+    if (!coordinator.start(options, shards)) {
+        cout << "ERR cannot start the shards of " << options.corpus << endl;
+        return -1;
+    }
+    for (size_t s = 0; s < shards; ++s) cerr << "shard " << s << " on cpus " << coordinator.cpus(s) << endl;
+    cout << "READY " << coordinator.modelCount() << endl;
+    string line;
+    while (getline(cin, line) && line != "quit") {
+        cout << coordinator.respond(line);
+        cout.flush();
     }
-    return tree;
+    return 0;
 }
 
-Octree fillOct(const std::vector<Point>& vertices) {
-    Octree tree;
-    for (Point p : vertices) {
-        tree.insert(p);
+/**
+ * How throughput scales with the shard count: for 1, 2, 4, ... up to max_shards shards, every OFF file under queries is searched
+ * (k = 10, both algorithms, one query at a time) and one JSON record per shard count and algorithm goes to stdout
+ * queries should lie outside the corpus: a corpus model searched twice in a row is answered from the score cache
+ */
+int shardBench(ShardOptions options, const string& queries_dir, size_t max_shards) {
+    vector<OffFile> queries = offFiles(queries_dir);
+    if (queries.empty()) {
+        cerr << "no queries under " << queries_dir << endl;
+        return -1;
     }
-    return tree;
+    vector<size_t> counts;
+    for (size_t shards = 1; shards < max_shards; shards *= 2) counts.push_back(shards);
+    counts.push_back(max_shards);
+    for (size_t shards : counts) {
+        ShardCoordinator coordinator;
+        auto loading = chrono::steady_clock::now();
+        if (!coordinator.start(options, shards)) {
+            cerr << "cannot start " << shards << " shards" << endl;
+            return -1;
+        }
+        double loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - loading).count();
+        for (const char* algorithm : {"kdtree", "octree"}) {
+            vector<double> latencies;
+            size_t partial = 0;
+            auto start = chrono::steady_clock::now();
+            for (const OffFile& query : queries) {
+                auto sent = chrono::steady_clock::now();
+                string answer = coordinator.respond(string(algorithm) + " 10 " + filesystem::absolute(query.path).string());
+                latencies.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - sent).count());
+                if (answer.find(" PARTIAL ") < answer.find('\n') || answer.rfind("ERR", 0) == 0) partial++;
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            sort(latencies.begin(), latencies.end());
+            cout << "{\"name\": \"shards " << shards << " " << algorithm << "\", \"shards\": " << shards << ", \"cpus\": \"";
+            for (size_t s = 0; s < shards; ++s) cout << (s > 0 ? " " : "") << coordinator.cpus(s);
+            cout << "\", \"models\": " << coordinator.modelCount() << ", \"load_seconds\": " << loadSeconds << ", \"queries\": " << queries.size()
+                 << ", \"qps\": " << queries.size() / seconds << ", \"p50_ms\": " << latencies[latencies.size() / 2]
+                 << ", \"p99_ms\": " << latencies[latencies.size() * 99 / 100] << ", \"partial\": " << partial << "}" << endl;
+        }
+    }
+    return 0;
 }
 
 /**
- * ./executable <source_dir> <tree_toggle_boolean> <count>
+ * Batch mode: every pair of the corpus scored once into a matrix file (see Matrix.h), picking up where an interrupted run stopped
+ * progress and timing go to stderr, pairs found in the score cache file (when given) are not compared again
  */
-int main(int argc, char* argv[]) {
-    string source_dir = argv[1];
-    string tree_toggle = argv[2];
-    int count = stoi(argv[3]);
+int matrix(const string& corpus_dir, const string& algorithm, const string& output, const SampleOptions& sampling, const string& score_cache) {
+    Corpus corpus;
+    corpus.setSampling(sampling);
+    if (algorithm != "kdtree" && algorithm != "octree") return -1;
+    if (!score_cache.empty() && !corpus.openScoreCache(score_cache)) {
+        cerr << "cannot open score cache " << score_cache << endl;
+        return -1;
+    }
+    bool loaded = filesystem::is_regular_file(corpus_dir) ? corpus.loadIndex(corpus_dir) : corpus.load(corpus_dir);
+    if (!loaded) {
+        cerr << "cannot open corpus " << corpus_dir << endl;
+        return -1;
+    }
+    auto start = chrono::steady_clock::now();
+    vector<MatrixTile> tiles = corpus.matrixTiles(ThreadPool::shared().size());
+    vector<string> names = corpus.names();
+    MatrixWriter writer;
+    if (!writer.open(output, algorithm, samplingName(corpus.samplingOptions()), names, tiles)) {
+        cerr << "cannot write " << output << " (or its checkpoint is from another corpus, algorithm, sampling or thread count)" << endl;
+        return -1;
+    }
+    vector<size_t> todo;
+    for (size_t t = 0; t < tiles.size(); ++t)
+        if (!writer.done(t)) todo.push_back(t);
+    cerr << "matrix: " << names.size() << " models, " << tiles.size() << " tiles, " << tiles.size() - todo.size() << " from the checkpoint" << endl;
+    atomic<bool> failed(false);
+    corpus.compareTiles(algorithm, tiles, todo, [&](size_t tile, const vector<float>& scores) {
+        if (!writer.write(tile, tiles[tile], scores, names)) failed = true;
+    });
+    if (failed || !writer.finish()) {
+        cerr << "writing " << output << " failed, rerun to resume" << endl;
+        return -1;
+    }
+    cerr << "matrix: done in " << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " s" << endl;
+    return 0;
+}
 
-    vector<Point> source_vertices; // vector of 3d points
-    vector<Face> source_faces; // vector of face vectors
+// one level of detail of an OFF file's viewer geometry (see Geometry.h) written to stdout, through the cache file unless it is "-"
+int geometry(const string& offPath, const string& cachePath, uint32_t level) {
+    vector<uint8_t> buffer;
+    string error;
+    if (!loadGeometry(offPath, cachePath == "-" ? "" : cachePath, level, buffer, error)) {
+        cerr << error << endl;
+        return -1;
+    }
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    cout.write(reinterpret_cast<const char*>(buffer.data()), static_cast<streamsize>(buffer.size()));
+    return cout.flush() ? 0 : -1;
+}
 
-    KDTree source_KDTree;
-    Octree source_Octree;
-    if (tree_toggle == "kdtree") {
-        source_KDTree =  fillKD(source_vertices);
+template <typename T>
+bool parseNumber(const char* text, T& value) { // the whole argument as a number of T, false where stoul would throw or wrap ("abc", "-1", "3x")
+    const char* end = text + strlen(text);
+    auto [next, error] = from_chars(text, end, value);
+    return error == errc() && next == end && next != text;
+}
+
+/**
+ * ./executable <source_file> <kdtree | octree> <count> [corpus_dir] [sampling]     prints the count best matches, best first
+ *      a directory is streamed through the scan pipeline once (per stage throughput goes to stderr), an index file is searched
+ *      the query's stats (see serve) go to stderr as well
+ * ./executable --serve <corpus_dir | index_file> [candidates] [sampling] [score_cache]
+ * ./executable --serve-shards <corpus_dir | index_file> <shards> [candidates] [sampling] [score_cache] [timeout_ms]
+ * ./executable --shard-bench <corpus_dir | index_file> <queries_dir> <max_shards> [candidates] [sampling]
+ * ./executable --build-index <corpus_dir> <index_file> [sampling]
+ * ./executable --matrix <corpus_dir | index_file> <kdtree | octree> <output.csv | output.bin> [sampling] [score_cache]
+ * ./executable --geometry <off_file> <cache_file | -> [level]
+ * sampling :: (none (default) | voxel[:budget] | fps[:budget])[,q<bits>[,delta]], see Sampling.h and Quantized.h
+ */
+int main(int argc, char* argv[]) {
+    SampleOptions sampling;
+    if (argc > 1 && string(argv[1]) == "--serve") {
+        size_t candidates = 256;
+        if (argc < 3 || argc > 6 || (argc >= 4 && !parseNumber(argv[3], candidates)) || (argc >= 5 && !parseSampling(argv[4], sampling))) return -1;
+        return serve(argv[2], candidates, sampling, argc == 6 ? argv[5] : "");
+    }
+    if (argc > 1 && string(argv[1]) == "--shard") { // started by --serve-shards
+        size_t index, shards, candidates;
+        if ((argc != 9 && argc != 10) || !parseNumber(argv[4], index) || !parseNumber(argv[5], shards) || !parseNumber(argv[7], candidates)
+            || !parseSampling(argv[8], sampling))
+            return -1;
+        return shard(argv[2], argv[3], index, shards, argv[6], candidates, sampling, argc == 10 ? argv[9] : "");
+    }
+    if (argc > 1 && string(argv[1]) == "--serve-shards") {
+        ShardOptions options;
+        size_t shards;
+        if (argc < 4 || argc > 8 || !parseNumber(argv[3], shards) || (argc >= 5 && !parseNumber(argv[4], options.candidates))
+            || (argc >= 6 && !parseSampling(argv[5], options.sampling)) || (argc == 8 && (!parseNumber(argv[7], options.timeoutMs) || options.timeoutMs < 0)))
+            return -1;
+        options.executable = executablePath(argv[0]);
+        options.corpus = argv[2];
+        options.scoreCache = argc >= 7 ? argv[6] : "";
+        return serveShards(options, max<size_t>(shards, 1));
+    }
+    if (argc > 1 && string(argv[1]) == "--shard-bench") {
+        ShardOptions options;
+        size_t maxShards;
+        if (argc < 5 || argc > 7 || !parseNumber(argv[4], maxShards) || (argc >= 6 && !parseNumber(argv[5], options.candidates))
+            || (argc == 7 && !parseSampling(argv[6], options.sampling)))
+            return -1;
+        options.executable = executablePath(argv[0]);
+        options.corpus = argv[2];
+        options.timeoutMs = 60000; // measured, not cut off
+        return shardBench(options, argv[3], max<size_t>(maxShards, 1));
+    }
+    if (argc > 1 && string(argv[1]) == "--build-index") {
+        if ((argc != 4 && argc != 5) || (argc == 5 && !parseSampling(argv[4], sampling))) return -1;
+        return CorpusIndex::build(argv[2], argv[3], sampling) ? 0 : -1;
+    }
+    if (argc > 1 && string(argv[1]) == "--matrix") {
+        if (argc < 5 || argc > 7 || (argc >= 6 && !parseSampling(argv[5], sampling))) return -1;
+        return matrix(argv[2], argv[3], argv[4], sampling, argc == 7 ? argv[6] : "");
     }
-    else if (tree_toggle == "octree") {
-        source_Octree = fillOct(source_vertices);
+    if (argc > 1 && string(argv[1]) == "--geometry") {
+        uint32_t level = 0;
+        if ((argc != 4 && argc != 5) || (argc == 5 && !parseNumber(argv[4], level))) return -1;
+        return geometry(argv[2], argv[3], level);
     }
-    if (!loadOFF(source_dir, source_vertices, source_faces)) return -1;
+    size_t count;
+    if (argc < 4 || !parseNumber(argv[3], count) || (argc > 5 && !parseSampling(argv[5], sampling))) return -1;
 
-    string directory = "path/to/ModelNet10/class_name/"; // path to the directory containing the off files you want to load (by class here)
-    // make a directory iterator out of the path - iterate over the "entries"
-    int iteration = 0;
-    vector<string> filenames;
-    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
-        vector<Point> vertices; // vector of 3d points
-        vector<Face> faces; // vector of face vectors
+    string source_dir = argv[1];
+    string tree_toggle = argv[2];
+    string directory = argc > 4 ? argv[4] : "ModelNet10"; // the directory containing the off files to rank (or an index file)
 
-        if (!loadOFF(entry.path().string(), vertices, faces)) continue;
-        if (tree_toggle == "kdtree") {
-            KDTree KDTree =  fillKD(vertices);
-            KDTreeComparison(source_KDTree,  KDTree);
-            filenames.push_back(entry.path().string());
-        }
-        else if (tree_toggle == "octree") {
-            Octree Octree = fillOct(vertices);
-             if (OctTreeComparison(source_Octree, Octree)) {
-                 filenames.push_back(entry.path().string());
-             }
-        }
-        iteration++;
-        if (iteration == count) {
-            break;
-        }
+    Corpus corpus;
+    corpus.setSampling(sampling);
+    vector<Match> results;
+    QueryStats queryStats;
+    if (filesystem::is_regular_file(directory)) {
+        if (!corpus.loadIndex(directory) || !corpus.search(source_dir, tree_toggle, count, results)) return -1;
+    } else {
+        if (!corpus.scan(directory, source_dir, tree_toggle, count, results)) return -1;
+        corpus.scanReport()->print(cerr);
     }
+    for (const Match& match : results) cout << match.score << '\t' << match.name << '\n';
+    cerr << "STATS " << queryStats.finish() << endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -87,7 +87,9 @@ def compile_cpp_code():
     """Compile the existing C++ preprocessing code"""
     print("Compiling C++ preprocessing code...")
     
-    cpp_files = ['KDTree.cpp', 'Octree.cpp', 'preprocessing.cpp', 'main.cpp']
+    engine_files = ['generic.cpp', 'KDTree.cpp', 'Octree.cpp', 'Pyramid.cpp', 'Descriptor.cpp', 'ThreadPool.cpp', 'Simd.cpp', 'PointCloud.cpp', 'Quantized.cpp', 'Stats.cpp', 'Similarity.cpp', 'MappedFile.cpp', 'ScoreCache.cpp', 'Sampling.cpp', 'Matrix.cpp', 'CorpusIndex.cpp', 'Corpus.cpp', 'Shards.cpp', 'Geometry.cpp']
+    targets = {'similarity_search': 'main.cpp', 'benchmark': 'benchmark.cpp'}  # executable -> its main
+    cpp_files = engine_files + list(targets.values())
     missing_files = [f for f in cpp_files if not Path(f).exists()]
     
     if missing_files:
@@ -95,8 +97,12 @@ def compile_cpp_code():
         return False
     
     # Basic compilation (you may need to adjust flags for your system)
-    compile_cmd = "g++ -std=c++17 -O2 -o preprocessing main.cpp preprocessing.cpp"
-    result = run_command(compile_cmd)
+    result = True
+    for target, main_file in targets.items():
+        compile_cmd = f"g++ -std=c++20 -O2 -pthread -o {target} {' '.join(engine_files)} {main_file}"
+        result = run_command(compile_cmd) and result
+    
+    result = compile_python_module(engine_files) and result
     
     if result:
         print("C++ code compiled successfully")
@@ -105,6 +111,19 @@ def compile_cpp_code():
         print("Warning: C++ compilation failed. You may need to adjust compiler flags.")
         return False
 
+def compile_python_module(engine_files):
+    """Build the engine as the similarity_engine extension module, next to the backend that imports it"""
+    import sysconfig
+    include_dir = sysconfig.get_paths()['include']
+    if not Path(include_dir, 'Python.h').exists():
+        print("Warning: Python headers not found, the backend will use the similarity_search server instead")
+        return False
+    target = Path('backend') / f"similarity_engine{sysconfig.get_config_var('EXT_SUFFIX')}"
+    # a library must leave the host's operator new alone, so allocations aren't counted in the module
+    compile_cmd = (f"g++ -std=c++20 -O2 -pthread -shared -fPIC -DSIMILARITY_ALLOCATION_STATS=0 -I{include_dir} "
+                   f"-o {target} {' '.join(engine_files)} PythonModule.cpp")
+    return run_command(compile_cmd) is not None
+
 def create_integration_script():
     """Create a Python script to integrate C++ preprocessing with the web app"""
     integration_script = '''#!/usr/bin/env python3